@@ -0,0 +1,800 @@
+/*
+AirControlX benchmark harness: times the simulation core headlessly and
+writes the results as JSON, so runs of two versions can be compared.
+
+Build (next to atc_sim.cpp, no SFML needed):
+    g++ -std=c++17 -O2 -march=native atc_bench.cpp -o atc_bench -lpthread -lrt
+Run:
+    ./atc_bench [--out results.json] [--filter NAME] [--quick] [--seed N]
+
+Cases:
+    BM_RunwayGrant/threads:T   request_runway, a grant pass and release_runway
+                               from T threads on one airport (lock
+                               contention, never short of runways)
+    BM_RadarSweep/aircraft:N   radar_monitor() over an N-aircraft fleet; the
+                               counters split it into the position scan
+                               and the separation check
+    BM_ViolationCheck/changes:C  violation_check() draining C speed changes
+                               out of a 100k-aircraft fleet
+    BM_AvnLogging/records:N    issue_avn() for N flights until the writer
+                               thread has stored them all
+    BM_EndToEnd/flights:N      a whole virtual-clock run of the built-in
+                               scenario, in completed flights per second
+    BM_SteadyState/rate:R      R generated flights per minute, spawning and
+                               retiring; after a warm-up, counts heap
+                               allocations per event and FAILS on any
+    BM_RunwayArbitration/commercial:C  C commercial flights and an
+                               EMERGENCY one ask for a single runway at the
+                               same instant, the emergency last; FAILS
+                               unless it is always granted first
+    BM_Sequencing/POLICY       two hours of traffic near the capacity of a
+                               mixed three-runway airport, greedy grants
+                               against the look-ahead sequencer
+    BM_TraceSeek/seconds:S     records S simulated seconds of generated
+                               traffic, then seeks the replay to random
+                               times; FAILS if the replayed end state
+                               differs from the run's
+    BM_Settlement/portals:P    P airline portal processes settle AVNs through
+                               the payment gateway at once, in committed
+                               requests per second; FAILS if a request is
+                               refused or the log does not replay
+    BM_MonteCarlo/threads:T    a capacity-planning sweep of seeded runs on
+                               T threads, in runs per second; FAILS if the
+                               aggregates differ from the same sweep on one
+
+Every case runs in its own forked child inside a scratch directory, on a
+fresh simulation instance, so AVN files never land in the working
+directory. Inputs are seeded (--seed), and the clock is
+virtual, so a case does the same work on every run. The output follows
+Google Benchmark's JSON layout (context + benchmarks[]).
+*/
+
+// Built as one unit with the core so the cases can drive its internals
+#include "atc_sim.cpp"
+
+// ========================== ALLOCATION COUNTER ==============================
+
+/*
+Every operator new in the process (the core, the standard library
+containers and strings) bumps one counter, so a case can check that a
+stretch of simulation ran without touching the heap.
+*/
+
+atomic<long long> bench_allocations(0);
+
+// Out of line, so the compiler never sees malloc and free paired with
+// the wrong new or delete
+__attribute__((noinline)) void* bench_alloc(size_t size) {
+    bench_allocations.fetch_add(1, memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+__attribute__((noinline)) void bench_free(void* p) {
+    free(p);
+}
+
+void* operator new(size_t size) { return bench_alloc(size); }
+void* operator new[](size_t size) { return bench_alloc(size); }
+void operator delete(void* p) noexcept { bench_free(p); }
+void operator delete[](void* p) noexcept { bench_free(p); }
+void operator delete(void* p, size_t) noexcept { bench_free(p); }
+void operator delete[](void* p, size_t) noexcept { bench_free(p); }
+
+// ========================== HARNESS =========================================
+
+struct BenchResult {
+    char name[64];
+    long long iterations;
+    double real_ns;            // Per iteration
+    double items_per_second;
+    char counters[256];        // Extra JSON members: "\"key\": value, ..."
+    int ok;
+};
+
+typedef void (*BenchFn)(int arg, BenchResult* result);
+
+struct BenchOptions {
+    const char* filter;
+    bool quick;
+    uint64_t seed;
+    char scratch[64];          // mkdtemp() directory the children work in
+};
+
+BenchOptions bench;
+vector<BenchResult> bench_results;
+int bench_failures = 0;
+
+// State every case starts from: virtual clock, no console output, a seed
+void bench_core_init() {
+    init_speed_limit_table();
+    sim = atc_state_new(); // Freed with the child
+    sim->avn_store_path = AVN_STORE_PATH;
+    sim->avn_log_path = AVN_LOG_PATH;
+    sim->sim_seed = bench.seed;
+    sim_clock_init(CLOCK_MODE_VIRTUAL, 1.0);
+    sim->event_log.level = LOG_OFF;
+    fleet_init();
+    unlink(AVN_STORE_PATH);    // Left by the previous case
+}
+
+int bench_tick_workers() {
+    return min(8, max(1, (int)sysconf(_SC_NPROCESSORS_ONLN)));
+}
+
+// Runs fn(arg) in a child process and collects its result through a pipe
+void bench_run(const char* name, BenchFn fn, int arg) {
+    if (bench.filter && !strstr(name, bench.filter)) {
+        return;
+    }
+    fprintf(stderr, "[Bench] %-32s ", name);
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        return;
+    }
+    fflush(NULL);
+    pid_t child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        BenchResult result;
+        memset(&result, 0, sizeof(result));
+        if (chdir(bench.scratch) == 0) {
+            result.ok = 1; // A case clears it to fail
+            fn(arg, &result);
+        }
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(written == (ssize_t)sizeof(result) ? 0 : 1);
+    }
+    close(fds[1]);
+    BenchResult result;
+    memset(&result, 0, sizeof(result));
+    ssize_t got = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    waitpid(child, NULL, 0);
+    if (got != (ssize_t)sizeof(result) || !result.ok) {
+        fprintf(stderr, "FAILED%s%s\n", result.counters[0] ? "  " : "", result.counters);
+        bench_failures++;
+        return;
+    }
+    snprintf(result.name, sizeof(result.name), "%s", name);
+    fprintf(stderr, "%14.1f ns/iter %16.0f items/s\n", result.real_ns, result.items_per_second);
+    bench_results.push_back(result);
+}
+
+void bench_write_json(FILE* out) {
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+    time_t now = time(NULL);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+    fprintf(out, "{\n  \"context\": {\n");
+    fprintf(out, "    \"date\": \"%s\",\n    \"host_name\": \"%s\",\n", date, host);
+    fprintf(out, "    \"executable\": \"atc_bench\",\n    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(out, "    \"speed_kernel\": \"%s\",\n    \"seed\": %llu,\n    \"quick\": %s\n  },\n",
+            SPEED_KERNEL_ISA, (unsigned long long)bench.seed, bench.quick ? "true" : "false");
+    fprintf(out, "  \"benchmarks\": [");
+    for (size_t b = 0; b < bench_results.size(); ++b) {
+        const BenchResult& r = bench_results[b];
+        fprintf(out, "%s\n    {\"name\": \"%s\", \"run_type\": \"iteration\", \"iterations\": %lld, "
+                     "\"real_time\": %.3f, \"time_unit\": \"ns\", \"items_per_second\": %.3f%s%s}",
+                b ? "," : "", r.name, r.iterations, r.real_ns, r.items_per_second,
+                r.counters[0] ? ", " : "", r.counters);
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+// ========================== CASES ===========================================
+
+// Runway grants: T threads, each with its own flight, take and release a
+// runway on a 64-runway airport. A request only queues; each thread then
+// runs the grant pass itself instead of the scheduler, and there are
+// always enough runways for every waiter. The cost is the airport lock
+// plus the queue and bitmap work under it. (The pass event armed by the
+// first request is never run, so no more are scheduled.)
+const int GRANT_RUNWAYS = 64;
+long long grant_iterations = 0;
+pthread_barrier_t grant_barrier;
+
+void* grant_thread(void* arg) {
+    int aircraft = (int)(intptr_t)arg;
+    Aircraft& flight = fleet_aircraft(aircraft);
+    Airport& airport = sim->airports[flight.airport];
+    int granted[MAX_AIRPORT_RUNWAYS];
+    pthread_barrier_wait(&grant_barrier);
+    for (long long it = 0; it < grant_iterations; ++it) {
+        request_runway(aircraft);
+        long long locked_at = timed_lock(&airport.lock, METRIC_AIRPORT_LOCK_WAIT);
+        runway_grant_pass_locked(airport, sim_now_us(), granted);
+        int runway = flight.runway; // Set under the lock, by this pass or another thread's
+        timed_unlock(&airport.lock, METRIC_AIRPORT_LOCK_HOLD, locked_at);
+        if (runway >= 0) {
+            flight.runway = -1;
+            release_runway(&sim->runways[runway], -1);
+        }
+    }
+    return nullptr;
+}
+
+void bench_runway_grant(int threads, BenchResult* result) {
+    bench_core_init();
+    add_airport("BNC", 0.f, 0.f);
+    for (int r = 0; r < GRANT_RUNWAYS; ++r) {
+        char name[16];
+        snprintf(name, sizeof(name), "RWY-%02d", r);
+        add_runway(name, (1 << RUNWAY_CLASSES) - 1, 1000000);
+    }
+    airports_init();
+    scheduler_init(1, 1024);
+    for (int t = 0; t < threads; ++t) {
+        char flight_number[10];
+        snprintf(flight_number, sizeof(flight_number), "GR%d", t % 100);
+        fleet_add(flight_number, COMMERCIAL, ARRIVAL, 0);
+    }
+
+    grant_iterations = bench.quick ? 100000 : 1000000;
+    vector<pthread_t> workers(threads);
+    pthread_barrier_init(&grant_barrier, NULL, threads + 1);
+    for (int t = 0; t < threads; ++t) {
+        sim_thread_create(&workers[t], grant_thread, (void*)(intptr_t)t);
+    }
+    long long start = monotonic_ns();
+    pthread_barrier_wait(&grant_barrier);
+    for (int t = 0; t < threads; ++t) {
+        pthread_join(workers[t], NULL);
+    }
+    long long elapsed = monotonic_ns() - start;
+
+    long long grants = grant_iterations * threads;
+    MetricSummary wait;
+    metric_merge(METRIC_AIRPORT_LOCK_WAIT, &wait);
+    result->iterations = grants;
+    result->real_ns = (double)elapsed / grants;
+    result->items_per_second = grants / (elapsed / 1e9);
+    snprintf(result->counters, sizeof(result->counters),
+             "\"threads\": %d, \"contended_fraction\": %.4f, \"lock_wait_p99_ns\": %llu",
+             threads, wait.total ? (double)wait.contended / wait.total : 0.0,
+             (unsigned long long)metric_quantile(wait, 0.99));
+}
+
+// Radar sweeps over a synthetic fleet, the clock moving one radar period
+// per sweep. The speeders are fined by one violation check first, untimed.
+void bench_radar_sweep(int n, BenchResult* result) {
+    bench_core_init();
+    default_airport_config();
+    airports_init();
+    scheduler_init(1, 1024);
+    n = fleet_fill_synthetic(n, bench.seed);
+    avn_log_start();
+    tick_pool_start(bench_tick_workers());
+    sim->scenario_drained = true;   // Nothing to ingest: the radar won't reschedule
+    sim->active_flights = 0;
+
+    violation_check();
+    radar_monitor();
+    int sweeps = max(5, (bench.quick ? 20000000 : 100000000) / n);
+    long long scan_before = sim->radar_scan_ns_total;
+    long long start = monotonic_ns();
+    for (int it = 0; it < sweeps; ++it) {
+        sim->sim_clock.virtual_us += sim->radar_period_us;
+        radar_monitor();
+    }
+    long long elapsed = monotonic_ns() - start;
+    tick_pool_stop();
+    avn_log_stop();
+
+    result->iterations = sweeps;
+    result->real_ns = (double)elapsed / sweeps;
+    result->items_per_second = (double)n * sweeps / (elapsed / 1e9);
+    // Split so the SoA position scan can be judged on its own: the
+    // separation check (grid relinks and pair search) runs inside the
+    // same sweep and costs more than the scan at every size
+    long long scan_ns = sim->radar_scan_ns_total - scan_before;
+    snprintf(result->counters, sizeof(result->counters),
+             "\"aircraft\": %d, \"tick_workers\": %d, \"scan_us\": %.1f, \"separation_us\": %.1f, "
+             "\"separation_losses\": %lld",
+             n, bench_tick_workers(), scan_ns / 1e3 / sweeps, (elapsed - scan_ns) / 1e3 / sweeps,
+             sim->separation_losses);
+}
+
+// Event-driven speed checks: C flights of a large fleet change speed
+// between drains; the drain should cost per change, not per aircraft
+const int VIOLATION_FLEET = 100000;
+
+void bench_violation_check(int changes, BenchResult* result) {
+    bench_core_init();
+    default_airport_config();
+    airports_init();
+    scheduler_init(1, 1024);
+    int n = fleet_fill_synthetic(VIOLATION_FLEET, bench.seed);
+    avn_log_start();
+    violation_check(); // Fines the synthetic speeders; later drains find none new
+
+    uint64_t rng = bench.seed;
+    int rounds = max(10, (bench.quick ? 2000000 : 20000000) / changes);
+    long long elapsed = 0;
+    for (int it = 0; it < rounds; ++it) {
+        for (int k = 0; k < changes; ++k) {
+            violation_mark_dirty((int)(splitmix64(&rng) % n));
+        }
+        long long start = monotonic_ns();
+        violation_check();
+        elapsed += monotonic_ns() - start;
+    }
+    avn_log_stop();
+
+    result->iterations = rounds;
+    result->real_ns = (double)elapsed / rounds;
+    result->items_per_second = (double)changes * rounds / (elapsed / 1e9);
+    snprintf(result->counters, sizeof(result->counters),
+             "\"fleet\": %d, \"changes\": %d, \"ns_per_change\": %.1f",
+             n, changes, (double)elapsed / rounds / changes);
+}
+
+// AVN logging: one AVN per flight, timed until the writer thread has put
+// every record in the store and the text log
+void bench_avn_logging(int n, BenchResult* result) {
+    bench_core_init();
+    default_airport_config();
+    airports_init();
+    n = fleet_fill_synthetic(n, bench.seed);
+    avn_log_start();
+
+    long long start = monotonic_ns();
+    for (int i = 0; i < n; ++i) {
+        const FleetChunk* chunk = fleet_chunk(i);
+        int s = fleet_slot(i);
+        issue_avn(i, (Phase)chunk->phase[s], chunk->speed[s], "Benchmark violation");
+    }
+    long long pushed = monotonic_ns();
+    avn_log_stop();
+    long long elapsed = monotonic_ns() - start;
+
+    result->iterations = n;
+    result->real_ns = (double)elapsed / n;
+    result->items_per_second = n / (elapsed / 1e9);
+    snprintf(result->counters, sizeof(result->counters),
+             "\"issue_ns\": %.1f, \"ring_full_waits\": %lld",
+             (double)(pushed - start) / n, sim->avn_log.full_waits.load());
+}
+
+// End to end: the built-in scenario scaled to n flights, run on the
+// virtual clock until every flight has finished
+void bench_end_to_end(int n, BenchResult* result) {
+    bench_core_init();
+    default_airport_config();
+    airports_init();
+    scenario_builtin(&sim->scenario, n);
+    sim->scenario.has_next = scenario_read(&sim->scenario, &sim->scenario.next);
+    sim->sim_end_us = 1000000LL * 1000000; // Far enough that the flights finish first
+    avn_log_start();
+    tick_pool_start(bench_tick_workers());
+    scheduler_init((int)sim->airports.size(), 1024);
+
+    long long start = monotonic_ns();
+    ingest_flights();
+    schedule_event(-1, EV_RADAR_SWEEP, 0);
+    schedule_event(-1, EV_SIM_END, sim->sim_end_us);
+    scheduler_run_virtual(LLONG_MAX);
+    long long elapsed = monotonic_ns() - start;
+    tick_pool_stop();
+    avn_log_stop();
+
+    long long flights = sim->fleet.admitted - sim->active_flights;
+    result->iterations = flights;
+    result->real_ns = flights ? (double)elapsed / flights : 0.0;
+    result->items_per_second = flights / (elapsed / 1e9);
+    snprintf(result->counters, sizeof(result->counters),
+             "\"flights\": %lld, \"radar_sweeps\": %lld, \"avns\": %lld",
+             flights, sim->radar_sweeps, (long long)sim->avn_log.tail.load());
+}
+
+// Steady state: generated traffic at rate flights per minute on the
+// 64-runway airport, below its capacity, so flights keep spawning and
+// retiring while the fleet stays level. The first STEADY_WARMUP_S simulated seconds
+// grow every pool and queue to its working size; the next STEADY_WINDOW_S
+// must then run without a single heap allocation.
+const long long STEADY_WARMUP_S = 600;
+const long long STEADY_WINDOW_S = 600;
+
+// Fleet pages actually in memory (chunks are mmapped and filled lazily)
+long long fleet_resident_bytes() {
+    long long page = sysconf(_SC_PAGESIZE);
+    size_t pages = (sizeof(FleetChunk) + page - 1) / page;
+    vector<unsigned char> resident(pages);
+    long long bytes = 0;
+    for (int c = 0; c < FLEET_MAX_CHUNKS && sim->fleet.chunks[c]; ++c) {
+        if (mincore(sim->fleet.chunks[c], sizeof(FleetChunk), resident.data()) == 0) {
+            for (size_t p = 0; p < pages; ++p) {
+                bytes += (resident[p] & 1) ? page : 0;
+            }
+        }
+    }
+    return bytes;
+}
+
+long long scheduled_events() {
+    long long events = 0;
+    for (int p = 0; p < sim->num_partitions; ++p) {
+        events += sim->schedulers[p].next_seq;
+    }
+    return events;
+}
+
+void bench_steady_state(int rate, BenchResult* result) {
+    bench_core_init();
+    add_airport("BNC", 0.f, 0.f);
+    for (int r = 0; r < GRANT_RUNWAYS; ++r) {
+        char name[16];
+        snprintf(name, sizeof(name), "RWY-%02d", r);
+        add_runway(name, (1 << RUNWAY_CLASSES) - 1, PHASE_DURATION_S * 1000000LL);
+    }
+    airports_init();
+    const double mix[3] = {60, 25, 15};
+    scenario_generator(&sim->scenario, rate, mix, bench.seed, -1);
+    sim->scenario.has_next = scenario_read(&sim->scenario, &sim->scenario.next);
+    sim->sim_end_us = (STEADY_WARMUP_S + STEADY_WINDOW_S + 1) * 1000000LL;
+    avn_log_start();
+    tick_pool_start(bench_tick_workers());
+    scheduler_init((int)sim->airports.size(), 1024);
+    ingest_flights();
+    schedule_event(-1, EV_RADAR_SWEEP, 0);
+    schedule_event(-1, EV_SIM_END, sim->sim_end_us);
+    scheduler_run_virtual(STEADY_WARMUP_S * 1000000LL);
+
+    long long events_before = scheduled_events();
+    long long allocations_before = bench_allocations.load();
+    long long start = monotonic_ns();
+    scheduler_run_virtual((STEADY_WARMUP_S + STEADY_WINDOW_S) * 1000000LL);
+    long long elapsed = monotonic_ns() - start;
+    long long allocations = bench_allocations.load() - allocations_before;
+    long long events = scheduled_events() - events_before;
+    int active = sim->active_flights;
+    int slots = fleet_size();
+    long long fleet_bytes = fleet_resident_bytes();
+    tick_pool_stop();
+    avn_log_stop();
+
+    result->iterations = events;
+    result->real_ns = events ? (double)elapsed / events : 0.0;
+    result->items_per_second = events / (elapsed / 1e9);
+    snprintf(result->counters, sizeof(result->counters),
+             "\"events\": %lld, \"allocations\": %lld, \"allocs_per_event\": %.6f, "
+             "\"active_flights\": %d, \"fleet_slots\": %d, \"fleet_bytes_per_active\": %.1f",
+             events, allocations, events ? (double)allocations / events : 0.0,
+             active, slots, active ? (double)fleet_bytes / active : 0.0);
+    if (allocations > 0) {
+        result->ok = 0;
+    }
+}
+
+// Same-instant arbitration on a one-runway airport: every round, C
+// commercial arrivals and then one EMERGENCY arrival ask for the runway
+// at the same instant, the emergency dispatched last. Items are grants.
+// FAILS unless every emergency is granted at the instant it asked.
+const long long ARBITRATION_OCCUPANCY_US = 1000000;
+
+void bench_runway_arbitration(int commercial, BenchResult* result) {
+    bench_core_init();
+    add_airport("ARB", 0.f, 0.f);
+    add_runway("ARB/09", (1 << RUNWAY_CLASSES) - 1, ARBITRATION_OCCUPANCY_US);
+    airports_init();
+    avn_log_start();
+    scheduler_init(1, 1024);
+    int rounds = bench.quick ? 1000 : 10000;
+    long long round_us = (commercial + 2) * ARBITRATION_OCCUPANCY_US; // Runway idle again by the next
+    for (int round = 0; round < rounds; ++round) {
+        for (int k = 0; k <= commercial; ++k) {
+            char flight_number[10];
+            snprintf(flight_number, sizeof(flight_number), "%s%d", k < commercial ? "AR" : "AE", round % 100000);
+            int aircraft = fleet_add(flight_number, k < commercial ? COMMERCIAL : EMERGENCY, ARRIVAL, 0);
+            fleet_aircraft(aircraft).phase_index = 2; // LANDING
+            schedule_event(aircraft, EV_RUNWAY_REQUEST, round * round_us);
+        }
+    }
+
+    long long start = monotonic_ns();
+    scheduler_run_virtual(LLONG_MAX);
+    long long elapsed = monotonic_ns() - start;
+    avn_log_stop();
+
+    const Airport& airport = sim->airports[0];
+    const MetricSummary& waits = *airport.wait_hist;
+    const MetricSummary& emergency = *airport.emergency_wait_hist;
+    result->iterations = waits.total;
+    result->real_ns = waits.total ? (double)elapsed / waits.total : 0.0;
+    result->items_per_second = waits.total / (elapsed / 1e9);
+    snprintf(result->counters, sizeof(result->counters),
+             "\"commercial_per_round\": %d, \"emergency_grants\": %llu, \"emergency_max_wait_s\": %.3f, "
+             "\"mean_wait_s\": %.3f",
+             commercial, (unsigned long long)emergency.total, emergency.max / 1e6,
+             waits.total ? waits.sum / 1e6 / waits.total : 0.0);
+    if ((long long)emergency.total != rounds || emergency.max != 0 ||
+        (long long)waits.total != (long long)rounds * (commercial + 1)) {
+        result->ok = 0;
+    }
+}
+
+// Runway sequencing: the same generated traffic on a mixed airport, one
+// case per policy. Two runways take everything in 3 s, a third only
+// commercial and cargo departures in 5 s, and the rate sits just below
+// what the three can move. Items are runway movements; the counters hold
+// movements per hour, mean delays, and the look-ahead's re-plan cost.
+const long long SEQUENCING_HOURS = 2;
+const double SEQUENCING_RATE = 50;      // Flights per minute; the runways move 52
+
+void bench_sequencing(int policy, BenchResult* result) {
+    bench_core_init();
+    sim->sequencing = (SequencingPolicy)policy;
+    add_airport("SEQ", 0.f, 0.f);
+    add_runway("SEQ/09L", (1 << RUNWAY_CLASSES) - 1, 3000000);
+    add_runway("SEQ/09R", (1 << RUNWAY_CLASSES) - 1, 3000000);
+    unsigned char short_departures = (1 << runway_class(DEPARTURE, COMMERCIAL)) | (1 << runway_class(DEPARTURE, CARGO));
+    add_runway("SEQ/04", short_departures, 5000000);
+    airports_init();
+    const double mix[3] = {60, 25, 15};
+    scenario_generator(&sim->scenario, SEQUENCING_RATE, mix, bench.seed, -1);
+    sim->scenario.has_next = scenario_read(&sim->scenario, &sim->scenario.next);
+    sim->sim_end_us = SEQUENCING_HOURS * 3600 * 1000000LL;
+    avn_log_start();
+    scheduler_init(1, 1024);
+    ingest_flights();
+    schedule_event(-1, EV_SIM_END, sim->sim_end_us);
+
+    long long start = monotonic_ns();
+    scheduler_run_virtual(LLONG_MAX);
+    long long elapsed = monotonic_ns() - start;
+    avn_log_stop();
+
+    const Airport& airport = sim->airports[0];
+    long long movements = 0;
+    for (int r = 0; r < airport.num_runways; ++r) {
+        movements += sim->runways[airport.first_runway + r].movements;
+    }
+    const MetricSummary& waits = *airport.wait_hist;
+    const MetricSummary& emergency = *airport.emergency_wait_hist;
+    MetricSummary* plans = new MetricSummary;
+    metric_merge(METRIC_SEQUENCER_PLAN, plans);
+    result->iterations = movements;
+    result->real_ns = movements ? (double)elapsed / movements : 0.0;
+    result->items_per_second = movements / (elapsed / 1e9);
+    snprintf(result->counters, sizeof(result->counters),
+             "\"policy\": \"%s\", \"movements_per_hour\": %.1f, \"mean_delay_s\": %.3f, "
+             "\"p99_delay_s\": %.3f, \"emergency_mean_delay_s\": %.3f, \"emergency_max_delay_s\": %.3f, "
+             "\"replan_p99_us\": %.1f",
+             SEQUENCING_NAMES[policy], movements / (double)SEQUENCING_HOURS,
+             waits.total ? waits.sum / 1e6 / waits.total : 0.0, metric_quantile(waits, 0.99) / 1e6,
+             emergency.total ? emergency.sum / 1e6 / emergency.total : 0.0, emergency.max / 1e6,
+             metric_quantile(*plans, 0.99) / 1e3);
+    delete plans;
+}
+
+// Record/replay: a whole run through the public API with --record, then
+// random seeks over the trace. Items are seeks.
+const char* BENCH_TRACE_PATH = "trace.bin";
+
+void bench_trace_seek(int seconds, BenchResult* result) {
+    FILE* console = fopen("/dev/null", "w");
+    AtcConfig config;
+    config.clock_mode = CLOCK_MODE_VIRTUAL;
+    config.duration_s = seconds;
+    config.seed = bench.seed;
+    config.generate_rate = 30;  // Half the default airport's runway capacity
+    config.log_level = LOG_OFF;
+    config.console = console;
+    config.avn_channel_name = NULL;
+    config.snapshot_hz = 0;
+    config.tick_workers = bench_tick_workers();
+    config.trace_path = BENCH_TRACE_PATH;
+    AtcStats run;
+    {
+        AtcSimulation simulation(config);
+        simulation.run();
+        run = simulation.stats();
+    }
+    fclose(console);
+    struct stat st;
+    long long trace_bytes = stat(BENCH_TRACE_PATH, &st) == 0 ? st.st_size : 0;
+
+    AtcReplay replay;
+    if (!replay.open(BENCH_TRACE_PATH)) {
+        result->ok = 0;
+        snprintf(result->counters, sizeof(result->counters), "\"error\": \"trace unreadable\"");
+        return;
+    }
+    replay.seek(replay.end_us());
+    AtcStats end = replay.stats();
+    bool match = end.flights_admitted == run.flights_admitted && end.active_flights == run.active_flights &&
+                 end.avns_issued == run.avns_issued;
+
+    const int SEEKS = 2000;
+    uint64_t rng = bench.seed;
+    long long start = monotonic_ns();
+    for (int k = 0; k < SEEKS; ++k) {
+        replay.seek((long long)(splitmix64(&rng) % (uint64_t)(replay.end_us() + 1)));
+    }
+    long long elapsed = monotonic_ns() - start;
+    unlink(BENCH_TRACE_PATH);
+
+    result->iterations = SEEKS;
+    result->real_ns = (double)elapsed / SEEKS;
+    result->items_per_second = SEEKS / (elapsed / 1e9);
+    snprintf(result->counters, sizeof(result->counters),
+             "\"trace_bytes\": %lld, \"flights\": %lld, \"avns\": %lld, \"replay_matches\": %s",
+             trace_bytes, run.flights_admitted, run.avns_issued, match ? "true" : "false");
+    if (!match) {
+        result->ok = 0;
+    }
+}
+
+// Settlement: P portal processes pay, and partly first appeal, their
+// airline's AVNs through the gateway, which commits each group of
+// concurrent requests with one fdatasync. Items are requests; the counters
+// hold the commit latency the portals saw and how many requests each
+// fsync carried. The same total work at every P.
+void bench_settlement(int portals, BenchResult* result) {
+    int avns = bench.quick ? 4000 : 20000;
+    PaymentLoadResult r;
+    if (!payment_load_test(portals, avns / portals, &r) || r.requests == 0) {
+        result->ok = 0;
+        snprintf(result->counters, sizeof(result->counters), "\"error\": \"gateway setup failed\"");
+        delete r.latency;
+        return;
+    }
+    long long committed = r.requests - r.failures;
+    result->iterations = r.requests;
+    result->real_ns = r.seconds * 1e9 / r.requests;
+    result->items_per_second = committed / r.seconds;
+    snprintf(result->counters, sizeof(result->counters),
+             "\"portals\": %d, \"p50_commit_us\": %.1f, \"p99_commit_us\": %.1f, \"group_commits\": %llu, "
+             "\"requests_per_fsync\": %.2f, \"fsync_mean_us\": %.1f, \"failures\": %lld, \"recovered\": %s",
+             portals, metric_quantile(*r.latency, 0.50) / 1e3, metric_quantile(*r.latency, 0.99) / 1e3,
+             (unsigned long long)r.commits, r.commits ? (double)committed / r.commits : 0.0,
+             r.commits ? r.commit_ns / 1e3 / r.commits : 0.0, r.failures, r.recovered ? "true" : "false");
+    if (r.failures || !r.recovered) {
+        result->ok = 0;
+    }
+    delete r.latency;
+}
+
+// Monte Carlo: a 2 x 2 grid (runway count x traffic mix) of short
+// generated runs spread over T threads. Items are runs. The same sweep is
+// then repeated on one thread, and every point's summaries must match:
+// which thread ran which job can't change the result.
+void bench_monte_carlo(int threads, BenchResult* result) {
+    AtcConfig base;
+    base.duration_s = 300;
+    base.seed = bench.seed;
+    base.generate_rate = 40;
+    MonteCarloPlan plan;
+    plan.runs = bench.quick ? 16 : 64;
+    plan.runways.push_back(2);
+    plan.runways.push_back(3);
+    const double mixes[] = { 60, 25, 15, 40, 40, 20 };
+    plan.mixes.assign(mixes, mixes + 6);
+
+    McSweep parallel, serial;
+    mc_sweep_init(&parallel, base, plan);
+    mc_sweep_init(&serial, base, plan);
+    double seconds = mc_sweep_run(&parallel, threads);
+    mc_sweep_run(&serial, 1);
+    bool match = parallel.failed == 0 && serial.failed == 0;
+    for (size_t p = 0; p < parallel.points.size() && match; ++p) {
+        for (int m = 0; m < MC_METRICS && match; ++m) {
+            const McStat& a = parallel.points[p].stats[m];
+            const McStat& b = serial.points[p].stats[m];
+            match = a.n == b.n && memcmp(a.hist, b.hist, sizeof(MetricSummary)) == 0 &&
+                    fabs(a.mean - b.mean) <= 1e-9 * (1 + fabs(b.mean));
+        }
+    }
+    long long runs = (long long)parallel.points.size() * plan.runs;
+    const McStat& busy = parallel.points[0].stats[MC_DELAY_MEAN]; // Two runways, the first mix
+    result->iterations = runs;
+    result->real_ns = seconds * 1e9 / runs;
+    result->items_per_second = runs / seconds;
+    snprintf(result->counters, sizeof(result->counters),
+             "\"threads\": %d, \"points\": %zu, \"runs_per_point\": %d, \"two_runway_delay_mean_s\": %.3f, "
+             "\"two_runway_delay_ci95_s\": %.3f, \"matches_serial\": %s",
+             threads, parallel.points.size(), plan.runs, busy.mean, mc_mean_ci(busy), match ? "true" : "false");
+    if (!match) {
+        result->ok = 0;
+    }
+    mc_sweep_free(&parallel);
+    mc_sweep_free(&serial);
+}
+
+// ========================== MAIN FUNCTION ===================================
+
+int main(int argc, char* argv[]) {
+    const char* out_path = NULL;
+    bench.filter = NULL;
+    bench.quick = false;
+    bench.seed = 1;
+    for (int a = 1; a < argc; ++a) {
+        bool has_value = a + 1 < argc;
+        if (strcmp(argv[a], "--out") == 0 && has_value) {
+            out_path = argv[++a];
+        } else if (strcmp(argv[a], "--filter") == 0 && has_value) {
+            bench.filter = argv[++a];
+        } else if (strcmp(argv[a], "--quick") == 0) {
+            bench.quick = true;
+        } else if (strcmp(argv[a], "--seed") == 0 && has_value) {
+            bench.seed = strtoull(argv[++a], NULL, 10);
+        } else {
+            fprintf(stderr, "usage: %s [--out FILE] [--filter NAME] [--quick] [--seed N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    snprintf(bench.scratch, sizeof(bench.scratch), "/tmp/atc_bench.XXXXXX");
+    if (!mkdtemp(bench.scratch)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    char name[64];
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        snprintf(name, sizeof(name), "BM_RunwayGrant/threads:%d", threads);
+        bench_run(name, bench_runway_grant, threads);
+    }
+    int max_fleet = bench.quick ? 100000 : 1000000;
+    for (int n = 1000; n <= max_fleet; n *= 10) {
+        snprintf(name, sizeof(name), "BM_RadarSweep/aircraft:%d", n);
+        bench_run(name, bench_radar_sweep, n);
+    }
+    for (int changes = 10; changes <= 10000; changes *= 10) {
+        snprintf(name, sizeof(name), "BM_ViolationCheck/changes:%d", changes);
+        bench_run(name, bench_violation_check, changes);
+    }
+    snprintf(name, sizeof(name), "BM_AvnLogging/records:%d", bench.quick ? 100000 : 1000000);
+    bench_run(name, bench_avn_logging, bench.quick ? 100000 : 1000000);
+    for (int n = 1000; n <= (bench.quick ? 1000 : 10000); n *= 10) {
+        snprintf(name, sizeof(name), "BM_EndToEnd/flights:%d", n);
+        bench_run(name, bench_end_to_end, n);
+    }
+    for (int rate = 100; rate <= (bench.quick ? 100 : 1000); rate *= 10) {
+        snprintf(name, sizeof(name), "BM_SteadyState/rate:%d", rate);
+        bench_run(name, bench_steady_state, rate);
+    }
+    for (int commercial = 1; commercial <= 4; commercial *= 4) {
+        snprintf(name, sizeof(name), "BM_RunwayArbitration/commercial:%d", commercial);
+        bench_run(name, bench_runway_arbitration, commercial);
+    }
+    for (int policy = SEQUENCING_GREEDY; policy <= SEQUENCING_LOOKAHEAD; ++policy) {
+        snprintf(name, sizeof(name), "BM_Sequencing/%s", SEQUENCING_NAMES[policy]);
+        bench_run(name, bench_sequencing, policy);
+    }
+    snprintf(name, sizeof(name), "BM_TraceSeek/seconds:%d", bench.quick ? 600 : 3600);
+    bench_run(name, bench_trace_seek, bench.quick ? 600 : 3600);
+    for (int portals = 1; portals <= 16; portals *= 4) {
+        snprintf(name, sizeof(name), "BM_Settlement/portals:%d", portals);
+        bench_run(name, bench_settlement, portals);
+    }
+    for (int threads = 1; threads <= 4; threads *= 4) {
+        snprintf(name, sizeof(name), "BM_MonteCarlo/threads:%d", threads);
+        bench_run(name, bench_monte_carlo, threads);
+    }
+
+    // The children leave their AVN files behind
+    const char* leftovers[] = { AVN_STORE_PATH, AVN_LOG_PATH };
+    for (int f = 0; f < 2; ++f) {
+        string path = string(bench.scratch) + "/" + leftovers[f];
+        unlink(path.c_str());
+    }
+    rmdir(bench.scratch);
+
+    FILE* out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        perror(out_path);
+        return 1;
+    }
+    bench_write_json(out);
+    if (out != stdout) {
+        fclose(out);
+    }
+    return bench_results.empty() || bench_failures ? 1 : 0;
+}
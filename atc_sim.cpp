@@ -0,0 +1,6927 @@
+ /*
+    🧚✈️ AIR TRAFFIC CONTROL SIMULATOR ✈️🧚
+       BY EMAN IHSAN AND FATIMA TUZ ZAHRA
+
+
+
+--------------------------------- MOD1 ----------------------------------
+Aircraft Movement & Speed Violation Monitoring
+- Each aircraft simulates a full journey: either ARRIVAL or DEPARTURE.
+- Journeys are driven by a discrete-event scheduler: every phase transition is
+  a timed event, and a small fixed pool of worker threads runs the handlers.
+- ARRIVAL aircraft pass through: HOLDING → APPROACH → LANDING → TAXI → GATE.
+- DEPARTURE aircraft pass through: GATE → TAXI → TAKEOFF → CLIMB → CRUISE.
+- Speed is randomized in each phase (smtimes outside limits).
+- Speed violations are checked the moment a phase sets a new speed (the
+  flight is marked in a dirty set the violation monitor drains); a periodic
+  radar sweep checks separation.
+- AVNS are once per aircraft for any speed issue.
+- Hot aircraft state (phase, speed, position, flags) lives in a
+  structure-of-arrays store published through per-aircraft seqlocks, so the
+  radar and the renderer read it without taking any lock. An aircraft has at
+  most one pending event, so each slot has a single writer.
+
+--------------------------------- MOD2 ----------------------------------
+Runway Synchronization & Priority-Based Access
+- Runways belong to airports loaded from --airports (default: one airport with
+  RWY-A, RWY-B, RWY-C). Each runway serves some directions and aircraft types
+  and has its own occupancy time.
+- Only one aircraft may use a runway at a time; access is synchronized.
+- Runway ownership is a per-airport bitmap of free runways per capability
+  class, guarded by that airport's lock (not a per-runway mutex), because
+  the release event may run on a different worker thread.
+- Emergency flights are given immediate access to runways( high priority using queue).
+- Flights that find every runway busy wait in a grant queue ordered by
+  priority, then FIFO; a released runway goes straight to the queue head.
+- Aircraft requesting LANDING (ARRIVAL) or TAKEOFF (DEPARTURE) phases trigger runway requests.
+- Once granted access, aircraft occupy the runway for its occupancy time (3s by default), then release it.
+- Each airport is a partition with its own lock, event queue and workers,
+  so separate airports simulate on separate cores without sharing locks.
+extra stuff:
+- Multithreading: A fixed worker pool serves any number of aircraft (100k+).
+- Radar Monitor: A monitoring thread operates like an air traffic radar system.
+- Synchronization: Aircraft and runway threads require tight mutex coordination.
+- Prioritization: Real-world emergency protocols influence access logic.
+- Scalability: Design sets up for Module 3 (e.g., billing, GUI integration).
+============================================================================
+*/
+
+#include "atc_sim.h"
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <cstdlib>
+#include <ctime>
+#include <cstring>
+#include<cmath>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <time.h>
+#include <sched.h>
+#include <climits>
+#include <stdint.h>
+#include <signal.h>
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+using namespace std;
+#define FINE_COMMERCIAL 5000
+#define FINE_CARGO 3000
+#define FINE_EMERGENCY 1000
+
+// ========================== STRUCT DEFINITIONS ==============================
+
+// Aircraft holds flight metadata and event-handler progress. The state that
+// radar and renderer poll lives in the FleetState store below.
+struct Aircraft {
+    char flight_number[10];
+    FlightType direction;
+    AircraftType type;
+    int phase_index;        // Position in the ARRIVAL/DEPARTURE phase sequence
+    int runway;             // Index into runways[] while held, -1 otherwise
+    int airport;            // Index into airports[]; also the event partition
+    uint64_t rng;           // Per-flight random stream, see fleet_add
+    float bearing;          // Radians; arrivals come in along it, departures leave along it
+};
+
+/*
+Structure-of-arrays store for the hot per-aircraft state. A radar sweep
+walks a few dense arrays instead of touching every Aircraft and its mutex.
+Each slot is guarded by a seqlock: the one worker handling that aircraft's
+event makes seq odd, writes, and makes it even again; readers retry until
+they see the same even seq on both sides of their copy. avn_issued is
+written by the radar itself, so it is a separate atomic flag outside the
+seqlock.
+
+Storage grows at runtime in fixed-size chunks, so a slot never moves once
+it exists and readers need no lock while flights are being added. Slots of
+finished flights are recycled, so memory follows the number of flights in
+the air rather than the number in the whole scenario.
+*/
+const int FLEET_CHUNK_BITS = 12;
+const int FLEET_CHUNK = 1 << FLEET_CHUNK_BITS;  // Aircraft per chunk
+const int FLEET_MAX_CHUNKS = 4096;              // 16M concurrent aircraft
+
+struct FleetChunk {
+    atomic<unsigned> seq[FLEET_CHUNK];
+    unsigned char phase[FLEET_CHUNK];       // Phase
+    unsigned char direction[FLEET_CHUNK];   // FlightType, copied for the radar
+    int speed[FLEET_CHUNK];
+    // Motion since the current phase started: position = start + vel * dt,
+    // in km from the airport and metres of altitude
+    float start_x[FLEET_CHUNK];
+    float start_y[FLEET_CHUNK];
+    float start_alt[FLEET_CHUNK];
+    float vel_x[FLEET_CHUNK];               // km/s
+    float vel_y[FLEET_CHUNK];
+    float vel_alt[FLEET_CHUNK];             // m/s
+    long long motion_t0[FLEET_CHUNK];       // Simulation time the motion started
+    unsigned char active[FLEET_CHUNK];
+    atomic<unsigned char> avn_issued[FLEET_CHUNK];
+    atomic<uint64_t> speed_dirty[FLEET_CHUNK / 64]; // Speed or phase changed since the last check
+    Aircraft aircraft[FLEET_CHUNK];         // Metadata, owned by the event handlers
+};
+
+struct FleetState {
+    FleetChunk* chunks[FLEET_MAX_CHUNKS];
+    atomic<int> size;                  // Slots in use or retired (high-water mark)
+    long long admitted;                // Flights ever added, for reports
+    vector<int> free_slots;            // Retired slots, reused first
+    pthread_mutex_t free_lock;
+};
+
+// Flights waiting for a speed check: a bit per slot in
+// FleetChunk::speed_dirty, and a bit per chunk here
+struct DirtySet {
+    atomic<uint64_t> chunks[FLEET_MAX_CHUNKS / 64];
+    atomic<bool> check_pending;        // An EV_VIOLATION_CHECK is queued
+    atomic<long long> marked_ns;       // When it was queued, for detection latency
+    atomic<long long> checks;          // Drains, and flights checked by them
+    atomic<long long> checked;
+};
+
+// Consistent copy of one aircraft's hot state, taken without locks
+struct FlightView {
+    Phase phase;
+    int speed;
+    float x, y;    // km from the airport
+    float alt;     // metres
+    bool active;
+};
+// Runway structure will be useful in Module 2
+struct Runway {
+    char name[24];
+    int airport;              // Index into airports[]
+    int local_index;          // Bit position in the airport's free bitmaps
+    unsigned char capabilities; // Bit runway_class(direction, type) set if served
+    long long occupancy_us;   // How long a landing or takeoff holds it
+    bool in_use;
+    long long granted_at_us;  // Start of the current occupancy
+    long long busy_us;        // Total occupied time, for utilization
+    int movements;            // Landings + takeoffs granted
+};
+
+const int MAX_AIRPORT_RUNWAYS = 64; // One bit each in the free bitmaps
+const int RUNWAY_CLASSES = 6;       // FlightType x AircraftType
+const int RUNWAY_QUEUE_RESERVE = 256; // Grant queue entries preallocated per class
+const int SEQUENCER_RESERVE = 256;    // Look-ahead horizon entries; later arrivals are planned once they ask
+
+// Capability class of a flight: which runways may take it
+int runway_class(FlightType direction, AircraftType type) {
+    return direction * 3 + type;
+}
+
+// A flight waiting for a runway
+struct RunwayRequest {
+    int priority;            // get_priority(): lower goes first
+    unsigned long long seq;  // Request order among equal priorities
+    int aircraft;            // Fleet index
+    long long requested_us;  // For grant latency
+};
+
+// A landing or takeoff in a sequencer's horizon
+struct RunwayDemand {
+    int aircraft;              // Fleet index
+    unsigned char runway_class;
+    bool emergency;
+    bool requested;            // At the runway and waiting for it
+    long long eta_us;          // When it reaches the runway; once requested, when it asked
+    int runway;                // Planned local runway, -1 if none serves it
+    long long start_us;        // Planned start on it
+};
+
+// Look-ahead plan of one airport (--sequencing lookahead), under its lock
+struct RunwaySequencer {
+    vector<RunwayDemand> plan;                // Sequence order
+    vector<RunwayDemand> kept;                // Scratch: the window before trying greedy order
+    uint64_t serves[RUNWAY_CLASSES];          // Local runways serving each class
+    long long free_at[MAX_AIRPORT_RUNWAYS];   // Scratch for scheduling
+    long long dropped;                        // Announcements turned away by a full horizon
+};
+
+/*
+An airport owns a contiguous slice of runways[] and everything needed to
+hand them out, guarded by its own lock. free_by_class[c] has bit r set
+while local runway r is free and serves class c, so finding a runway is
+one ctz instead of a scan, and each class has its own grant queue.
+*/
+struct MetricSummary;
+
+struct Airport {
+    char code[8];
+    float x_km, y_km;                        // Location; flights fly around it
+    int first_runway, num_runways;           // Slice of runways[]
+    unsigned char classes;                   // Union of its runways' capabilities
+    pthread_mutex_t lock;
+    uint64_t free_by_class[RUNWAY_CLASSES];
+    vector<RunwayRequest> waiters[RUNWAY_CLASSES]; // Heaps, one per class
+    unsigned long long request_seq;
+    bool grant_pass_pending;                 // EV_RUNWAY_GRANT_PASS queued for free runways
+    MetricSummary* wait_hist;                // Grant latencies in microseconds, fixed size
+    MetricSummary* emergency_wait_hist;      // The EMERGENCY ones among them
+    MetricSummary* holding_hist;             // The ARRIVAL ones: airborne, holding to land
+    RunwaySequencer* sequencer;              // NULL: greedy grants
+};
+
+// METRICS: histogram shards, one per recording thread
+enum Metric {
+    METRIC_RUNWAY_WAIT,          // request_runway to grant, simulated us
+    METRIC_AIRPORT_LOCK_WAIT,    // Runway arbitration locks (one per airport)
+    METRIC_AIRPORT_LOCK_HOLD,
+    METRIC_PRINT_LOCK_WAIT,
+    METRIC_PRINT_LOCK_HOLD,
+    METRIC_RADAR_SWEEP,
+    METRIC_AVN_ISSUE,
+    METRIC_VIOLATION_DETECT,     // Speed change marked to checked
+    METRIC_SEQUENCER_PLAN,       // One look-ahead re-plan of an airport
+    METRIC_FRAME,                // Visualizer frame to frame
+    NUM_METRICS
+};
+
+const char* METRIC_NAMES[NUM_METRICS] = {
+    "runway_wait", "airport_lock_wait", "airport_lock_hold", "print_lock_wait",
+    "print_lock_hold", "radar_sweep", "issue_avn", "violation_detect",
+    "sequencer_plan", "render_frame"
+};
+const char* METRIC_UNITS[NUM_METRICS] = {
+    "sim_us", "ns", "ns", "ns", "ns", "ns", "ns", "ns", "ns", "ns"
+};
+
+const int HIST_SUB_BITS = 5;
+const int HIST_SUB = 1 << HIST_SUB_BITS;
+const int HIST_MAX_BITS = 44;    // Larger values land in the top bucket
+const int HIST_BUCKETS = (HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB;
+
+struct MetricShard {
+    // Single writer (the owning thread); readers merge with relaxed loads
+    atomic<uint64_t> counts[NUM_METRICS][HIST_BUCKETS];
+    atomic<uint64_t> total[NUM_METRICS];
+    atomic<uint64_t> sum[NUM_METRICS];
+    atomic<uint64_t> max[NUM_METRICS];
+    atomic<uint64_t> contended[NUM_METRICS];
+    pthread_t thread;        // Owner, so a thread finds its shard again
+    MetricShard* next;
+};
+
+// Periodic dumps every --metrics-interval seconds, plus one on demand
+// whenever the process gets SIGUSR1 (polled every 100 ms)
+struct MetricsReporter {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    bool running;
+    bool stopping;
+    long long interval_ns;           // 0: SIGUSR1 only
+};
+
+// SIMULATION CLOCK
+struct SimClock {
+    ClockMode mode;
+    double time_scale;             // Simulated seconds per wall-clock second
+    timespec start;                // CLOCK_MONOTONIC at simulation start
+    time_t epoch;                  // Wall-clock time of simulated t = 0
+    atomic<long long> virtual_us;  // Current time in VIRTUAL mode
+};
+
+// EVENT LOGGER: per-thread rings drained by one sink
+enum LogEventType {
+    LOG_PHASE,            // flight, direction, phase, speed
+    LOG_RUNWAY_ASSIGNED,  // flight, runway
+    LOG_RUNWAY_RELEASED,  // runway
+    LOG_AVN,              // flight, fine, text = reason
+    LOG_FLIGHT_DROPPED,   // flight (no airport can take it)
+    LOG_FLEET_FULL,
+    LOG_SIM_END,
+    LOG_FLIGHT_ADDED,     // Trace only: aircraft, flight, type, direction, airport
+    LOG_FLIGHT_RETIRED    // Trace only: aircraft
+};
+
+struct LogEvent {
+    unsigned long long seq;   // Global order across threads
+    long long sim_us;
+    unsigned char type;       // LogEventType
+    unsigned char level;      // LogLevel it reaches the console at
+    unsigned char direction;
+    unsigned char phase;
+    unsigned char aircraft_type;
+    int speed;
+    int aircraft;             // Fleet index, -1 when none
+    int runway;               // Index into runways[], -1 when none
+    int airport;
+    int fine;
+    char flight_number[10];
+    char text[64];
+};
+
+const int LOG_RING_SIZE = 2048;   // Events per thread, power of two
+
+struct LogRing {
+    LogEvent events[LOG_RING_SIZE];
+    atomic<unsigned long long> head;  // Next write (owning thread only)
+    atomic<unsigned long long> tail;  // Next read (sink only)
+    atomic<unsigned long long> claiming; // While pushing, a floor under the seq being claimed; else ~0
+    pthread_t thread;                 // Owner, so a thread finds its ring again
+    LogRing* next;
+};
+
+struct EventLogger {
+    atomic<int> level;
+    atomic<unsigned long long> seq;
+    atomic<LogRing*> rings;           // Freed with the instance: exited threads may have events left
+    pthread_t sink;
+    pthread_mutex_t lock;             // Sink's sleep and shutdown only
+    pthread_cond_t wakeup;
+    bool running;
+    bool stopping;
+    bool tracing;                     // A trace is being recorded: every event is pushed
+    uint32_t drained_word;            // Futex: bumped by the sink after each batch it takes
+    uint32_t full_sleepers;           // Pushers asleep on drained_word, their ring full
+};
+
+// TRACE RECORDER: binary record of a run for AtcReplay
+const char TRACE_MAGIC[8] = { 'A', 'T', 'C', 'T', 'R', 'C', '1', '\0' };
+const char TRACE_END_MAGIC[8] = { 'A', 'T', 'C', 'T', 'E', 'N', 'D', '\0' };
+const uint32_t TRACE_VERSION = 1;
+
+// Record tags beyond the LogEventTypes, which tag the event records
+enum TraceTag { TRACE_SNAPSHOT = 0xF0, TRACE_END = 0xF1 };
+
+// One fleet slot as the trace sees it
+struct TraceFlight {
+    char flight_number[10];
+    unsigned char type;         // AircraftType
+    unsigned char direction;    // FlightType
+    unsigned char phase;        // Phase
+    unsigned char active;
+    unsigned char avn_issued;
+    int airport;
+    int speed;
+    long long phase_t0;         // Start of the current phase, -1 while parked
+};
+
+// What a trace knows at one instant. The recorder keeps one in step with
+// what it has written, so snapshots cost no locks; replay rebuilds it.
+struct TraceWorld {
+    long long now_us;
+    long long admitted;
+    long long avns;
+    int active;
+    vector<TraceFlight> flights;  // Indexed like the fleet
+    vector<int> runway_holder;    // Fleet index, -1 when free
+};
+
+struct TraceIndexEntry {
+    long long sim_us;
+    uint64_t offset;              // Of the snapshot record
+};
+
+struct TraceRecorder {
+    FILE* file;                   // NULL: not recording
+    uint64_t offset;              // Bytes written so far
+    long long snapshot_us;        // --trace-snapshot
+    long long next_snapshot_us;
+    long long last_us;            // Time of the previous record; records store deltas
+    TraceWorld world;
+    vector<TraceIndexEntry> index;
+    vector<unsigned char> buf;    // One batch, written with a single fwrite
+};
+
+// AVN RECORD STORE: on-disk layout of avn_records.bin
+const char* AVN_STORE_PATH = "avn_records.bin";
+const char AVN_STORE_MAGIC[8] = { 'A', 'T', 'C', 'A', 'V', 'N', '1', '\0' };
+const int AVN_FLIGHT_BUCKETS = 1 << 16;   // Power of two
+const int AVN_AIRLINE_SLOTS = 1 << 11;    // Power of two, > 36 * 36 codes
+const uint64_t AVN_STORE_INITIAL_CAPACITY = 4096;
+
+enum AvnStatus { AVN_OPEN, AVN_APPEALED, AVN_PAID };
+const char* AVN_STATUS_NAMES[] = { "OPEN", "APPEALED", "PAID" };
+
+// Ids in the link fields are 1-based; 0 means "none"
+struct AvnStoreRecord {
+    uint32_t avn_id;
+    char flight_number[10];
+    uint8_t type;            // AircraftType
+    uint8_t phase;           // Phase at the time of the violation
+    int32_t speed;
+    int32_t fine;
+    uint8_t status;          // AvnStatus
+    uint8_t reserved0[3];
+    uint32_t prev_flight;    // Older record in the same flight bucket
+    uint32_t prev_airline;   // Older record of the same airline
+    uint32_t open_prev;      // Unpaid list neighbours (newer / older)
+    uint32_t open_next;
+    int64_t issued_at;       // sim_wall_time() at issue
+    uint8_t reserved1[8];
+};
+static_assert(sizeof(AvnStoreRecord) == 64, "AVN records are fixed-width");
+
+// One airline's entry in the header's open-addressed table
+struct AvnAirlineSlot {
+    char code[2];            // Two-letter prefix of the flight number
+    uint8_t used;
+    uint8_t reserved;
+    uint32_t head;           // Newest AVN of this airline
+    uint32_t count;
+    uint32_t unpaid_count;
+    int64_t total_fines;
+    int64_t unpaid_fines;
+};
+
+struct AvnStoreHeader {
+    char magic[8];
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t count;          // Records appended (published with release)
+    uint64_t capacity;       // Records the file has room for
+    int64_t total_fines;
+    int64_t open_fines;      // Sum over OPEN and APPEALED records
+    uint64_t open_count;
+    uint32_t open_head;      // Newest unpaid AVN
+    uint32_t flight_heads[AVN_FLIGHT_BUCKETS];
+    AvnAirlineSlot airlines[AVN_AIRLINE_SLOTS];
+};
+
+// Records start on the first page boundary after the header
+const size_t AVN_STORE_HEADER_BYTES = (sizeof(AvnStoreHeader) + 4095) & ~(size_t)4095;
+
+// CREATE truncates for the log writer; UPDATE maps an existing store for
+// the payment gateway, which only changes statuses
+enum AvnStoreMode { AVN_STORE_READ, AVN_STORE_CREATE, AVN_STORE_UPDATE };
+
+struct AvnStore {
+    int fd;
+    bool writable;
+    size_t mapped_bytes;
+    AvnStoreHeader* header;
+    AvnStoreRecord* records;
+};
+
+// AVN EVENT CHANNEL: shared-memory ring for the portals
+const char* AVN_CHANNEL_NAME = "/atc_avn_events";
+const uint32_t AVN_CHANNEL_MAGIC = 0x41564e43; // "AVNC"
+const uint32_t AVN_CHANNEL_SLOTS = 1 << 14;    // Power of two
+const int AVN_CHANNEL_MAX_CONSUMERS = 8;
+
+struct AvnEvent {
+    uint32_t avn_id;
+    char flight_number[10];
+    uint8_t type;            // AircraftType
+    uint8_t phase;           // Phase
+    int32_t speed;
+    int32_t fine;
+    int64_t issued_at;
+};
+
+struct AvnChannelSlot {
+    uint64_t seq;            // Message number + 1 when complete, 0 while written
+    AvnEvent event;
+    char pad[64 - sizeof(uint64_t) - sizeof(AvnEvent)];
+};
+static_assert(sizeof(AvnChannelSlot) == 64, "one slot per cache line");
+
+// Fields shared between processes are only touched with __atomic builtins
+struct AvnChannelHeader {
+    uint32_t magic;
+    uint32_t slots;
+    uint32_t closed;         // Producer is done; consumers drain and exit
+    uint32_t futex_word;     // Bumped on every publish, consumers wait on it
+    uint32_t sleepers;       // Consumers inside FUTEX_WAIT
+    uint32_t reserved;
+    uint64_t write_seq;      // Messages published so far
+    uint32_t consumer_used[AVN_CHANNEL_MAX_CONSUMERS];
+    uint64_t consumer_cursor[AVN_CHANNEL_MAX_CONSUMERS]; // For lossless mode
+    char pad[64];
+};
+
+struct AvnChannel {
+    AvnChannelHeader* header;
+    AvnChannelSlot* slots;
+    size_t mapped_bytes;
+    bool owner;              // Created (and will unlink) the region
+    char name[64];
+};
+
+struct AvnConsumer {
+    AvnChannel* channel;
+    int index;               // Slot in consumer_cursor, -1 if unregistered
+    uint64_t cursor;         // Next message number to read
+    uint64_t lost;           // Messages overwritten before we got to them
+};
+
+// PAYMENT GATEWAY: settlement requests over shared memory, made durable in
+// a write-ahead log next to the store (avn_records.bin.wal)
+const char* PAYMENT_GATEWAY_NAME = "/atc_payments";
+const uint32_t PAYMENT_GATEWAY_MAGIC = 0x41564e50; // "AVNP"
+const int PAYMENT_SLOTS = 256;                     // Requests in flight at once
+const uint32_t PAYMENT_WAL_MAGIC = 0x4c415750;     // "PWAL"
+const int PAYMENT_MAX_PORTALS = 16;                // Billing portal processes
+
+// FREE -> CLAIMED (client fills it) -> SUBMITTED -> TAKEN (gateway) -> DONE
+enum PaymentSlotState {
+    PAYMENT_SLOT_FREE, PAYMENT_SLOT_CLAIMED, PAYMENT_SLOT_SUBMITTED, PAYMENT_SLOT_TAKEN, PAYMENT_SLOT_DONE
+};
+enum PaymentResult {
+    PAYMENT_OK, PAYMENT_NO_SUCH_AVN, PAYMENT_NOT_OWNER, PAYMENT_REJECTED, PAYMENT_LOG_FAILED, PAYMENT_UNAVAILABLE
+};
+const char* PAYMENT_RESULT_NAMES[] = {
+    "settled", "no such AVN", "not this airline's AVN", "not allowed from its status",
+    "log write failed", "gateway unavailable"
+};
+
+struct PaymentSlot {
+    uint32_t state;          // PaymentSlotState; the client sleeps on it
+    uint32_t avn_id;
+    uint8_t status;          // Requested AvnStatus: APPEALED or PAID
+    uint8_t result;          // PaymentResult, valid once DONE
+    char airline[2];         // Requesting airline; "**" is the operator
+    int32_t fine;            // Amount settled, valid once DONE
+    uint64_t lsn;            // Log position of the commit, valid once DONE
+    char pad[40];
+};
+static_assert(sizeof(PaymentSlot) == 64, "one slot per cache line");
+
+// Fields shared between processes are only touched with __atomic builtins
+struct PaymentGatewayHeader {
+    uint32_t magic;
+    uint32_t stopping;       // Finish what was submitted, then close
+    uint32_t closed;         // No more requests are taken
+    uint32_t submit_word;    // Bumped on every submit, the gateway waits on it
+    uint32_t gateway_sleeping;
+    uint32_t claim_hint;     // Where clients start looking for a free slot
+    int32_t gateway_pid;     // So clients notice a crashed gateway
+    uint32_t reserved;
+    uint64_t commits;        // Group commits, one fdatasync each
+    uint64_t settled;        // Requests committed through them
+    uint64_t commit_ns;      // Total time in write + fdatasync
+    uint64_t max_batch;
+    char pad[64];
+    PaymentSlot slots[PAYMENT_SLOTS];
+};
+
+struct PaymentGateway {
+    PaymentGatewayHeader* header;
+    bool owner;              // Created (and will unlink) the region
+    char name[64];
+};
+
+// One committed status change; fixed width and checksummed, so a record
+// torn by a crash is recognised on recovery and cut off
+struct PaymentWalRecord {
+    uint32_t magic;
+    uint32_t checksum;       // FNV-1a over the rest of the record
+    uint64_t lsn;            // 1, 2, 3, ... without gaps
+    uint32_t avn_id;
+    uint8_t status;          // AvnStatus after the change
+    uint8_t reserved0;
+    char airline[2];         // Who asked for it
+    int32_t fine;
+    uint8_t reserved1[4];
+};
+static_assert(sizeof(PaymentWalRecord) == 32, "WAL records are fixed-width");
+
+// The gateway's side: the store it applies to and the log it commits to
+struct PaymentLedger {
+    AvnStore store;
+    int wal_fd;
+    uint64_t next_lsn;
+    off_t wal_bytes;         // Committed length of the log
+    vector<PaymentWalRecord> batch;
+    vector<int> batch_slots; // Slot of each batch record
+};
+
+// What a settlement load test measured
+struct PaymentLoadResult {
+    int portals;
+    long long requests;
+    long long failures;      // Anything but PAYMENT_OK
+    double seconds;
+    MetricSummary* latency;  // Submit to answer, ns; the caller frees it
+    uint64_t commits, max_batch, commit_ns;
+    bool recovered;          // The log alone rebuilt the final store
+};
+
+// AVN LOG PIPELINE
+const int AVN_RING_SIZE = 1 << 16;              // Records; power of two
+const size_t AVN_FLUSH_BYTES = 64 * 1024;
+const int AVN_FLUSH_MS = 200;
+const long AVN_ROTATE_BYTES = 64L * 1024 * 1024;
+const int AVN_ROTATE_KEEP = 4;                  // avn_log.txt.1 .. .4
+const char* AVN_LOG_PATH = "avn_log.txt";
+
+struct AvnRecord {
+    char flight_number[10];
+    AircraftType type;
+    Phase phase;
+    int speed;
+    int fine;
+    time_t issued_at;        // sim_wall_time(); formatted by the writer thread
+    char reason[64];
+};
+
+struct AvnRingCell {
+    atomic<size_t> seq;      // == position when free, position + 1 when full
+    AvnRecord record;
+};
+
+struct AvnLog {
+    vector<AvnRingCell> cells;
+    atomic<size_t> tail;     // Next position producers claim
+    size_t head;             // Next position the writer reads (writer only)
+    atomic<bool> stopping;
+    pthread_t writer;
+    FILE* file;
+    long file_bytes;
+    AvnStore store;          // Binary history, appended by the writer
+    bool store_ok;
+    AvnChannel channel;      // Live feed to portal processes
+    bool channel_ok;
+    atomic<long long> full_waits; // Producer found the ring full and slept
+    uint32_t drained_word;   // Futex: bumped by the writer after each batch it drains
+    uint32_t full_sleepers;  // Producers asleep on drained_word
+    uint32_t pushed_word;    // Futex: bumped by producers after each record and by avn_log_stop()
+    uint32_t writer_asleep;  // The writer is idle on pushed_word
+};
+
+// TICK ENGINE
+const int TICK_GRAIN = 1024;           // Aircraft per block; divides FLEET_CHUNK
+const int MAX_TICK_WORKERS = 64;
+
+typedef void (*TickFn)(int begin, int end);
+
+struct TickDeque {
+    atomic<uint64_t> range;            // (next block << 32) | end block
+    char pad[56];                      // One cache line each
+};
+
+struct TickPool {
+    int workers;                       // Including the calling thread
+    pthread_t threads[MAX_TICK_WORKERS];
+    TickDeque deques[MAX_TICK_WORKERS];
+    pthread_mutex_t lock;
+    pthread_cond_t start;              // New pass (or stop) for the helpers
+    pthread_cond_t done;               // Last helper finished the pass
+    unsigned long long generation;     // Pass counter, guarded by lock
+    int busy_helpers;
+    bool stopping;
+    TickFn fn;
+    int count;
+    atomic<long long> steals;
+};
+
+// SEPARATION GRID
+const float MIN_SEPARATION_KM = 5.0f;          // About 3 NM, terminal radar minimum
+const float MIN_VERTICAL_SEPARATION_M = 300.f; // About 1000 ft
+const float GROUND_ALTITUDE_M = 30.f;          // Below this an aircraft is not checked
+
+struct SeparationGrid {
+    vector<int> heads;         // Bucket -> first aircraft, -1 when empty
+    vector<int> next, prev;    // Intrusive bucket lists, indexed by aircraft
+    vector<int> bucket;        // Bucket aircraft i is linked into, -1 if absent
+    vector<uint64_t> cell;     // Packed cell of aircraft i
+    vector<float> x, y, alt;   // Position as of the last update
+    vector<uint8_t> settled;   // Already fined: an obstacle, but two never pair
+    long long moves;           // Relinks done by incremental updates
+};
+
+// SCENARIO SOURCES
+const char SCENARIO_MAGIC[8] = {'A', 'T', 'C', 'S', 'C', 'N', '2', '\0'};
+const char SCENARIO_MAGIC_V1[8] = {'A', 'T', 'C', 'S', 'C', 'N', '1', '\0'};
+const long long INGEST_HORIZON_US = 2000000; // Look-ahead for lazy ingestion
+
+enum ScenarioKind {
+    SCENARIO_BUILTIN,
+    SCENARIO_CSV,
+    SCENARIO_BINARY,
+    SCENARIO_GENERATOR
+};
+
+struct ScenarioFlight {
+    char flight_number[10];
+    AircraftType type;
+    FlightType direction;
+    long long start_us;      // Offset from simulation start
+    int airport;             // Index into airports[], -1 = any
+};
+
+// On-disk record of the binary format (SCENARIO_MAGIC_V1 files stop
+// after start_ms)
+struct ScenarioRecord {
+    char flight_number[10];
+    unsigned char type;
+    unsigned char direction;
+    uint32_t start_ms;
+    unsigned char airport;   // SCENARIO_ANY_AIRPORT or index into airports[]
+    unsigned char reserved[3];
+};
+const int SCENARIO_RECORD_V1_BYTES = 16;
+const unsigned char SCENARIO_ANY_AIRPORT = 0xFF;
+
+struct ScenarioSource {
+    ScenarioKind kind;
+    FILE* file;
+    long long line;            // CSV line number, for error messages
+    long long emitted;         // Flights handed out so far
+    long long limit;           // Stop after this many (-1 = no limit)
+    long long last_start_us;   // Start times never go backwards
+    bool warned_order;
+    size_t record_bytes;       // BINARY: record size of the file's version
+    // GENERATOR only
+    uint64_t rng;
+    double rate_per_us[3];     // Poisson rate per AircraftType
+    long long next_arrival_us[3];
+    // One-flight look-ahead used by the ingestion event
+    bool has_next;
+    ScenarioFlight next;
+};
+
+// WORLD SNAPSHOTS: triple buffer between the simulation and a renderer
+const int SNAPSHOT_FRESH = 4; // Flag next to the buffer index in middle
+
+struct SnapshotExchange {
+    WorldSnapshot buffers[3];
+    atomic<int> middle;      // Shared buffer index | SNAPSHOT_FRESH
+    int back;                // Producer only
+    int front;               // Renderer only
+};
+
+// MONTE CARLO: what each run contributes to its grid point
+enum McMetric { MC_DELAY_MEAN, MC_DELAY_P99, MC_HOLDING_MEAN, MC_AVNS, MC_METRICS };
+const char* const MC_METRIC_NAMES[] = { "mean delay (s)", "p99 delay (s)", "mean holding (s)", "AVNs" };
+const char* const MC_METRIC_COLUMNS[] = { "delay_mean_s", "delay_p99_s", "holding_mean_s", "avns" };
+const double MC_METRIC_SCALE[] = { 1e6, 1e6, 1e6, 1 }; // Histogram units per reported unit
+const double MC_DEFAULT_RATE = 30;                     // Flights per minute if none given
+
+// One metric over a grid point's runs, in fixed space however many there are
+struct McStat {
+    long long n;
+    double mean, m2;         // Welford's running mean and sum of squared deviations
+    MetricSummary* hist;     // Values in MC_METRIC_SCALE units, for percentiles
+};
+
+struct McPoint {
+    int runways;
+    double occupancy_s;
+    double mix[3];
+    pthread_mutex_t lock;    // Held while a finished run is folded in
+    int done;                // Runs finished, failed ones included
+    McStat stats[MC_METRICS];
+};
+
+struct McSweep {
+    AtcConfig base;          // Every run's config, before the grid point's values
+    int runs;                // Per grid point
+    vector<McPoint> points;
+    atomic<long long> next_job; // point * runs + run
+    atomic<long long> failed;
+    FILE* report;
+    FILE* csv;
+    FILE* quiet;             // Console of the runs themselves
+    pthread_mutex_t report_lock;
+};
+
+
+// ========================== INSTANCE STATE ==================================
+
+/*
+Everything one simulation owns lives in an AtcState: fleet, runways, clock,
+event queues, radar scratch, and the console, AVN and metrics sinks. The
+code reaches it through sim, a thread-local pointer to the instance the
+current thread works for. API calls set it on the caller's thread
+(SimScope), and every thread the core starts inherits its creator's
+(sim_thread_create), so two AtcSimulation objects in one process never
+share a lock, a queue or a file.
+*/
+
+struct Scheduler;
+
+struct AtcState {
+    uint64_t id;                  // Unique per process, for the per-thread caches
+    FleetState fleet;             // Grows as the scenario is ingested
+    vector<Runway> runways;       // Grouped by airport, from --airports
+    vector<Airport> airports;     // Sized once at startup, never reallocated
+    atomic<bool> simulation_running;
+    atomic<int> active_flights;   // Flights that have not reached their last phase
+    long long radar_period_us;    // --radar-hz
+    uint64_t sim_seed;            // --seed; every random stream derives from it
+    FILE* console;                // Event log, reports and safe_print()
+    pthread_mutex_t print_lock;   // Mutex for clean console output
+
+    atomic<MetricShard*> metric_shards; // Freed with the instance: exited threads still count
+    MetricsReporter metrics_reporter;
+    SimClock sim_clock;
+    EventLogger event_log;
+    AvnLog avn_log;
+    TickPool tick_pool;
+    pthread_mutex_t tick_pass_lock; // Serializes passes; global events can run on different partition-0 workers
+
+    SeparationGrid radar_grid;                  // Only the radar touches it
+    vector<pair<int, int>> radar_conflicts;     // Scratch, reused every sweep
+    long long separation_losses;
+    // Filled by the radar's parallel scan, one entry per fleet index
+    vector<unsigned char> radar_airborne;       // Active, in a separation phase, off the ground
+    vector<float> radar_x, radar_y, radar_alt;
+    vector<vector<pair<int, int>>> radar_block_pairs; // Per tick block, reused
+    // Sweep cost, reported at the end of the run (only the radar writes these)
+    long long radar_sweeps;
+    long long radar_sweep_ns_total;
+    long long radar_sweep_ns_max;
+    long long radar_scan_ns_total; // The position scan's share; the rest is the separation check
+    long long radar_scan_now;     // Sim time of the sweep in progress, for the scan blocks
+    DirtySet speed_dirty;         // Drained by the violation monitor
+
+    Scheduler* schedulers;        // One per airport partition
+    int num_partitions;
+    int next_airport;             // assign_airport()'s round-robin cursor
+    SequencingPolicy sequencing;  // --sequencing
+    ScenarioSource scenario;
+    atomic<bool> scenario_drained; // Every flight has been handed to the fleet
+    long long sim_end_us;         // Flights starting after this are never ingested
+    SnapshotExchange snapshots;
+    long long snapshot_period_us; // 0: no snapshots
+    TraceRecorder trace;          // Written by the event log sink only
+
+    // AtcSimulation lifecycle
+    string avn_store_path, avn_log_path, avn_channel_name; // Empty: sink off
+    string trace_path;            // Empty: no trace
+    long long trace_snapshot_us;
+    ClockMode clock_mode;
+    double time_scale;
+    int num_workers;
+    int tick_workers;
+    LogLevel log_level;
+    double metrics_interval_s;
+    bool loaded;                  // Runway model and flight source are ready
+    bool started;
+    bool finished;
+    vector<pthread_t> worker_threads;
+};
+
+thread_local AtcState* sim = nullptr;
+
+// Makes state the current instance for the lifetime of the scope
+struct SimScope {
+    AtcState* saved;
+    explicit SimScope(AtcState* state) : saved(sim) { sim = state; }
+    ~SimScope() { sim = saved; }
+};
+
+struct SimThreadStart {
+    AtcState* state;
+    void* (*fn)(void*);
+    void* arg;
+};
+
+void* sim_thread_main(void* p) {
+    SimThreadStart start = *(SimThreadStart*)p;
+    delete (SimThreadStart*)p;
+    sim = start.state;
+    return start.fn(start.arg);
+}
+
+// pthread_create for the core's own threads: the new thread works for the
+// same instance as the one that started it
+int sim_thread_create(pthread_t* thread, void* (*fn)(void*), void* arg) {
+    SimThreadStart* start = new SimThreadStart;
+    start->state = sim;
+    start->fn = fn;
+    start->arg = arg;
+    int rc = pthread_create(thread, NULL, sim_thread_main, start);
+    if (rc != 0) {
+        delete start;
+    }
+    return rc;
+}
+
+atomic<uint64_t> next_instance_id(1);
+
+// A blank instance with the original defaults; nothing loaded, no threads
+AtcState* atc_state_new() {
+    AtcState* state = new AtcState(); // Zeroed
+    state->id = next_instance_id.fetch_add(1);
+    state->simulation_running = true;
+    state->radar_period_us = 1000000 / DEFAULT_RADAR_HZ;
+    state->sim_seed = 1;
+    state->console = stdout;
+    pthread_mutex_init(&state->print_lock, NULL);
+    pthread_mutex_init(&state->tick_pass_lock, NULL);
+    pthread_mutex_init(&state->fleet.free_lock, NULL);
+    state->snapshot_period_us = 1000000 / DEFAULT_SNAPSHOT_HZ;
+    return state;
+}
+
+void atc_state_delete(AtcState* state); // Needs Scheduler, see EMBEDDING API
+
+// Aircraft i lives in chunk i / FLEET_CHUNK at slot i % FLEET_CHUNK
+FleetChunk* fleet_chunk(int i) {
+    return sim->fleet.chunks[i >> FLEET_CHUNK_BITS];
+}
+
+int fleet_slot(int i) {
+    return i & (FLEET_CHUNK - 1);
+}
+
+Aircraft& fleet_aircraft(int i) {
+    return fleet_chunk(i)->aircraft[fleet_slot(i)];
+}
+
+// Priority values: lower means higher priority
+int get_priority(AircraftType type) {
+    int result;
+
+if (type == EMERGENCY) {
+    result = 0;
+} else if (type == COMMERCIAL) {
+    result = 1;
+} else if (type == CARGO) {
+    result = 2;
+} else {
+    result = 3;
+}
+
+return result;
+
+}
+
+// ========================== METRICS =========================================
+
+/*
+Latency and contention histograms for the hot paths, cheap enough to stay
+on. Every thread records into its own MetricShard, so recording is a
+clz, a shift and a few relaxed stores on memory no other thread writes.
+Shards go on the instance's lock-free list the first time a thread
+records for it, and are only merged when someone reads them. Threads
+outside any instance record nothing.
+
+Buckets are HDR-style log-linear: values below HIST_SUB are exact, and
+every power of two above that is split into HIST_SUB equal sub-buckets,
+so any recorded value is off by at most 1/HIST_SUB (about 3%) from the
+bucket it lands in, from nanoseconds up to hours.
+
+Lock metrics come in pairs: *_wait is the time to acquire (0 when the
+trylock fast path succeeds) and *_hold the time the lock was held. A
+contended acquisition is one where the fast path failed.
+*/
+
+long long monotonic_ns(); // SIMULATION CLOCK
+
+// This thread's shard, valid while metric_shard_owner is sim->id
+thread_local MetricShard* metric_shard = nullptr;
+thread_local uint64_t metric_shard_owner = 0;
+
+int hist_bucket(uint64_t v) {
+    if (v >= (1ULL << HIST_MAX_BITS)) {
+        return HIST_BUCKETS - 1;
+    }
+    if (v < (uint64_t)HIST_SUB) {
+        return (int)v;
+    }
+    int e = 63 - __builtin_clzll(v);
+    int shift = e - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int)(v >> shift) - HIST_SUB;
+}
+
+// Largest value that lands in bucket b
+uint64_t hist_bucket_high(int b) {
+    if (b < HIST_SUB) {
+        return b;
+    }
+    int shift = b / HIST_SUB - 1;
+    uint64_t top = b % HIST_SUB + HIST_SUB;
+    return ((top + 1) << shift) - 1;
+}
+
+// Only a thread that works for several instances in turn ever walks the list
+MetricShard* metric_shard_get() {
+    if (metric_shard_owner == sim->id) {
+        return metric_shard;
+    }
+    pthread_t self = pthread_self();
+    MetricShard* shard = sim->metric_shards.load(memory_order_acquire);
+    while (shard && !pthread_equal(shard->thread, self)) {
+        shard = shard->next;
+    }
+    if (!shard) {
+        shard = new MetricShard(); // Zeroed
+        shard->thread = self;
+        MetricShard* head = sim->metric_shards.load(memory_order_relaxed);
+        do {
+            shard->next = head;
+        } while (!sim->metric_shards.compare_exchange_weak(head, shard, memory_order_release));
+    }
+    metric_shard = shard;
+    metric_shard_owner = sim->id;
+    return shard;
+}
+
+inline void metric_bump(atomic<uint64_t>& counter, uint64_t by) {
+    counter.store(counter.load(memory_order_relaxed) + by, memory_order_relaxed);
+}
+
+void metric_record(Metric m, long long value) {
+    if (!sim) {
+        return;
+    }
+    MetricShard* shard = metric_shard_get();
+    uint64_t v = value > 0 ? (uint64_t)value : 0;
+    metric_bump(shard->counts[m][hist_bucket(v)], 1);
+    metric_bump(shard->total[m], 1);
+    metric_bump(shard->sum[m], v);
+    if (v > shard->max[m].load(memory_order_relaxed)) {
+        shard->max[m].store(v, memory_order_relaxed);
+    }
+}
+
+// Lock with wait/contention accounting; returns when it was acquired,
+// for timed_unlock's hold time
+long long timed_lock(pthread_mutex_t* lock, Metric wait) {
+    if (pthread_mutex_trylock(lock) == 0) {
+        long long now = monotonic_ns();
+        metric_record(wait, 0);
+        return now;
+    }
+    long long start = monotonic_ns();
+    pthread_mutex_lock(lock);
+    long long now = monotonic_ns();
+    metric_record(wait, now - start);
+    if (sim) {
+        metric_bump(metric_shard_get()->contended[wait], 1);
+    }
+    return now;
+}
+
+void timed_unlock(pthread_mutex_t* lock, Metric hold, long long locked_at) {
+    long long held = monotonic_ns() - locked_at;
+    pthread_mutex_unlock(lock);
+    metric_record(hold, held);
+}
+
+// One metric merged over every thread
+struct MetricSummary {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total, sum, max, contended;
+};
+
+// Single-threaded histogram (the caller owns it or holds its lock)
+void hist_add(MetricSummary* summary, uint64_t v) {
+    summary->counts[hist_bucket(v)]++;
+    summary->total++;
+    summary->sum += v;
+    summary->max = max(summary->max, v);
+}
+
+void metric_merge(Metric m, MetricSummary* out) {
+    memset(out, 0, sizeof(*out));
+    for (MetricShard* shard = sim->metric_shards.load(memory_order_acquire); shard; shard = shard->next) {
+        for (int b = 0; b < HIST_BUCKETS; ++b) {
+            out->counts[b] += shard->counts[m][b].load(memory_order_relaxed);
+        }
+        out->total += shard->total[m].load(memory_order_relaxed);
+        out->sum += shard->sum[m].load(memory_order_relaxed);
+        out->max = max(out->max, (uint64_t)shard->max[m].load(memory_order_relaxed));
+        out->contended += shard->contended[m].load(memory_order_relaxed);
+    }
+}
+
+// Value at quantile q (0..1): the top of the bucket it falls in, capped
+// at the recorded maximum
+uint64_t metric_quantile(const MetricSummary& s, double q) {
+    uint64_t seen = 0, rank = max((uint64_t)1, (uint64_t)ceil(q * s.total));
+    for (int b = 0; b < HIST_BUCKETS; ++b) {
+        seen += s.counts[b];
+        if (seen >= rank) {
+            return min(hist_bucket_high(b), s.max);
+        }
+    }
+    return s.max;
+}
+
+// Human-readable table, one line per metric that has samples
+string metrics_report() {
+    MetricSummary* summary = new MetricSummary; // About 10 KB, too big for some stacks
+    MetricSummary& s = *summary;
+    char line[256];
+    string out = "[Metrics] metric               unit         count        p50        p99      p99.9        max  contended";
+    for (int m = 0; m < NUM_METRICS; ++m) {
+        metric_merge((Metric)m, &s);
+        if (s.total == 0) {
+            continue;
+        }
+        snprintf(line, sizeof(line), "\n[Metrics] %-20s %-7s %10llu %10llu %10llu %10llu %10llu %10llu",
+                 METRIC_NAMES[m], METRIC_UNITS[m], (unsigned long long)s.total,
+                 (unsigned long long)metric_quantile(s, 0.50), (unsigned long long)metric_quantile(s, 0.99),
+                 (unsigned long long)metric_quantile(s, 0.999), (unsigned long long)s.max,
+                 (unsigned long long)s.contended);
+        out += line;
+    }
+    delete summary;
+    return out;
+}
+
+// Machine-readable dump at shutdown (--metrics-file): summary statistics
+// plus the non-empty buckets as [highest value, count] pairs
+bool metrics_write_json(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+    MetricSummary* summary = new MetricSummary;
+    MetricSummary& s = *summary;
+    fprintf(file, "{\n  \"metrics\": [");
+    for (int m = 0; m < NUM_METRICS; ++m) {
+        metric_merge((Metric)m, &s);
+        fprintf(file, "%s\n    {\"name\": \"%s\", \"unit\": \"%s\", \"count\": %llu, \"contended\": %llu, "
+                      "\"mean\": %.1f, \"max\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu,\n"
+                      "     \"buckets\": [",
+                m ? "," : "", METRIC_NAMES[m], METRIC_UNITS[m], (unsigned long long)s.total,
+                (unsigned long long)s.contended, s.total ? (double)s.sum / s.total : 0.0,
+                (unsigned long long)s.max, (unsigned long long)metric_quantile(s, 0.50),
+                (unsigned long long)metric_quantile(s, 0.90), (unsigned long long)metric_quantile(s, 0.99),
+                (unsigned long long)metric_quantile(s, 0.999));
+        bool first = true;
+        for (int b = 0; b < HIST_BUCKETS; ++b) {
+            if (s.counts[b]) {
+                fprintf(file, "%s[%llu, %llu]", first ? "" : ", ",
+                        (unsigned long long)hist_bucket_high(b), (unsigned long long)s.counts[b]);
+                first = false;
+            }
+        }
+        fprintf(file, "]}");
+    }
+    fprintf(file, "\n  ]\n}\n");
+    delete summary;
+    return fclose(file) == 0;
+}
+
+// Bumped by every SIGUSR1; each instance's reporter dumps once per bump
+volatile sig_atomic_t metrics_dump_requests = 0;
+
+void metrics_on_signal(int) {
+    metrics_dump_requests = metrics_dump_requests + 1;
+}
+
+void* metrics_reporter_loop(void*) {
+    const long long POLL_NS = 100000000;
+    long long next_dump = sim->metrics_reporter.interval_ns ? monotonic_ns() + sim->metrics_reporter.interval_ns : LLONG_MAX;
+    sig_atomic_t seen = metrics_dump_requests;
+    pthread_mutex_lock(&sim->metrics_reporter.lock);
+    while (!sim->metrics_reporter.stopping) {
+        long long wake = min(next_dump, monotonic_ns() + POLL_NS);
+        timespec deadline;
+        deadline.tv_sec = wake / 1000000000;
+        deadline.tv_nsec = wake % 1000000000;
+        pthread_cond_timedwait(&sim->metrics_reporter.wakeup, &sim->metrics_reporter.lock, &deadline);
+        if (sim->metrics_reporter.stopping) {
+            break;
+        }
+        long long now = monotonic_ns();
+        if (metrics_dump_requests != seen || now >= next_dump) {
+            seen = metrics_dump_requests;
+            if (now >= next_dump) {
+                next_dump = now + sim->metrics_reporter.interval_ns;
+            }
+            pthread_mutex_unlock(&sim->metrics_reporter.lock);
+            safe_print(metrics_report());
+            pthread_mutex_lock(&sim->metrics_reporter.lock);
+        }
+    }
+    pthread_mutex_unlock(&sim->metrics_reporter.lock);
+    return nullptr;
+}
+
+void metrics_reporter_start(double interval_s) {
+    sim->metrics_reporter.interval_ns = (long long)(interval_s * 1e9);
+    sim->metrics_reporter.stopping = false;
+    pthread_mutex_init(&sim->metrics_reporter.lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sim->metrics_reporter.wakeup, &attr);
+    pthread_condattr_destroy(&attr);
+    signal(SIGUSR1, metrics_on_signal);
+    sim->metrics_reporter.running = sim_thread_create(&sim->metrics_reporter.thread, metrics_reporter_loop, NULL) == 0;
+}
+
+void metrics_reporter_stop() {
+    if (!sim->metrics_reporter.running) {
+        return;
+    }
+    pthread_mutex_lock(&sim->metrics_reporter.lock);
+    sim->metrics_reporter.stopping = true;
+    pthread_cond_signal(&sim->metrics_reporter.wakeup);
+    pthread_mutex_unlock(&sim->metrics_reporter.lock);
+    pthread_join(sim->metrics_reporter.thread, NULL);
+    sim->metrics_reporter.running = false;
+}
+
+// ========================== HELPER FUNCTIONS ================================
+#define RESET_COLOR "\033[0m"
+#define RED_COLOR "\033[31m"
+#define GREEN_COLOR "\033[32m"
+#define YELLOW_COLOR "\033[33m"
+#define BLUE_COLOR "\033[34m"
+#define MAGENTA_COLOR "\033[35m"
+#define CYAN_COLOR "\033[36m"
+#define WHITE_COLOR "\033[37m"
+pthread_mutex_t tool_print_lock = PTHREAD_MUTEX_INITIALIZER; // Callers outside any instance
+
+// Free-form console output for rare messages (reports, the billing
+// portal); simulation events go through the event logger instead
+void safe_print(const string& msg) {
+    pthread_mutex_t* lock = sim ? &sim->print_lock : &tool_print_lock;
+    FILE* out = sim ? sim->console : stdout;
+    long long locked_at = timed_lock(lock, METRIC_PRINT_LOCK_WAIT);
+    fprintf(out, WHITE_COLOR "%s" RESET_COLOR "\n", msg.c_str());
+    fflush(out);
+    timed_unlock(lock, METRIC_PRINT_LOCK_HOLD, locked_at);
+}
+
+// splitmix64 step: small, fast, and good enough for simulation noise.
+// Each flight and each scenario owns its state, so there is no shared
+// generator (and no hidden lock) like rand().
+uint64_t splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// ========================== SIMULATION CLOCK ================================
+
+/*
+All pacing goes through sim_now_us() instead of sleep()/usleep().
+REAL-TIME: simulated time follows CLOCK_MONOTONIC (optionally scaled by
+--time-scale), which is what the SFML visualizer needs.
+VIRTUAL: simulated time only moves when the scheduler jumps to the next
+event, so a run takes as long as its handlers need and, with one dispatch
+thread and a fixed --seed, is fully deterministic.
+*/
+
+void sim_clock_init(ClockMode mode, double time_scale) {
+    sim->sim_clock.mode = mode;
+    sim->sim_clock.time_scale = time_scale;
+    sim->sim_clock.virtual_us = 0;
+    clock_gettime(CLOCK_MONOTONIC, &sim->sim_clock.start);
+    // Virtual runs stamp logs from a fixed epoch so output is reproducible
+    sim->sim_clock.epoch = (mode == CLOCK_MODE_VIRTUAL) ? 0 : time(NULL);
+}
+
+// Microseconds of simulated time since the simulation started
+long long sim_now_us() {
+    if (sim->sim_clock.mode == CLOCK_MODE_VIRTUAL) {
+        return sim->sim_clock.virtual_us.load(memory_order_relaxed);
+    }
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long real_us = (now.tv_sec - sim->sim_clock.start.tv_sec) * 1000000LL +
+                        (now.tv_nsec - sim->sim_clock.start.tv_nsec) / 1000;
+    return (long long)(real_us * sim->sim_clock.time_scale);
+}
+
+// Wall-clock equivalent of the current simulated time, for log stamps
+time_t sim_wall_time() {
+    return sim->sim_clock.epoch + (time_t)(sim_now_us() / 1000000);
+}
+
+long long monotonic_ns() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// CLOCK_MONOTONIC deadline at which simulated time reaches sim_us
+// (REAL-TIME mode only)
+timespec sim_deadline(long long sim_us) {
+    long long real_us = (long long)(sim_us / sim->sim_clock.time_scale);
+    timespec deadline = sim->sim_clock.start;
+    deadline.tv_sec += real_us / 1000000;
+    deadline.tv_nsec += (real_us % 1000000) * 1000;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+// ========================== EVENT LOGGER ====================================
+
+/*
+Console output from the simulation goes through the event logger instead
+of safe_print(). A caller fills a fixed-size LogEvent (what happened, to
+which flight, phase, speed, runway) and pushes it into its own thread's
+ring: no lock, no allocation, no formatting. A background sink drains
+every ring, puts the batch back in global order, formats and colorizes
+it into one buffer and writes it with a single fwrite, so the console
+lock is taken once per batch instead of once per line.
+
+Order holds across batches too. A thread can take a sequence number and
+be preempted before publishing it, while others publish later numbers.
+So while pushing, each ring advertises a floor under the number it is
+claiming, and the sink only takes events below the lowest floor. The
+rest wait for the next batch.
+
+A thread whose ring is full sleeps on a futex the sink bumps after every
+batch, as a producer does on a full AVN ring, instead of spinning against
+the sink for the CPU.
+
+--log-level picks what reaches the console: debug (every phase change),
+info (runway and simulation events), warn (AVNs and dropped flights) or
+off. The filter is checked before anything is recorded, so a filtered-out
+event costs one relaxed load. While a trace is being recorded every event
+is pushed regardless, and the sink hands the ordered batch to the trace
+before filtering what it prints.
+*/
+
+// This thread's ring, valid while log_ring_owner is sim->id
+thread_local LogRing* log_ring = nullptr;
+thread_local uint64_t log_ring_owner = 0;
+
+bool log_enabled(LogLevel level) {
+    return level >= sim->event_log.level.load(memory_order_relaxed) || sim->event_log.tracing;
+}
+
+void log_wake_sink() {
+    pthread_mutex_lock(&sim->event_log.lock);
+    pthread_cond_signal(&sim->event_log.wakeup);
+    pthread_mutex_unlock(&sim->event_log.lock);
+}
+
+long futex(uint32_t* word, int op, uint32_t value, const timespec* timeout); // See AVN EVENT CHANNEL
+
+// Copies ev into this thread's ring. A full ring means the sink is behind;
+// the caller waits for it rather than lose console lines.
+void log_push(LogEvent& ev) {
+    if (log_ring_owner != sim->id) {
+        pthread_t self = pthread_self();
+        LogRing* ring = sim->event_log.rings.load(memory_order_acquire);
+        while (ring && !pthread_equal(ring->thread, self)) {
+            ring = ring->next;
+        }
+        if (!ring) {
+            ring = new LogRing(); // Zeroed
+            ring->claiming = ~0ULL;
+            ring->thread = self;
+            LogRing* head = sim->event_log.rings.load(memory_order_relaxed);
+            do {
+                ring->next = head;
+            } while (!sim->event_log.rings.compare_exchange_weak(head, ring, memory_order_release));
+        }
+        log_ring = ring;
+        log_ring_owner = sim->id;
+    }
+    unsigned long long h = log_ring->head.load(memory_order_relaxed);
+    while (h - log_ring->tail.load(memory_order_acquire) >= (unsigned long long)LOG_RING_SIZE) {
+        // Announce the sleep before the last look at the tail, so a batch
+        // taken in between either shows up there or voids the wait
+        __atomic_add_fetch(&sim->event_log.full_sleepers, 1, __ATOMIC_SEQ_CST);
+        uint32_t word = __atomic_load_n(&sim->event_log.drained_word, __ATOMIC_SEQ_CST);
+        log_wake_sink();
+        if (h - log_ring->tail.load(memory_order_seq_cst) >= (unsigned long long)LOG_RING_SIZE) {
+            timespec timeout = { 0, 10 * 1000000L };
+            futex(&sim->event_log.drained_word, FUTEX_WAIT, word, &timeout);
+        }
+        __atomic_sub_fetch(&sim->event_log.full_sleepers, 1, __ATOMIC_SEQ_CST);
+    }
+    // The floor goes up before the claim; the sink reads them the other
+    // way round, so it either sees this floor or a counter already past
+    // the number claimed here (all sequentially consistent)
+    log_ring->claiming.store(sim->event_log.seq.load());
+    ev.seq = sim->event_log.seq.fetch_add(1);
+    ev.sim_us = sim_now_us();
+    log_ring->events[h & (LOG_RING_SIZE - 1)] = ev;
+    log_ring->head.store(h + 1, memory_order_release);
+    log_ring->claiming.store(~0ULL, memory_order_release);
+}
+
+void log_copy_flight(LogEvent& ev, const char* flight_number) {
+    size_t n = strnlen(flight_number, sizeof(ev.flight_number) - 1);
+    memcpy(ev.flight_number, flight_number, n); // ev is zeroed, so it stays terminated
+}
+
+void log_phase(int index, const Aircraft& aircraft, Phase phase, int speed) {
+    if (!log_enabled(LOG_DEBUG)) return;
+    LogEvent ev = {};
+    ev.type = LOG_PHASE;
+    ev.level = LOG_DEBUG;
+    ev.aircraft = index;
+    ev.direction = aircraft.direction;
+    ev.phase = phase;
+    ev.speed = speed;
+    log_copy_flight(ev, aircraft.flight_number);
+    log_push(ev);
+}
+
+void log_runway(LogEventType type, int index, const char* flight_number, int runway) {
+    if (!log_enabled(LOG_INFO)) return;
+    LogEvent ev = {};
+    ev.type = type;
+    ev.level = LOG_INFO;
+    ev.aircraft = index;
+    ev.runway = runway;
+    log_copy_flight(ev, flight_number);
+    log_push(ev);
+}
+
+void log_avn(int index, const char* flight_number, const char* reason, int fine) {
+    if (!log_enabled(LOG_WARN)) return;
+    LogEvent ev = {};
+    ev.type = LOG_AVN;
+    ev.level = LOG_WARN;
+    ev.aircraft = index;
+    ev.fine = fine;
+    log_copy_flight(ev, flight_number);
+    memcpy(ev.text, reason, strnlen(reason, sizeof(ev.text) - 1));
+    log_push(ev);
+}
+
+void log_simple(LogLevel level, LogEventType type, const char* flight_number) {
+    if (!log_enabled(level)) return;
+    LogEvent ev = {};
+    ev.type = type;
+    ev.level = level;
+    ev.aircraft = -1;
+    log_copy_flight(ev, flight_number);
+    log_push(ev);
+}
+
+// Fleet membership, for the trace only; never printed
+void log_flight(LogEventType type, int index, const Aircraft& aircraft) {
+    if (!sim->event_log.tracing) return;
+    LogEvent ev = {};
+    ev.type = type;
+    ev.level = LOG_OFF;
+    ev.aircraft = index;
+    ev.aircraft_type = aircraft.type;
+    ev.direction = aircraft.direction;
+    ev.airport = aircraft.airport;
+    log_copy_flight(ev, aircraft.flight_number);
+    log_push(ev);
+}
+
+void trace_record_batch(const vector<LogEvent>& batch); // See TRACE RECORDER
+
+bool log_seq_less(const LogEvent& a, const LogEvent& b) {
+    return a.seq < b.seq;
+}
+
+// Appends the console line for ev, colour codes included
+void log_format(const LogEvent& ev, string& out) {
+    char line[256];
+    switch (ev.type) {
+    case LOG_PHASE:
+        snprintf(line, sizeof(line), GREEN_COLOR "[Flight %s] [%s] Phase: %s, Speed: %d km/h" RESET_COLOR "\n",
+                 ev.flight_number, ev.direction == ARRIVAL ? "ARRIVAL" : "DEPARTURE",
+                 PHASE_NAMES[ev.phase], ev.speed);
+        break;
+    case LOG_RUNWAY_ASSIGNED:
+        snprintf(line, sizeof(line), BLUE_COLOR "[Runway Assigned] %s is using %s" RESET_COLOR "\n\n",
+                 ev.flight_number, sim->runways[ev.runway].name);
+        break;
+    case LOG_RUNWAY_RELEASED:
+        snprintf(line, sizeof(line), MAGENTA_COLOR "[Runway Released] Runway %s is now available." RESET_COLOR "\n\n",
+                 sim->runways[ev.runway].name);
+        break;
+    case LOG_AVN:
+        snprintf(line, sizeof(line), RED_COLOR "[AVN] Violation by Flight %s - %s - Fine: $%d" RESET_COLOR "\n\n",
+                 ev.flight_number, ev.text, ev.fine);
+        break;
+    case LOG_FLIGHT_DROPPED:
+        snprintf(line, sizeof(line), WHITE_COLOR "[Scenario] No airport has a runway for %s; dropped." RESET_COLOR "\n",
+                 ev.flight_number);
+        break;
+    case LOG_FLEET_FULL:
+        snprintf(line, sizeof(line), WHITE_COLOR "[Scenario] Fleet storage full; remaining flights dropped." RESET_COLOR "\n");
+        break;
+    case LOG_SIM_END:
+        snprintf(line, sizeof(line), YELLOW_COLOR "\nSimulation Time Ended." RESET_COLOR "\n\n");
+        break;
+    default:
+        return;
+    }
+    out += line;
+}
+
+// Takes everything published so far below the lowest sequence number
+// still being claimed, in global order; returns how many
+size_t log_drain(vector<LogEvent>& batch, string& text) {
+    batch.clear();
+    // Counter first: a thread that claimed below it had already linked
+    // its ring, so the list read after it has every such ring
+    unsigned long long cut = sim->event_log.seq.load();
+    LogRing* rings = sim->event_log.rings.load(memory_order_acquire);
+    for (LogRing* ring = rings; ring; ring = ring->next) {
+        cut = min(cut, ring->claiming.load());
+    }
+    for (LogRing* ring = rings; ring; ring = ring->next) {
+        unsigned long long tail = ring->tail.load(memory_order_relaxed);
+        unsigned long long head = ring->head.load(memory_order_acquire);
+        for (; tail < head && ring->events[tail & (LOG_RING_SIZE - 1)].seq < cut; ++tail) {
+            batch.push_back(ring->events[tail & (LOG_RING_SIZE - 1)]);
+        }
+        ring->tail.store(tail, memory_order_release);
+    }
+    if (batch.empty()) {
+        return 0;
+    }
+    __atomic_add_fetch(&sim->event_log.drained_word, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sim->event_log.full_sleepers, __ATOMIC_SEQ_CST) > 0) {
+        futex(&sim->event_log.drained_word, FUTEX_WAKE, INT_MAX, NULL);
+    }
+    sort(batch.begin(), batch.end(), log_seq_less);
+    if (sim->trace.file) {
+        trace_record_batch(batch);
+    }
+    text.clear();
+    int level = sim->event_log.level.load(memory_order_relaxed);
+    for (size_t e = 0; e < batch.size(); ++e) {
+        if (batch[e].level >= level) { // Pushed only for the trace otherwise
+            log_format(batch[e], text);
+        }
+    }
+    if (text.empty()) {
+        return batch.size(); // Trace-only batch: nothing to print, so no console lock
+    }
+    long long locked_at = timed_lock(&sim->print_lock, METRIC_PRINT_LOCK_WAIT);
+    fwrite(text.data(), 1, text.size(), sim->console);
+    fflush(sim->console);
+    timed_unlock(&sim->print_lock, METRIC_PRINT_LOCK_HOLD, locked_at);
+    return batch.size();
+}
+
+// Sink thread: wakes every few milliseconds (or when a ring fills up)
+void* log_sink(void*) {
+    const long long POLL_NS = 5000000;
+    vector<LogEvent> batch;
+    string text;
+    pthread_mutex_lock(&sim->event_log.lock);
+    while (!sim->event_log.stopping) {
+        pthread_mutex_unlock(&sim->event_log.lock);
+        size_t drained = log_drain(batch, text);
+        pthread_mutex_lock(&sim->event_log.lock);
+        if (drained == 0 && !sim->event_log.stopping) {
+            long long wake = monotonic_ns() + POLL_NS;
+            timespec deadline;
+            deadline.tv_sec = wake / 1000000000;
+            deadline.tv_nsec = wake % 1000000000;
+            pthread_cond_timedwait(&sim->event_log.wakeup, &sim->event_log.lock, &deadline);
+        }
+    }
+    pthread_mutex_unlock(&sim->event_log.lock);
+    while (log_drain(batch, text) > 0) {
+        // Final flush: everything pushed before log_stop() is printed
+    }
+    return nullptr;
+}
+
+void log_start(LogLevel level) {
+    sim->event_log.level = level;
+    sim->event_log.stopping = false;
+    sim->event_log.drained_word = 0;
+    sim->event_log.full_sleepers = 0;
+    pthread_mutex_init(&sim->event_log.lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sim->event_log.wakeup, &attr);
+    pthread_condattr_destroy(&attr);
+    sim->event_log.running = sim_thread_create(&sim->event_log.sink, log_sink, NULL) == 0;
+}
+
+// Prints whatever is still buffered and stops the sink
+void log_stop() {
+    if (!sim->event_log.running) {
+        return;
+    }
+    pthread_mutex_lock(&sim->event_log.lock);
+    sim->event_log.stopping = true;
+    pthread_cond_signal(&sim->event_log.wakeup);
+    pthread_mutex_unlock(&sim->event_log.lock);
+    pthread_join(sim->event_log.sink, NULL);
+    sim->event_log.running = false;
+}
+
+// ========================== AVN RECORD STORE ================================
+
+/*
+Binary, append-only AVN history for the billing portal (avn_records.bin).
+The file is a header followed by fixed-width 64-byte records and is mapped
+with mmap, so AVN id N is simply record N - 1. Every record links to the
+previous record in the same flight hash bucket and to the previous record
+of the same airline. The header holds the newest id per flight bucket and
+an open-addressed airline table with each airline's newest id and running
+totals. A query therefore walks only its own chain, and airline totals
+are O(1). Unpaid AVNs form a doubly linked list through the records, so
+open lists never scan the whole history. Only the log writer thread
+appends; readers (the portal) map the file read-only. Once the run is
+over, the payment gateway maps it for update and changes statuses.
+*/
+
+uint32_t avn_hash(const char* key, size_t len) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len && key[i]; ++i) {
+        h = (h ^ (unsigned char)key[i]) * 16777619u;
+    }
+    return h;
+}
+
+uint32_t avn_flight_bucket(const char* flight) { return avn_hash(flight, 10) & (AVN_FLIGHT_BUCKETS - 1); }
+
+// Airline = two-letter prefix of the flight number ("PK303" -> "PK").
+// Returns its slot, claiming a free one if create is set; NULL if absent.
+AvnAirlineSlot* avn_airline_slot(AvnStoreHeader* h, const char* flight, bool create) {
+    uint32_t i = avn_hash(flight, 2) & (AVN_AIRLINE_SLOTS - 1);
+    for (int probes = 0; probes < AVN_AIRLINE_SLOTS; ++probes) {
+        AvnAirlineSlot* slot = &h->airlines[i];
+        if (!slot->used) {
+            if (!create) return NULL;
+            slot->used = 1;
+            memcpy(slot->code, flight, 2);
+            return slot;
+        }
+        if (memcmp(slot->code, flight, 2) == 0) return slot;
+        i = (i + 1) & (AVN_AIRLINE_SLOTS - 1);
+    }
+    return NULL;
+}
+
+bool avn_store_map(AvnStore* store, size_t bytes) {
+    void* base = mmap(NULL, bytes, store->writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                      MAP_SHARED, store->fd, 0);
+    if (base == MAP_FAILED) return false;
+    store->mapped_bytes = bytes;
+    store->header = (AvnStoreHeader*)base;
+    store->records = (AvnStoreRecord*)((char*)base + AVN_STORE_HEADER_BYTES);
+    return true;
+}
+
+bool avn_store_open(AvnStore* store, const char* path, AvnStoreMode mode) {
+    store->writable = mode != AVN_STORE_READ;
+    store->header = NULL;
+    store->fd = mode == AVN_STORE_CREATE ? open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)
+              : open(path, store->writable ? O_RDWR : O_RDONLY);
+    if (store->fd < 0) return false;
+
+    if (mode == AVN_STORE_CREATE) {
+        size_t bytes = AVN_STORE_HEADER_BYTES + AVN_STORE_INITIAL_CAPACITY * sizeof(AvnStoreRecord);
+        if (ftruncate(store->fd, bytes) != 0 || !avn_store_map(store, bytes)) {
+            close(store->fd);
+            return false;
+        }
+        memcpy(store->header->magic, AVN_STORE_MAGIC, sizeof(AVN_STORE_MAGIC));
+        store->header->record_size = sizeof(AvnStoreRecord);
+        store->header->capacity = AVN_STORE_INITIAL_CAPACITY;
+        return true; // The rest of a fresh file is already zero
+    }
+
+    struct stat st;
+    if (fstat(store->fd, &st) != 0 || (size_t)st.st_size < AVN_STORE_HEADER_BYTES ||
+        !avn_store_map(store, st.st_size)) {
+        close(store->fd);
+        return false;
+    }
+    if (memcmp(store->header->magic, AVN_STORE_MAGIC, sizeof(AVN_STORE_MAGIC)) != 0 ||
+        store->header->record_size != sizeof(AvnStoreRecord)) {
+        munmap(store->header, store->mapped_bytes);
+        close(store->fd);
+        return false;
+    }
+    return true;
+}
+
+void avn_store_close(AvnStore* store) {
+    if (!store->header) return;
+    if (store->writable) {
+        msync(store->header, store->mapped_bytes, MS_SYNC);
+    }
+    munmap(store->header, store->mapped_bytes);
+    close(store->fd);
+    store->header = NULL;
+}
+
+uint64_t avn_store_count(const AvnStore* store) {
+    return __atomic_load_n(&store->header->count, __ATOMIC_ACQUIRE);
+}
+
+// O(1): AVN ids are dense, starting at 1
+AvnStoreRecord* avn_store_get(const AvnStore* store, uint32_t avn_id) {
+    if (avn_id == 0 || avn_id > avn_store_count(store)) return NULL;
+    return &store->records[avn_id - 1];
+}
+
+// Doubles the file when full (writer only)
+// The larger mapping is made before the old one goes, so a failed grow
+// leaves the store as it was: still mapped, at its old capacity (the
+// file may stay longer, which nothing reads)
+bool avn_store_grow(AvnStore* store) {
+    uint64_t capacity = store->header->capacity * 2;
+    size_t bytes = AVN_STORE_HEADER_BYTES + capacity * sizeof(AvnStoreRecord);
+    if (ftruncate(store->fd, bytes) != 0) return false;
+    void* old_base = store->header;
+    size_t old_bytes = store->mapped_bytes;
+    if (!avn_store_map(store, bytes)) return false; // Fields untouched on failure
+    munmap(old_base, old_bytes);
+    store->header->capacity = capacity;
+    return true;
+}
+
+// Appends a new OPEN AVN; fills in id and links. Returns the id, 0 on failure.
+uint32_t avn_store_append(AvnStore* store, AvnStoreRecord record) {
+    AvnStoreHeader* h = store->header;
+    if (h->count == h->capacity && !avn_store_grow(store)) return 0;
+    h = store->header;
+
+    uint32_t id = (uint32_t)h->count + 1;
+    uint32_t fb = avn_flight_bucket(record.flight_number);
+    AvnAirlineSlot* airline = avn_airline_slot(h, record.flight_number, true);
+    record.avn_id = id;
+    record.status = AVN_OPEN;
+    record.prev_flight = h->flight_heads[fb];
+    record.prev_airline = airline->head;
+    record.open_prev = 0;
+    record.open_next = h->open_head;
+    store->records[id - 1] = record;
+
+    if (h->open_head) store->records[h->open_head - 1].open_prev = id;
+    h->open_head = id;
+    h->flight_heads[fb] = id;
+    airline->head = id;
+    airline->count++;
+    airline->unpaid_count++;
+    airline->total_fines += record.fine;
+    airline->unpaid_fines += record.fine;
+    h->total_fines += record.fine;
+    h->open_fines += record.fine;
+    h->open_count++;
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELEASE);
+    return id;
+}
+
+// Moves an AVN between OPEN/APPEALED/PAID, keeping the unpaid list and totals
+bool avn_store_set_status(AvnStore* store, uint32_t avn_id, AvnStatus status) {
+    AvnStoreRecord* r = avn_store_get(store, avn_id);
+    if (!r || !store->writable) return false;
+    AvnStoreHeader* h = store->header;
+    AvnAirlineSlot* airline = avn_airline_slot(h, r->flight_number, false);
+    bool was_unpaid = r->status != AVN_PAID;
+    bool unpaid = status != AVN_PAID;
+
+    if (was_unpaid && !unpaid) {
+        if (r->open_prev) store->records[r->open_prev - 1].open_next = r->open_next;
+        else h->open_head = r->open_next;
+        if (r->open_next) store->records[r->open_next - 1].open_prev = r->open_prev;
+        r->open_prev = r->open_next = 0;
+        h->open_fines -= r->fine;
+        h->open_count--;
+        airline->unpaid_fines -= r->fine;
+        airline->unpaid_count--;
+    } else if (!was_unpaid && unpaid) {
+        r->open_prev = 0;
+        r->open_next = h->open_head;
+        if (h->open_head) store->records[h->open_head - 1].open_prev = avn_id;
+        h->open_head = avn_id;
+        h->open_fines += r->fine;
+        h->open_count++;
+        airline->unpaid_fines += r->fine;
+        airline->unpaid_count++;
+    }
+    r->status = status;
+    return true;
+}
+
+/*
+Chain walks, newest first, without allocating:
+    for (uint32_t id = avn_store_first_for_flight(s, "PK303"); id;
+         id = avn_store_next_for_flight(s, "PK303", id)) { ... }
+*/
+uint32_t avn_store_skip_to_flight(const AvnStore* store, const char* flight, uint32_t id) {
+    while (id && strncmp(store->records[id - 1].flight_number, flight, 10) != 0) {
+        id = store->records[id - 1].prev_flight;
+    }
+    return id;
+}
+
+uint32_t avn_store_first_for_flight(const AvnStore* store, const char* flight) {
+    return avn_store_skip_to_flight(store, flight, store->header->flight_heads[avn_flight_bucket(flight)]);
+}
+
+uint32_t avn_store_next_for_flight(const AvnStore* store, const char* flight, uint32_t id) {
+    return avn_store_skip_to_flight(store, flight, store->records[id - 1].prev_flight);
+}
+
+// Airline chains are exact, no filtering needed
+uint32_t avn_store_first_for_airline(const AvnStore* store, const char* airline) {
+    AvnAirlineSlot* slot = avn_airline_slot(store->header, airline, false);
+    return slot ? slot->head : 0;
+}
+
+uint32_t avn_store_next_for_airline(const AvnStore* store, uint32_t id) {
+    return store->records[id - 1].prev_airline;
+}
+
+void print_avn_record(const AvnStoreRecord& r) {
+    printf("AVN-%u  %-9.10s %-10s %-8s %4d km/h  $%-5d %s\n", r.avn_id, r.flight_number,
+           AIRCRAFT_TYPE_NAMES[r.type], PHASE_NAMES[r.phase], r.speed, r.fine,
+           AVN_STATUS_NAMES[r.status]);
+}
+
+// --avn-query KEY: AVN id (digits), airline (2 letters) or flight number
+int run_avn_query(const char* store_path, const char* key) {
+    AvnStore store;
+    if (!avn_store_open(&store, store_path, AVN_STORE_READ)) {
+        printf("No AVN store at %s\n", store_path);
+        return 1;
+    }
+    int matches = 0;
+    if (key[0] >= '0' && key[0] <= '9') {
+        AvnStoreRecord* r = avn_store_get(&store, (uint32_t)strtoul(key, NULL, 10));
+        if (r) { print_avn_record(*r); matches++; }
+    } else if (strlen(key) == 2) {
+        for (uint32_t id = avn_store_first_for_airline(&store, key); id;
+             id = avn_store_next_for_airline(&store, id)) {
+            print_avn_record(store.records[id - 1]);
+            matches++;
+        }
+        AvnAirlineSlot* slot = avn_airline_slot(store.header, key, false);
+        if (slot) {
+            printf("%.2s: %u AVNs, $%lld issued, $%lld unpaid\n", slot->code, slot->count,
+                   (long long)slot->total_fines, (long long)slot->unpaid_fines);
+        }
+    } else {
+        char flight[10] = {0};
+        strncpy(flight, key, sizeof(flight) - 1);
+        for (uint32_t id = avn_store_first_for_flight(&store, flight); id;
+             id = avn_store_next_for_flight(&store, flight, id)) {
+            print_avn_record(store.records[id - 1]);
+            matches++;
+        }
+    }
+    if (matches == 0) printf("No AVNs match %s\n", key);
+    avn_store_close(&store);
+    return matches ? 0 : 1;
+}
+
+int payment_settle_all(const char* store_path);
+
+// Airline Billing Portal, run once the simulation is over: unpaid AVNs
+// and what each airline owes, straight from the store's header, then
+// payment through the settlement gateway
+int run_billing_summary(const char* store_path) {
+    safe_print("\n🧾 Launching Airline Billing Portal...\n");
+
+    AvnStore store;
+    if (!avn_store_open(&store, store_path, AVN_STORE_READ) || avn_store_count(&store) == 0) {
+        safe_print("No AVNs to process. All aircrafts compliant.");
+        return 0;
+    }
+    safe_print("📋 AVN Fine Summary:");
+
+    // Unpaid AVNs straight off the open list, newest first
+    const int MAX_LISTED = 20;
+    int listed = 0;
+    for (uint32_t id = store.header->open_head; id && listed < MAX_LISTED;
+         id = store.records[id - 1].open_next, ++listed) {
+        print_avn_record(store.records[id - 1]);
+    }
+    if (store.header->open_count > (uint64_t)listed) {
+        printf("... and %llu more unpaid AVNs\n",
+               (unsigned long long)(store.header->open_count - listed));
+    }
+
+    // Per-airline totals come from the header, not from the records
+    printf("\n");
+    for (int i = 0; i < AVN_AIRLINE_SLOTS; ++i) {
+        const AvnAirlineSlot& slot = store.header->airlines[i];
+        if (slot.used) {
+            printf("✈️  %.2s: %u AVNs, $%lld due\n", slot.code, slot.unpaid_count,
+                   (long long)slot.unpaid_fines);
+        }
+    }
+
+    printf("\n💰 Total Fine Amount Due: $%lld\n", (long long)store.header->open_fines);
+    avn_store_close(&store);
+    printf("✅ Processing payment...\n");
+    return payment_settle_all(store_path);
+}
+
+// ========================== AVN EVENT CHANNEL ===============================
+
+/*
+Live AVN feed from the ATC core to airline/billing portal processes over
+POSIX shared memory (shm_open + mmap). One producer (the AVN log writer)
+broadcasts into a ring of cache-line slots. Every consumer keeps its own
+cursor and reads events in place in the shared mapping (zero copy). A
+slot's seq is cleared while it is rewritten and set to its message number
++ 1 afterwards, so a reader that was lapped can tell and skip ahead. The
+producer never waits for slow portals unless asked to be lossless (the
+benchmark). Idle consumers sleep on a futex in the shared header, and the
+producer only makes the wake syscall when someone is actually sleeping.
+*/
+
+long futex(uint32_t* word, int op, uint32_t value, const timespec* timeout) {
+    return syscall(SYS_futex, word, op, value, timeout, NULL, 0);
+}
+
+bool avn_channel_map(AvnChannel* channel, int fd) {
+    channel->mapped_bytes = sizeof(AvnChannelHeader) + AVN_CHANNEL_SLOTS * sizeof(AvnChannelSlot);
+    void* base = mmap(NULL, channel->mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+    channel->header = (AvnChannelHeader*)base;
+    channel->slots = (AvnChannelSlot*)((char*)base + sizeof(AvnChannelHeader));
+    return true;
+}
+
+// Producer side: creates (replacing any stale region) a fresh channel
+bool avn_channel_create(AvnChannel* channel, const char* name) {
+    snprintf(channel->name, sizeof(channel->name), "%s", name);
+    channel->owner = true;
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return false;
+    if (ftruncate(fd, sizeof(AvnChannelHeader) + AVN_CHANNEL_SLOTS * sizeof(AvnChannelSlot)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    if (!avn_channel_map(channel, fd)) {
+        shm_unlink(name);
+        return false;
+    }
+    channel->header->slots = AVN_CHANNEL_SLOTS;
+    __atomic_store_n(&channel->header->magic, AVN_CHANNEL_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Consumer side: maps an existing channel, e.g. from a separate portal process
+bool avn_channel_attach(AvnChannel* channel, const char* name) {
+    snprintf(channel->name, sizeof(channel->name), "%s", name);
+    channel->owner = false;
+    int fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0 || !avn_channel_map(channel, fd)) return false;
+    if (__atomic_load_n(&channel->header->magic, __ATOMIC_ACQUIRE) != AVN_CHANNEL_MAGIC) {
+        munmap(channel->header, channel->mapped_bytes);
+        return false;
+    }
+    return true;
+}
+
+void avn_channel_wake(AvnChannel* channel) {
+    __atomic_add_fetch(&channel->header->futex_word, 1, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&channel->header->sleepers, __ATOMIC_ACQUIRE) > 0) {
+        futex(&channel->header->futex_word, FUTEX_WAKE, INT_MAX, NULL);
+    }
+}
+
+// Lowest cursor among registered consumers (lossless publishing only)
+uint64_t avn_channel_min_cursor(AvnChannel* channel, uint64_t fallback) {
+    uint64_t low = fallback;
+    for (int i = 0; i < AVN_CHANNEL_MAX_CONSUMERS; ++i) {
+        if (__atomic_load_n(&channel->header->consumer_used[i], __ATOMIC_ACQUIRE)) {
+            low = min(low, __atomic_load_n(&channel->header->consumer_cursor[i], __ATOMIC_ACQUIRE));
+        }
+    }
+    return low;
+}
+
+// Single producer. lossless waits for the slowest registered consumer
+// instead of overwriting events it has not read yet.
+void avn_channel_publish(AvnChannel* channel, const AvnEvent& event, bool lossless) {
+    AvnChannelHeader* h = channel->header;
+    uint64_t seq = h->write_seq;
+    if (lossless) {
+        while (seq - avn_channel_min_cursor(channel, seq) >= AVN_CHANNEL_SLOTS) {
+            sched_yield();
+        }
+    }
+    AvnChannelSlot* slot = &channel->slots[seq & (AVN_CHANNEL_SLOTS - 1)];
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    atomic_thread_fence(memory_order_release);
+    slot->event = event;
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&h->write_seq, seq + 1, __ATOMIC_RELEASE);
+    avn_channel_wake(channel);
+}
+
+void avn_channel_close(AvnChannel* channel) {
+    if (!channel->header) return;
+    if (channel->owner) {
+        __atomic_store_n(&channel->header->closed, 1, __ATOMIC_RELEASE);
+        avn_channel_wake(channel);
+    }
+    munmap(channel->header, channel->mapped_bytes);
+    channel->header = NULL;
+    if (channel->owner) shm_unlink(channel->name);
+}
+
+// from_start: replay what is still in the ring; otherwise only new events
+void avn_channel_subscribe(AvnChannel* channel, AvnConsumer* consumer, bool from_start) {
+    AvnChannelHeader* h = channel->header;
+    uint64_t now = __atomic_load_n(&h->write_seq, __ATOMIC_ACQUIRE);
+    consumer->channel = channel;
+    consumer->cursor = (from_start && now > AVN_CHANNEL_SLOTS) ? now - AVN_CHANNEL_SLOTS :
+                       from_start ? 0 : now;
+    consumer->lost = 0;
+    consumer->index = -1;
+    for (int i = 0; i < AVN_CHANNEL_MAX_CONSUMERS; ++i) {
+        uint32_t expected = 0;
+        if (__atomic_compare_exchange_n(&h->consumer_used[i], &expected, 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            __atomic_store_n(&h->consumer_cursor[i], consumer->cursor, __ATOMIC_RELEASE);
+            consumer->index = i;
+            break;
+        }
+    }
+}
+
+void avn_channel_unsubscribe(AvnConsumer* consumer) {
+    if (consumer->index >= 0) {
+        __atomic_store_n(&consumer->channel->header->consumer_used[consumer->index], 0, __ATOMIC_RELEASE);
+        consumer->index = -1;
+    }
+}
+
+/*
+Zero-copy read: returns a pointer straight into the shared ring, or NULL
+when there is nothing new. Use the event in place, then call
+avn_channel_consume(); if that returns false the slot was overwritten
+mid-read and whatever was read must be discarded.
+*/
+const AvnEvent* avn_channel_peek(AvnConsumer* consumer) {
+    AvnChannelHeader* h = consumer->channel->header;
+    uint64_t written = __atomic_load_n(&h->write_seq, __ATOMIC_ACQUIRE);
+    if (written - consumer->cursor > AVN_CHANNEL_SLOTS) {
+        // Lapped by the producer: skip to the oldest event still in the ring
+        consumer->lost += written - AVN_CHANNEL_SLOTS - consumer->cursor;
+        consumer->cursor = written - AVN_CHANNEL_SLOTS;
+    }
+    if (consumer->cursor == written) return NULL;
+    AvnChannelSlot* slot = &consumer->channel->slots[consumer->cursor & (AVN_CHANNEL_SLOTS - 1)];
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != consumer->cursor + 1) return NULL;
+    return &slot->event;
+}
+
+bool avn_channel_consume(AvnConsumer* consumer) {
+    AvnChannelSlot* slot = &consumer->channel->slots[consumer->cursor & (AVN_CHANNEL_SLOTS - 1)];
+    atomic_thread_fence(memory_order_acquire);
+    bool intact = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == consumer->cursor + 1;
+    if (!intact) consumer->lost++;
+    consumer->cursor++;
+    if (consumer->index >= 0) {
+        __atomic_store_n(&consumer->channel->header->consumer_cursor[consumer->index],
+                         consumer->cursor, __ATOMIC_RELEASE);
+    }
+    return intact;
+}
+
+// Sleeps until the producer publishes or closes, or timeout_ms passes.
+// Returns false once the channel is closed and fully drained.
+bool avn_channel_wait(AvnConsumer* consumer, int timeout_ms) {
+    AvnChannelHeader* h = consumer->channel->header;
+    uint32_t word = __atomic_load_n(&h->futex_word, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&h->write_seq, __ATOMIC_ACQUIRE) != consumer->cursor) return true;
+    if (__atomic_load_n(&h->closed, __ATOMIC_ACQUIRE)) return false;
+
+    timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    __atomic_add_fetch(&h->sleepers, 1, __ATOMIC_ACQ_REL);
+    futex(&h->futex_word, FUTEX_WAIT, word, &timeout); // Returns at once if word moved
+    __atomic_sub_fetch(&h->sleepers, 1, __ATOMIC_ACQ_REL);
+    return true;
+}
+
+// Portal process: streams one airline's AVNs (or every airline for "ALL")
+// live, keeping a running amount due, until the simulation closes the channel
+int run_portal(const char* channel_name, const char* airline) {
+    AvnChannel channel;
+    if (!avn_channel_attach(&channel, channel_name)) {
+        printf("[Portal %s] No running simulation at %s\n", airline, channel_name);
+        return 1;
+    }
+    bool all = strcmp(airline, "ALL") == 0;
+    AvnConsumer consumer;
+    avn_channel_subscribe(&channel, &consumer, true);
+
+    long long due = 0;
+    int count = 0;
+    for (;;) {
+        const AvnEvent* ev = avn_channel_peek(&consumer);
+        if (!ev) {
+            if (!avn_channel_wait(&consumer, 100)) break;
+            continue;
+        }
+        // Filter and read in place; only what is printed gets copied
+        bool mine = all || strncmp(ev->flight_number, airline, 2) == 0;
+        uint32_t avn_id = ev->avn_id;
+        int fine = ev->fine;
+        char flight[11] = {0};
+        if (mine) memcpy(flight, ev->flight_number, 10);
+        if (avn_channel_consume(&consumer) && mine) {
+            due += fine;
+            count++;
+            printf("[Portal %s] AVN-%u %s fined $%d (%d AVNs, $%lld due)\n",
+                   airline, avn_id, flight, fine, count, due);
+            fflush(stdout);
+        }
+    }
+    printf("[Portal %s] Channel closed: %d AVNs, $%lld due, %llu events missed\n",
+           airline, count, due, (unsigned long long)consumer.lost);
+    fflush(stdout); // Forked portals leave through _exit()
+    avn_channel_unsubscribe(&consumer);
+    avn_channel_close(&channel);
+    return 0;
+}
+
+// --bench-ipc N: one producer, one consumer process, lossless, N events
+int run_ipc_benchmark(long long n) {
+    AvnChannel channel;
+    const char* name = "/atc_avn_bench";
+    if (!avn_channel_create(&channel, name)) {
+        printf("[IPC Bench] shm_open failed\n");
+        return 1;
+    }
+    AvnConsumer consumer;
+    avn_channel_subscribe(&channel, &consumer, true); // Registered before fork
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        long long received = 0, checksum = 0;
+        while (received < n) {
+            const AvnEvent* ev = avn_channel_peek(&consumer);
+            if (!ev) {
+                if (!avn_channel_wait(&consumer, 100)) break;
+                continue;
+            }
+            int fine = ev->fine; // Read in place
+            if (avn_channel_consume(&consumer)) {
+                checksum += fine;
+                received++;
+            }
+        }
+        _exit(received == n && checksum == n * (long long)FINE_CARGO ? 0 : 1);
+    }
+
+    AvnEvent event;
+    memset(&event, 0, sizeof(event));
+    memcpy(event.flight_number, "FX101", 6);
+    event.fine = FINE_CARGO;
+
+    long long start = monotonic_ns();
+    for (long long i = 0; i < n; ++i) {
+        event.avn_id = (uint32_t)(i + 1);
+        avn_channel_publish(&channel, event, true);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    double seconds = (monotonic_ns() - start) / 1e9;
+
+    printf("[IPC Bench] %lld events in %.3f s: %.2f M msgs/s, consumer %s\n", n, seconds,
+           n / seconds / 1e6, WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "verified" : "FAILED");
+    avn_channel_close(&channel);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+// ========================== PAYMENT GATEWAY =================================
+
+/*
+Settles AVNs once the run is over. Airline portal processes put "pay" and
+"appeal" requests into slots of a shared-memory region and sleep on their
+slot's futex. One gateway process owns the AVN store and is the only one
+that changes it. Each pass, the gateway takes every submitted slot and
+checks the request against the store. It appends the accepted ones to the
+write-ahead log (avn_records.bin.wal) with one write() and makes them
+durable with one fdatasync(). This is the group commit: a single flush
+covers everyone who asked while the previous flush was running. Only then
+are the changes applied to the mapped store and the portals answered, so
+the store itself is never flushed per request. On startup the gateway
+replays the log into the store. Replay stops at the first torn or corrupt
+record and cuts the log off there. A new run clears the log along with the
+store.
+*/
+
+string payment_wal_path(const char* store_path) {
+    return string(store_path) + ".wal";
+}
+
+uint32_t payment_wal_checksum(const PaymentWalRecord& record) {
+    const unsigned char* bytes = (const unsigned char*)&record;
+    uint32_t h = 2166136261u; // FNV-1a, every byte after the checksum
+    for (size_t i = offsetof(PaymentWalRecord, lsn); i < sizeof(record); ++i) {
+        h = (h ^ bytes[i]) * 16777619u;
+    }
+    return h;
+}
+
+// An appeal needs an OPEN AVN; paying settles an OPEN or APPEALED one
+bool payment_allowed(AvnStatus from, AvnStatus to) {
+    return from != AVN_PAID && (to == AVN_PAID || (to == AVN_APPEALED && from == AVN_OPEN));
+}
+
+// Maps the store for update and replays the log into it (crash recovery).
+// Returns the records replayed, -1 if either file can't be opened.
+long long payment_ledger_open(PaymentLedger* ledger, const char* store_path, off_t* torn_bytes) {
+    *torn_bytes = 0;
+    if (!avn_store_open(&ledger->store, store_path, AVN_STORE_UPDATE)) return -1;
+    ledger->wal_fd = open(payment_wal_path(store_path).c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (ledger->wal_fd < 0 || fstat(ledger->wal_fd, &st) != 0) {
+        if (ledger->wal_fd >= 0) close(ledger->wal_fd);
+        avn_store_close(&ledger->store);
+        return -1;
+    }
+
+    ledger->next_lsn = 1;
+    ledger->wal_bytes = 0;
+    long long replayed = 0;
+    PaymentWalRecord chunk[256];
+    bool intact = true;
+    while (intact) {
+        ssize_t got = pread(ledger->wal_fd, chunk, sizeof(chunk), ledger->wal_bytes);
+        int n = got > 0 ? (int)(got / sizeof(PaymentWalRecord)) : 0;
+        for (int k = 0; k < n && intact; ++k) {
+            const PaymentWalRecord& r = chunk[k];
+            intact = r.magic == PAYMENT_WAL_MAGIC && r.checksum == payment_wal_checksum(r) &&
+                     r.lsn == ledger->next_lsn;
+            if (intact) {
+                avn_store_set_status(&ledger->store, r.avn_id, (AvnStatus)r.status); // Idempotent
+                ledger->next_lsn++;
+                ledger->wal_bytes += sizeof(r);
+                replayed++;
+            }
+        }
+        intact = intact && got == (ssize_t)sizeof(chunk);
+    }
+
+    // Whatever follows the last good record was never acknowledged
+    *torn_bytes = st.st_size - ledger->wal_bytes;
+    if (*torn_bytes > 0 && (ftruncate(ledger->wal_fd, ledger->wal_bytes) != 0 || fdatasync(ledger->wal_fd) != 0)) {
+        close(ledger->wal_fd);
+        avn_store_close(&ledger->store);
+        return -1;
+    }
+    return replayed;
+}
+
+void payment_ledger_close(PaymentLedger* ledger) {
+    close(ledger->wal_fd);
+    avn_store_close(&ledger->store); // msync: the log could be dropped after this
+}
+
+// Group commit: the whole batch in one write and one fdatasync. On failure
+// the log is cut back, so a half-written batch is never replayed.
+bool payment_ledger_commit(PaymentLedger* ledger) {
+    const char* data = (const char*)ledger->batch.data();
+    size_t bytes = ledger->batch.size() * sizeof(PaymentWalRecord);
+    size_t done = 0;
+    while (done < bytes) {
+        ssize_t n = pwrite(ledger->wal_fd, data + done, bytes - done, ledger->wal_bytes + done);
+        if (n <= 0) break;
+        done += n;
+    }
+    if (done == bytes && fdatasync(ledger->wal_fd) == 0) {
+        ledger->wal_bytes += bytes;
+        return true;
+    }
+    if (ftruncate(ledger->wal_fd, ledger->wal_bytes) != 0) {
+        perror("payment log");
+    }
+    ledger->next_lsn -= ledger->batch.size();
+    return false;
+}
+
+bool payment_gateway_map(PaymentGateway* gateway, int fd) {
+    void* base = mmap(NULL, sizeof(PaymentGatewayHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+    gateway->header = (PaymentGatewayHeader*)base;
+    return true;
+}
+
+// Owner side: creates (replacing any stale region) the request slots,
+// before the gateway and the portals are forked
+bool payment_gateway_create(PaymentGateway* gateway, const char* name) {
+    snprintf(gateway->name, sizeof(gateway->name), "%s", name);
+    gateway->owner = true;
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return false;
+    if (ftruncate(fd, sizeof(PaymentGatewayHeader)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    if (!payment_gateway_map(gateway, fd)) {
+        shm_unlink(name);
+        return false;
+    }
+    __atomic_store_n(&gateway->header->magic, PAYMENT_GATEWAY_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Client side: maps a running gateway's slots from a separate process
+bool payment_gateway_attach(PaymentGateway* gateway, const char* name) {
+    snprintf(gateway->name, sizeof(gateway->name), "%s", name);
+    gateway->owner = false;
+    int fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0 || !payment_gateway_map(gateway, fd)) return false;
+    if (__atomic_load_n(&gateway->header->magic, __ATOMIC_ACQUIRE) != PAYMENT_GATEWAY_MAGIC) {
+        munmap(gateway->header, sizeof(PaymentGatewayHeader));
+        return false;
+    }
+    return true;
+}
+
+void payment_gateway_close(PaymentGateway* gateway) {
+    if (!gateway->header) return;
+    munmap(gateway->header, sizeof(PaymentGatewayHeader));
+    gateway->header = NULL;
+    if (gateway->owner) shm_unlink(gateway->name);
+}
+
+// Asks the gateway to answer what is already submitted and exit
+void payment_gateway_stop(PaymentGateway* gateway) {
+    PaymentGatewayHeader* h = gateway->header;
+    __atomic_store_n(&h->stopping, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&h->submit_word, 1, __ATOMIC_SEQ_CST);
+    futex(&h->submit_word, FUTEX_WAKE, 1, NULL);
+}
+
+void payment_answer(PaymentGatewayHeader* h, int i, PaymentResult result, int fine, uint64_t lsn) {
+    PaymentSlot* slot = &h->slots[i];
+    slot->result = result;
+    slot->fine = fine;
+    slot->lsn = lsn;
+    __atomic_store_n(&slot->state, PAYMENT_SLOT_DONE, __ATOMIC_RELEASE);
+    futex(&slot->state, FUTEX_WAKE, 1, NULL);
+}
+
+// A slot the gateway has just taken: either queued for the next commit or
+// answered straight away
+void payment_take(PaymentGatewayHeader* h, PaymentLedger* ledger, int i) {
+    PaymentSlot* slot = &h->slots[i];
+    for (size_t k = 0; k < ledger->batch.size(); ++k) {
+        if (ledger->batch[k].avn_id == slot->avn_id) {
+            // Checked against the store once this batch is applied
+            __atomic_store_n(&slot->state, PAYMENT_SLOT_SUBMITTED, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+    AvnStoreRecord* r = avn_store_get(&ledger->store, slot->avn_id);
+    PaymentResult result = PAYMENT_OK;
+    if (!r) {
+        result = PAYMENT_NO_SUCH_AVN;
+    } else if (memcmp(slot->airline, "**", 2) != 0 && memcmp(slot->airline, r->flight_number, 2) != 0) {
+        result = PAYMENT_NOT_OWNER;
+    } else if (!payment_allowed((AvnStatus)r->status, (AvnStatus)slot->status)) {
+        result = PAYMENT_REJECTED;
+    }
+    if (result != PAYMENT_OK) {
+        payment_answer(h, i, result, 0, 0);
+        return;
+    }
+    PaymentWalRecord record;
+    memset(&record, 0, sizeof(record));
+    record.magic = PAYMENT_WAL_MAGIC;
+    record.lsn = ledger->next_lsn++;
+    record.avn_id = slot->avn_id;
+    record.status = slot->status;
+    memcpy(record.airline, slot->airline, 2);
+    record.fine = r->fine;
+    record.checksum = payment_wal_checksum(record);
+    ledger->batch.push_back(record);
+    ledger->batch_slots.push_back(i);
+}
+
+// Flag for the stand-alone gateway (--gateway)
+volatile sig_atomic_t payment_gateway_signalled = 0;
+
+void payment_gateway_on_signal(int) {
+    payment_gateway_signalled = 1;
+}
+
+// Gateway loop: one group commit per pass over the slots, until it is
+// stopped and everything submitted before that has been answered
+void payment_gateway_serve(PaymentGateway* gateway, PaymentLedger* ledger) {
+    PaymentGatewayHeader* h = gateway->header;
+    __atomic_store_n(&h->gateway_pid, (int32_t)getpid(), __ATOMIC_RELEASE);
+    ledger->batch.reserve(PAYMENT_SLOTS);
+    ledger->batch_slots.reserve(PAYMENT_SLOTS);
+    bool draining = false;
+    for (;;) {
+        uint32_t word = __atomic_load_n(&h->submit_word, __ATOMIC_ACQUIRE);
+        ledger->batch.clear();
+        ledger->batch_slots.clear();
+        for (int i = 0; i < PAYMENT_SLOTS; ++i) {
+            uint32_t expected = PAYMENT_SLOT_SUBMITTED;
+            if (__atomic_load_n(&h->slots[i].state, __ATOMIC_ACQUIRE) == PAYMENT_SLOT_SUBMITTED &&
+                __atomic_compare_exchange_n(&h->slots[i].state, &expected, PAYMENT_SLOT_TAKEN, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                payment_take(h, ledger, i);
+            }
+        }
+
+        if (!ledger->batch.empty()) {
+            long long start = monotonic_ns();
+            bool durable = payment_ledger_commit(ledger);
+            long long elapsed = monotonic_ns() - start;
+            for (size_t k = 0; k < ledger->batch.size(); ++k) {
+                const PaymentWalRecord& r = ledger->batch[k];
+                if (durable) {
+                    avn_store_set_status(&ledger->store, r.avn_id, (AvnStatus)r.status);
+                }
+                payment_answer(h, ledger->batch_slots[k], durable ? PAYMENT_OK : PAYMENT_LOG_FAILED,
+                               durable ? r.fine : 0, durable ? r.lsn : 0);
+            }
+            if (durable) {
+                __atomic_add_fetch(&h->commits, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&h->settled, ledger->batch.size(), __ATOMIC_RELAXED);
+                __atomic_add_fetch(&h->commit_ns, (uint64_t)elapsed, __ATOMIC_RELAXED);
+                if (ledger->batch.size() > __atomic_load_n(&h->max_batch, __ATOMIC_RELAXED)) {
+                    __atomic_store_n(&h->max_batch, (uint64_t)ledger->batch.size(), __ATOMIC_RELAXED);
+                }
+            }
+            continue; // More arrived during the flush; they form the next group
+        }
+        if (draining) break;
+        if (payment_gateway_signalled || __atomic_load_n(&h->stopping, __ATOMIC_SEQ_CST)) {
+            // Closed first, then one more pass: a portal that submitted
+            // before it saw closed is still answered
+            __atomic_store_n(&h->closed, 1, __ATOMIC_SEQ_CST);
+            draining = true;
+            continue;
+        }
+        timespec timeout = { 0, 100000000L };
+        __atomic_store_n(&h->gateway_sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&h->submit_word, __ATOMIC_SEQ_CST) == word) {
+            futex(&h->submit_word, FUTEX_WAIT, word, &timeout);
+        }
+        __atomic_store_n(&h->gateway_sleeping, 0, __ATOMIC_RELEASE);
+    }
+}
+
+// Gateway process body: recovery, then serving until stopped
+int payment_gateway_main(PaymentGateway* gateway, const char* store_path, bool report) {
+    PaymentLedger ledger;
+    off_t torn = 0;
+    long long replayed = payment_ledger_open(&ledger, store_path, &torn);
+    if (replayed < 0) {
+        printf("[Gateway] Cannot open %s or its log\n", store_path);
+        __atomic_store_n(&gateway->header->closed, 1, __ATOMIC_SEQ_CST);
+        fflush(stdout);
+        return 1;
+    }
+    if (report && (replayed > 0 || torn > 0)) {
+        printf("[Gateway] Recovered %lld settlements from %s (%lld torn bytes cut off)\n", replayed,
+               payment_wal_path(store_path).c_str(), (long long)torn);
+        fflush(stdout);
+    }
+    payment_gateway_serve(gateway, &ledger);
+    payment_ledger_close(&ledger);
+
+    PaymentGatewayHeader* h = gateway->header;
+    if (report && h->commits) {
+        printf("[Gateway] %llu settlements in %llu group commits (%.1f per fsync, max %llu), fsync mean %.0f us\n",
+               (unsigned long long)h->settled, (unsigned long long)h->commits, (double)h->settled / h->commits,
+               (unsigned long long)h->max_batch, h->commit_ns / 1e3 / h->commits);
+    }
+    fflush(stdout); // Forked gateways leave through _exit()
+    return 0;
+}
+
+// Portal side, from any attached process: submits one request and sleeps
+// until it is committed or turned down
+PaymentResult payment_request(PaymentGateway* gateway, const char* airline, uint32_t avn_id, AvnStatus status,
+                              int* fine) {
+    PaymentGatewayHeader* h = gateway->header;
+    PaymentSlot* slot = NULL;
+    while (!slot) {
+        if (__atomic_load_n(&h->closed, __ATOMIC_ACQUIRE)) return PAYMENT_UNAVAILABLE;
+        uint32_t start = __atomic_fetch_add(&h->claim_hint, 1, __ATOMIC_RELAXED);
+        for (int k = 0; k < PAYMENT_SLOTS && !slot; ++k) {
+            PaymentSlot* candidate = &h->slots[(start + k) % PAYMENT_SLOTS];
+            uint32_t expected = PAYMENT_SLOT_FREE;
+            if (__atomic_load_n(&candidate->state, __ATOMIC_RELAXED) == PAYMENT_SLOT_FREE &&
+                __atomic_compare_exchange_n(&candidate->state, &expected, PAYMENT_SLOT_CLAIMED, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                slot = candidate;
+            }
+        }
+        if (!slot) sched_yield(); // Every slot is in flight
+    }
+    slot->avn_id = avn_id;
+    slot->status = status;
+    memcpy(slot->airline, airline, 2);
+    __atomic_store_n(&slot->state, PAYMENT_SLOT_SUBMITTED, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&h->submit_word, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&h->gateway_sleeping, __ATOMIC_SEQ_CST)) {
+        futex(&h->submit_word, FUTEX_WAKE, 1, NULL);
+    }
+
+    for (;;) {
+        uint32_t state = __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE);
+        if (state == PAYMENT_SLOT_DONE) break;
+        timespec timeout = { 0, 100000000L };
+        if (futex(&slot->state, FUTEX_WAIT, state, &timeout) == 0 || errno != ETIMEDOUT) continue;
+        // Quiet for a while: is anyone still serving?
+        pid_t pid = __atomic_load_n(&h->gateway_pid, __ATOMIC_ACQUIRE);
+        bool gone = pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+        if (!gone && !__atomic_load_n(&h->closed, __ATOMIC_ACQUIRE)) continue;
+        uint32_t expected = PAYMENT_SLOT_SUBMITTED;
+        if (__atomic_compare_exchange_n(&slot->state, &expected, PAYMENT_SLOT_FREE, false, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE)) {
+            return PAYMENT_UNAVAILABLE; // Never taken
+        }
+        if (gone && expected != PAYMENT_SLOT_DONE) {
+            // Died mid-commit: the outcome is known once it has recovered
+            __atomic_store_n(&slot->state, PAYMENT_SLOT_FREE, __ATOMIC_RELEASE);
+            return PAYMENT_UNAVAILABLE;
+        }
+    }
+    PaymentResult result = (PaymentResult)slot->result;
+    if (fine) *fine = slot->fine;
+    __atomic_store_n(&slot->state, PAYMENT_SLOT_FREE, __ATOMIC_RELEASE);
+    return result;
+}
+
+// --gateway: serves settlement requests against the last run's store until
+// SIGINT or SIGTERM. Only while no simulation is writing that store.
+int run_payment_gateway(const char* store_path) {
+    PaymentGateway gateway;
+    if (!payment_gateway_create(&gateway, PAYMENT_GATEWAY_NAME)) {
+        printf("[Gateway] shm_open failed\n");
+        return 1;
+    }
+    signal(SIGINT, payment_gateway_on_signal);
+    signal(SIGTERM, payment_gateway_on_signal);
+    printf("[Gateway] Serving %s on %s (Ctrl+C to stop)\n", store_path, PAYMENT_GATEWAY_NAME);
+    fflush(stdout);
+    int code = payment_gateway_main(&gateway, store_path, true);
+    payment_gateway_close(&gateway);
+    return code;
+}
+
+// --pay ID / --appeal ID: one request to a running gateway, as the operator
+int run_payment_request(const char* avn_id, bool appeal) {
+    PaymentGateway gateway;
+    if (!payment_gateway_attach(&gateway, PAYMENT_GATEWAY_NAME)) {
+        printf("[Payment] No gateway running at %s (start one with --gateway)\n", PAYMENT_GATEWAY_NAME);
+        return 1;
+    }
+    uint32_t id = (uint32_t)strtoul(avn_id, NULL, 10);
+    AvnStatus status = appeal ? AVN_APPEALED : AVN_PAID;
+    int fine = 0;
+    PaymentResult result = payment_request(&gateway, "**", id, status, &fine);
+    if (result == PAYMENT_OK) {
+        printf("[Payment] AVN-%u %s: %s ($%d)\n", id, AVN_STATUS_NAMES[status], PAYMENT_RESULT_NAMES[result], fine);
+    } else {
+        printf("[Payment] AVN-%u %s: %s\n", id, AVN_STATUS_NAMES[status], PAYMENT_RESULT_NAMES[result]);
+    }
+    payment_gateway_close(&gateway);
+    return result == PAYMENT_OK ? 0 : 1;
+}
+
+// Billing portal's payment step: a gateway process and up to
+// PAYMENT_MAX_PORTALS airline portal processes, which pay everything their
+// airlines owe at the same time
+int payment_settle_all(const char* store_path) {
+    AvnStore store;
+    if (!avn_store_open(&store, store_path, AVN_STORE_READ)) return 1;
+    uint64_t due_count = store.header->open_count;
+    int64_t due = store.header->open_fines;
+    vector<int> airlines; // Table slots with something due
+    for (int i = 0; i < AVN_AIRLINE_SLOTS; ++i) {
+        if (store.header->airlines[i].used && store.header->airlines[i].unpaid_count) {
+            airlines.push_back(i);
+        }
+    }
+    PaymentGateway gateway;
+    if (airlines.empty() || !payment_gateway_create(&gateway, PAYMENT_GATEWAY_NAME)) {
+        avn_store_close(&store);
+        return airlines.empty() ? 0 : 1;
+    }
+
+    fflush(stdout);
+    pid_t gateway_pid = fork();
+    if (gateway_pid == 0) {
+        _exit(payment_gateway_main(&gateway, store_path, true)); // CHILD PROCESS: Payment Gateway
+    }
+    // Airlines are dealt round-robin; each portal walks its airlines' chains
+    int portals = min(PAYMENT_MAX_PORTALS, (int)airlines.size());
+    vector<pid_t> portal_pids;
+    for (int p = 0; p < portals; ++p) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            // CHILD PROCESS: Airline Portal
+            int failures = 0;
+            for (size_t a = p; a < airlines.size(); a += portals) {
+                const AvnAirlineSlot& airline = store.header->airlines[airlines[a]];
+                for (uint32_t id = airline.head; id; id = store.records[id - 1].prev_airline) {
+                    if (store.records[id - 1].status != AVN_PAID &&
+                        payment_request(&gateway, airline.code, id, AVN_PAID, NULL) != PAYMENT_OK) {
+                        failures++;
+                    }
+                }
+            }
+            _exit(failures ? 1 : 0);
+        }
+        portal_pids.push_back(pid);
+    }
+    int failed = 0;
+    for (size_t p = 0; p < portal_pids.size(); ++p) {
+        int status = 0;
+        waitpid(portal_pids[p], &status, 0);
+        failed += !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    payment_gateway_stop(&gateway);
+    int status = 0;
+    waitpid(gateway_pid, &status, 0);
+    payment_gateway_close(&gateway);
+
+    // Our read-only mapping sees the gateway's changes
+    uint64_t settled = due_count - store.header->open_count;
+    printf("✅ Payment successful: %llu AVNs settled by %d airline portals, $%lld collected.\n",
+           (unsigned long long)settled, portals, (long long)(due - store.header->open_fines));
+    if (store.header->open_count) {
+        printf("⚠️  %llu AVNs ($%lld) still due\n", (unsigned long long)store.header->open_count,
+               (long long)store.header->open_fines);
+    }
+    avn_store_close(&store);
+    return failed || !(WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 1 : 0;
+}
+
+// SETTLEMENT LOAD TEST: a synthetic finished run where each portal's
+// airline owes per_portal AVNs. Every portal pays all of its own and
+// appeals every fourth one first.
+const char* PAYMENT_BENCH_STORE = "avn_payments_bench.bin";
+const char* PAYMENT_BENCH_NAME = "/atc_payments_bench";
+
+bool payment_bench_store(int portals, int per_portal) {
+    AvnStore store;
+    if (!avn_store_open(&store, PAYMENT_BENCH_STORE, AVN_STORE_CREATE)) return false;
+    AvnStoreRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = CARGO;
+    record.phase = CRUISE;
+    record.fine = FINE_CARGO;
+    bool ok = true;
+    for (int k = 0; k < per_portal && ok; ++k) {
+        for (int p = 0; p < portals && ok; ++p) {
+            snprintf(record.flight_number, sizeof(record.flight_number), "%c%c%d", 'A' + p / 26, 'A' + p % 26,
+                     100 + k % 900);
+            ok = avn_store_append(&store, record) != 0;
+        }
+    }
+    avn_store_close(&store);
+    return ok;
+}
+
+// Requests the load test sends per AVN: the payment, plus every fourth
+// AVN's appeal
+long long payment_bench_requests(int per_portal) {
+    return per_portal + (per_portal + 3) / 4;
+}
+
+bool payment_load_test(int portals, int per_portal, PaymentLoadResult* out) {
+    memset(out, 0, sizeof(*out));
+    out->portals = portals;
+    out->latency = new MetricSummary(); // Zeroed
+    string wal = payment_wal_path(PAYMENT_BENCH_STORE);
+    unlink(wal.c_str());
+    PaymentGateway gateway;
+    if (!payment_bench_store(portals, per_portal) || !payment_gateway_create(&gateway, PAYMENT_BENCH_NAME)) {
+        return false;
+    }
+    // Per-portal results, written by the portal processes
+    size_t shared_bytes = portals * (sizeof(MetricSummary) + sizeof(long long));
+    void* shared = mmap(NULL, shared_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        payment_gateway_close(&gateway);
+        return false;
+    }
+    MetricSummary* latencies = (MetricSummary*)shared;
+    long long* failures = (long long*)(latencies + portals);
+
+    fflush(stdout);
+    pid_t gateway_pid = fork();
+    if (gateway_pid == 0) {
+        _exit(payment_gateway_main(&gateway, PAYMENT_BENCH_STORE, false));
+    }
+    long long start = monotonic_ns();
+    vector<pid_t> portal_pids;
+    for (int p = 0; p < portals; ++p) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            char airline[3] = { (char)('A' + p / 26), (char)('A' + p % 26), 0 };
+            // Ids were dealt round-robin: the portal's k-th AVN is k * portals + p + 1
+            for (int k = 0; k < per_portal; ++k) {
+                uint32_t id = (uint32_t)(k * portals + p + 1);
+                for (int step = (k % 4 == 0) ? 0 : 1; step < 2; ++step) {
+                    long long t0 = monotonic_ns();
+                    PaymentResult result = payment_request(&gateway, airline, id, step ? AVN_PAID : AVN_APPEALED, NULL);
+                    hist_add(&latencies[p], monotonic_ns() - t0);
+                    failures[p] += result != PAYMENT_OK;
+                }
+            }
+            _exit(0);
+        }
+        portal_pids.push_back(pid);
+    }
+    for (size_t p = 0; p < portal_pids.size(); ++p) {
+        waitpid(portal_pids[p], NULL, 0);
+    }
+    out->seconds = (monotonic_ns() - start) / 1e9;
+    payment_gateway_stop(&gateway);
+    waitpid(gateway_pid, NULL, 0);
+
+    PaymentGatewayHeader* h = gateway.header;
+    out->commits = h->commits;
+    out->max_batch = h->max_batch;
+    out->commit_ns = h->commit_ns;
+    for (int p = 0; p < portals; ++p) {
+        const MetricSummary& s = latencies[p];
+        for (int b = 0; b < HIST_BUCKETS; ++b) {
+            out->latency->counts[b] += s.counts[b];
+        }
+        out->latency->total += s.total;
+        out->latency->sum += s.sum;
+        out->latency->max = max(out->latency->max, s.max);
+        out->failures += failures[p];
+        out->requests += s.total;
+    }
+    munmap(shared, shared_bytes);
+    payment_gateway_close(&gateway);
+
+    // Crash recovery: a pristine copy of the store, the log with a torn
+    // record on its end, and the replay has to reach the same final state
+    PaymentLedger ledger;
+    off_t torn = 0;
+    const char garbage[16] = { 'P', 'W', 'A', 'L' };
+    int fd = open(wal.c_str(), O_WRONLY | O_APPEND);
+    bool appended = fd >= 0 && write(fd, garbage, sizeof(garbage)) == (ssize_t)sizeof(garbage);
+    if (fd >= 0) close(fd);
+    long long replayed = payment_bench_store(portals, per_portal) && appended
+                       ? payment_ledger_open(&ledger, PAYMENT_BENCH_STORE, &torn) : -1;
+    if (replayed >= 0) {
+        bool all_paid = ledger.store.header->open_count == 0;
+        for (uint64_t i = 0; i < avn_store_count(&ledger.store) && all_paid; ++i) {
+            all_paid = ledger.store.records[i].status == AVN_PAID;
+        }
+        out->recovered = all_paid && replayed == out->requests - out->failures && torn == (off_t)sizeof(garbage);
+        payment_ledger_close(&ledger);
+    }
+    unlink(PAYMENT_BENCH_STORE);
+    unlink(wal.c_str());
+    return true;
+}
+
+// --bench-payments P: settlement load test with P concurrent portals
+int run_payment_benchmark(int portals) {
+    const int TOTAL_AVNS = 20000;
+    PaymentLoadResult r;
+    bool ran = payment_load_test(portals, max(1, TOTAL_AVNS / portals), &r);
+    if (!ran) {
+        printf("[Payment Bench] Could not set up the store or the gateway\n");
+        delete r.latency;
+        return 1;
+    }
+    printf("[Payment Bench] %d portals, %lld requests in %.3f s: %.0f settlements/s\n", portals, r.requests,
+           r.seconds, r.requests / r.seconds);
+    printf("[Payment Bench] commit latency p50 %.0f us, p99 %.0f us, max %.0f us; %llu group commits "
+           "(%.1f per fsync, max %llu), fsync mean %.0f us\n",
+           metric_quantile(*r.latency, 0.50) / 1e3, metric_quantile(*r.latency, 0.99) / 1e3, r.latency->max / 1e3,
+           (unsigned long long)r.commits, r.commits ? (double)(r.requests - r.failures) / r.commits : 0.0,
+           (unsigned long long)r.max_batch, r.commits ? r.commit_ns / 1e3 / r.commits : 0.0);
+    printf("[Payment Bench] %lld failed requests, crash recovery %s\n", r.failures,
+           r.recovered ? "verified" : "FAILED");
+    delete r.latency;
+    return r.failures == 0 && r.recovered ? 0 : 1;
+}
+
+// ========================== AVN LOG PIPELINE ================================
+
+/*
+issue_avn() never touches the file system. It copies a fixed-size AvnRecord
+into a bounded lock-free MPSC ring: each cell carries a sequence number and
+producers claim cells with a CAS on the tail (Vyukov's bounded queue). One
+writer thread drains the ring, appends each record to the binary AVN store,
+publishes it to the live portal channel, and formats a text line into a
+batch buffer. It writes the batch once it
+reaches AVN_FLUSH_BYTES or AVN_FLUSH_MS has passed. Once the text log grows
+past AVN_ROTATE_BYTES it rotates avn_log.txt to .1 .. .N.
+
+A fine is never dropped, so a producer that finds the ring full has to
+wait. It sleeps on a futex the writer bumps after every batch instead
+of spinning, which would take the CPU from the writer it is waiting for.
+The writer only makes the wake syscall when someone is asleep. The idle
+writer sleeps the same way on a word producers bump after each record,
+until one does, avn_log_stop() is called or buffered text is due.
+*/
+
+// Producer side, safe from any thread; only waits if the ring is full
+void avn_log_push(const AvnRecord& record) {
+    size_t pos = sim->avn_log.tail.load(memory_order_relaxed);
+    for (;;) {
+        AvnRingCell* cell = &sim->avn_log.cells[pos & (AVN_RING_SIZE - 1)];
+        size_t seq = cell->seq.load(memory_order_acquire);
+        long diff = (long)(seq - pos);
+        if (diff == 0) {
+            if (sim->avn_log.tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                cell->record = record;
+                cell->seq.store(pos + 1, memory_order_release);
+                __atomic_add_fetch(&sim->avn_log.pushed_word, 1, __ATOMIC_SEQ_CST);
+                if (__atomic_load_n(&sim->avn_log.writer_asleep, __ATOMIC_SEQ_CST)) {
+                    futex(&sim->avn_log.pushed_word, FUTEX_WAKE, 1, NULL);
+                }
+                return;
+            }
+        } else if (diff < 0) {
+            // Writer is behind by a whole ring. Announce the sleep before
+            // the last look at the cell, so a batch drained in between
+            // either shows up there or moves the word and voids the wait.
+            sim->avn_log.full_waits++;
+            __atomic_add_fetch(&sim->avn_log.full_sleepers, 1, __ATOMIC_SEQ_CST);
+            uint32_t word = __atomic_load_n(&sim->avn_log.drained_word, __ATOMIC_SEQ_CST);
+            if ((long)(cell->seq.load(memory_order_seq_cst) - pos) < 0) {
+                timespec timeout = { 0, 10 * 1000000L };
+                futex(&sim->avn_log.drained_word, FUTEX_WAIT, word, &timeout);
+            }
+            __atomic_sub_fetch(&sim->avn_log.full_sleepers, 1, __ATOMIC_SEQ_CST);
+            pos = sim->avn_log.tail.load(memory_order_relaxed);
+        } else {
+            pos = sim->avn_log.tail.load(memory_order_relaxed);
+        }
+    }
+}
+
+// Consumer side, writer thread only: a record is ready at the head
+bool avn_log_ready() {
+    const AvnRingCell* cell = &sim->avn_log.cells[sim->avn_log.head & (AVN_RING_SIZE - 1)];
+    return (long)(cell->seq.load(memory_order_seq_cst) - (sim->avn_log.head + 1)) >= 0;
+}
+
+// Consumer side, writer thread only
+bool avn_log_pop(AvnRecord* record) {
+    AvnRingCell* cell = &sim->avn_log.cells[sim->avn_log.head & (AVN_RING_SIZE - 1)];
+    size_t seq = cell->seq.load(memory_order_acquire);
+    if ((long)(seq - (sim->avn_log.head + 1)) < 0) {
+        return false; // Empty
+    }
+    *record = cell->record;
+    cell->seq.store(sim->avn_log.head + AVN_RING_SIZE, memory_order_release);
+    sim->avn_log.head++;
+    return true;
+}
+
+void avn_log_rotate() {
+    const char* path = sim->avn_log_path.c_str();
+    fclose(sim->avn_log.file);
+    char from[PATH_MAX], to[PATH_MAX];
+    for (int k = AVN_ROTATE_KEEP - 1; k >= 1; --k) {
+        snprintf(from, sizeof(from), "%s.%d", path, k);
+        snprintf(to, sizeof(to), "%s.%d", path, k + 1);
+        rename(from, to);
+    }
+    snprintf(to, sizeof(to), "%s.1", path);
+    rename(path, to);
+    sim->avn_log.file = fopen(path, "w");
+    sim->avn_log.file_bytes = 0;
+}
+
+void avn_log_flush(const char* buf, size_t used) {
+    if (sim->avn_log.file) {
+        fwrite(buf, 1, used, sim->avn_log.file);
+        fflush(sim->avn_log.file);
+        sim->avn_log.file_bytes += used;
+        if (sim->avn_log.file_bytes >= AVN_ROTATE_BYTES) {
+            avn_log_rotate();
+        }
+    }
+}
+
+void* avn_log_writer(void*) {
+    vector<char> buf(AVN_FLUSH_BYTES + 256);
+    size_t used = 0;
+    long long last_flush = monotonic_ns();
+
+    for (;;) {
+        bool stopping = sim->avn_log.stopping.load(memory_order_acquire);
+        int drained = 0;
+        AvnRecord record;
+
+        while (used + 256 <= buf.size() && avn_log_pop(&record)) {
+            // localtime_r/gmtime_r, unlike ctime, are safe off the main
+            // thread; virtual runs use UTC so output is the same anywhere
+            char when[32];
+            tm local;
+            if (sim->sim_clock.mode == CLOCK_MODE_VIRTUAL) gmtime_r(&record.issued_at, &local);
+            else localtime_r(&record.issued_at, &local);
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &local);
+            uint32_t avn_id = 0;
+            if (sim->avn_log.store_ok) {
+                AvnStoreRecord stored;
+                memset(&stored, 0, sizeof(stored));
+                memcpy(stored.flight_number, record.flight_number, sizeof(stored.flight_number));
+                stored.type = record.type;
+                stored.phase = record.phase;
+                stored.speed = record.speed;
+                stored.fine = record.fine;
+                stored.issued_at = record.issued_at;
+                avn_id = avn_store_append(&sim->avn_log.store, stored);
+            }
+            if (sim->avn_log.channel_ok) {
+                AvnEvent event;
+                event.avn_id = avn_id;
+                memcpy(event.flight_number, record.flight_number, sizeof(event.flight_number));
+                event.type = record.type;
+                event.phase = record.phase;
+                event.speed = record.speed;
+                event.fine = record.fine;
+                event.issued_at = record.issued_at;
+                avn_channel_publish(&sim->avn_log.channel, event, false);
+            }
+
+            int n = snprintf(&buf[used], buf.size() - used, "%s - AVN-%u - %s - %s - %s - Fine: $%d\n",
+                             when, avn_id, record.flight_number, AIRCRAFT_TYPE_NAMES[record.type],
+                             record.reason, record.fine);
+            used += min((size_t)max(n, 0), buf.size() - used - 1);
+            drained++;
+        }
+
+        long long now = monotonic_ns();
+        if (used >= AVN_FLUSH_BYTES ||
+            (used > 0 && (stopping || now - last_flush >= AVN_FLUSH_MS * 1000000LL))) {
+            avn_log_flush(buf.data(), used);
+            used = 0;
+            last_flush = now;
+        }
+
+        if (drained > 0) {
+            __atomic_add_fetch(&sim->avn_log.drained_word, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&sim->avn_log.full_sleepers, __ATOMIC_SEQ_CST) > 0) {
+                futex(&sim->avn_log.drained_word, FUTEX_WAKE, INT_MAX, NULL);
+            }
+        } else {
+            if (stopping) {
+                break; // Producers are done and the ring is empty
+            }
+            // Idle until the next record, stop, or the buffered text's
+            // flush deadline. The sleep is announced before the last look
+            // at the ring, so a record pushed in between either shows up
+            // there or moves the word and voids the wait.
+            long long wait_ns = used > 0 ? last_flush + AVN_FLUSH_MS * 1000000LL - now
+                                         : AVN_FLUSH_MS * 1000000LL;
+            timespec timeout = { (time_t)(wait_ns / 1000000000), (long)(wait_ns % 1000000000) };
+            __atomic_store_n(&sim->avn_log.writer_asleep, 1, __ATOMIC_SEQ_CST);
+            uint32_t word = __atomic_load_n(&sim->avn_log.pushed_word, __ATOMIC_SEQ_CST);
+            if (!avn_log_ready() && !sim->avn_log.stopping.load(memory_order_seq_cst)) {
+                futex(&sim->avn_log.pushed_word, FUTEX_WAIT, word, &timeout);
+            }
+            __atomic_store_n(&sim->avn_log.writer_asleep, 0, __ATOMIC_SEQ_CST);
+        }
+    }
+    return nullptr;
+}
+
+// Truncates the log and starts the writer thread
+void avn_log_start() {
+    sim->avn_log.cells = vector<AvnRingCell>(AVN_RING_SIZE);
+    for (size_t i = 0; i < (size_t)AVN_RING_SIZE; ++i) {
+        sim->avn_log.cells[i].seq.store(i, memory_order_relaxed);
+    }
+    sim->avn_log.tail = 0;
+    sim->avn_log.head = 0;
+    sim->avn_log.stopping = false;
+    sim->avn_log.full_waits = 0;
+    sim->avn_log.drained_word = 0;
+    sim->avn_log.full_sleepers = 0;
+    sim->avn_log.pushed_word = 0;
+    sim->avn_log.writer_asleep = 0;
+    // Either sink may be off (empty path)
+    sim->avn_log.file = sim->avn_log_path.empty() ? NULL : fopen(sim->avn_log_path.c_str(), "w"); // Clears previous run
+    sim->avn_log.file_bytes = 0;
+    sim->avn_log.store_ok = !sim->avn_store_path.empty() &&
+                            avn_store_open(&sim->avn_log.store, sim->avn_store_path.c_str(), AVN_STORE_CREATE);
+    if (sim->avn_log.store_ok) {
+        unlink(payment_wal_path(sim->avn_store_path.c_str()).c_str()); // Settlements of the previous run's AVNs
+    }
+    // The channel itself is created with the instance, before portals are forked
+    sim_thread_create(&sim->avn_log.writer, avn_log_writer, NULL);
+}
+
+// Drains everything already pushed, then closes the file
+void avn_log_stop() {
+    sim->avn_log.stopping.store(true, memory_order_seq_cst);
+    __atomic_add_fetch(&sim->avn_log.pushed_word, 1, __ATOMIC_SEQ_CST);
+    futex(&sim->avn_log.pushed_word, FUTEX_WAKE, 1, NULL);
+    pthread_join(sim->avn_log.writer, NULL);
+    if (sim->avn_log.file) {
+        fclose(sim->avn_log.file);
+        sim->avn_log.file = NULL;
+    }
+    if (sim->avn_log.store_ok) {
+        avn_store_close(&sim->avn_log.store);
+        sim->avn_log.store_ok = false;
+    }
+    if (sim->avn_log.channel_ok) {
+        avn_channel_close(&sim->avn_log.channel); // Portals drain and exit
+        sim->avn_log.channel_ok = false;
+    }
+}
+
+void issue_avn(int index, Phase phase, int speed, const char* reason) {
+    Aircraft* aircraft = &fleet_aircraft(index);
+    // Only the first violation per aircraft is fined
+    if (!fleet_chunk(index)->avn_issued[fleet_slot(index)].exchange(1)) {
+        long long start = monotonic_ns();
+        int fine = (aircraft->type == COMMERCIAL) ? FINE_COMMERCIAL :
+                   (aircraft->type == CARGO) ? FINE_CARGO : FINE_EMERGENCY;
+
+        log_avn(index, aircraft->flight_number, reason, fine);
+
+        // Hand off to the log writer; no file I/O on the radar path
+        AvnRecord record;
+        memcpy(record.flight_number, aircraft->flight_number, sizeof(record.flight_number));
+        record.type = aircraft->type;
+        record.phase = phase;
+        record.speed = speed;
+        record.fine = fine;
+        record.issued_at = sim_wall_time();
+        strncpy(record.reason, reason, sizeof(record.reason) - 1);
+        record.reason[sizeof(record.reason) - 1] = '\0';
+        avn_log_push(record);
+        metric_record(METRIC_AVN_ISSUE, monotonic_ns() - start);
+    }
+}
+
+// ========================== FLIGHT STATE STORE ==============================
+
+void fleet_init() {
+    sim->fleet.size = 0;
+    sim->fleet.admitted = 0;
+    sim->fleet.free_slots.clear();
+    pthread_mutex_init(&sim->fleet.free_lock, NULL);
+}
+
+// Number of slots readers may look at; everything below it is initialized
+int fleet_size() {
+    return sim->fleet.size.load(memory_order_acquire);
+}
+
+// Chunks come straight from mmap, already zero: a page costs memory only
+// once a slot on it is first written, so a small fleet doesn't pay for
+// the whole half-megabyte chunk, and the heap never sees the fleet
+FleetChunk* fleet_chunk_alloc() {
+    void* mem = mmap(NULL, sizeof(FleetChunk), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return mem == MAP_FAILED ? NULL : new (mem) FleetChunk; // No initializer: nothing is touched
+}
+
+void fleet_chunk_free(FleetChunk* chunk) {
+    if (chunk) {
+        munmap(chunk, sizeof(FleetChunk));
+    }
+}
+
+// Called by a flight's last event; its slot goes back to fleet_add
+void fleet_retire(int i) {
+    log_flight(LOG_FLIGHT_RETIRED, i, fleet_aircraft(i));
+    pthread_mutex_lock(&sim->fleet.free_lock);
+    sim->fleet.free_slots.push_back(i);
+    pthread_mutex_unlock(&sim->fleet.free_lock);
+}
+
+void fleet_write_begin(int i);
+void fleet_write_end(int i);
+
+// Spread flights around the compass, stable for a given flight number
+float flight_bearing(const char* flight_number) {
+    uint32_t h = avn_hash(flight_number, strlen(flight_number));
+    return (h % 3600) * (float)M_PI / 1800.f;
+}
+
+// Single producer (the ingestion event). Returns the aircraft index, or -1
+// when every chunk is full.
+int fleet_add(const char* flight_number, AircraftType type, FlightType direction, int airport) {
+    int i = -1;
+    pthread_mutex_lock(&sim->fleet.free_lock);
+    if (!sim->fleet.free_slots.empty()) {
+        i = sim->fleet.free_slots.back();
+        sim->fleet.free_slots.pop_back();
+    }
+    pthread_mutex_unlock(&sim->fleet.free_lock);
+
+    bool fresh = i < 0;
+    if (fresh) {
+        i = sim->fleet.size.load(memory_order_relaxed);
+        if ((i >> FLEET_CHUNK_BITS) >= FLEET_MAX_CHUNKS) {
+            return -1;
+        }
+        if (!sim->fleet.chunks[i >> FLEET_CHUNK_BITS]) {
+            sim->fleet.chunks[i >> FLEET_CHUNK_BITS] = fleet_chunk_alloc();
+            if (!sim->fleet.chunks[i >> FLEET_CHUNK_BITS]) {
+                return -1;
+            }
+        }
+    }
+
+    FleetChunk* chunk = fleet_chunk(i);
+    int s = fleet_slot(i);
+    Aircraft& aircraft = chunk->aircraft[s];
+    memcpy(aircraft.flight_number, flight_number, sizeof(aircraft.flight_number));
+    aircraft.flight_number[sizeof(aircraft.flight_number) - 1] = '\0';
+    aircraft.type = type;
+    aircraft.direction = direction;
+    aircraft.phase_index = 0;
+    aircraft.runway = -1;
+    aircraft.airport = airport;
+    // Seeded by admission order, so a flight's speeds don't depend on which
+    // worker runs its events or how many workers there are
+    uint64_t stream = sim->sim_seed ^ ((uint64_t)sim->fleet.admitted * 0xD1B54A32D192ED03ULL);
+    aircraft.rng = splitmix64(&stream);
+    aircraft.bearing = flight_bearing(aircraft.flight_number);
+
+    fleet_write_begin(i);
+    chunk->phase[s] = GATE;              // Parked until its first phase starts
+    chunk->direction[s] = direction;
+    chunk->speed[s] = 0;
+    chunk->start_x[s] = sim->airports[airport].x_km;   // Parked at its airport
+    chunk->start_y[s] = sim->airports[airport].y_km;
+    chunk->start_alt[s] = 0.f;
+    chunk->vel_x[s] = chunk->vel_y[s] = chunk->vel_alt[s] = 0.f;
+    chunk->motion_t0[s] = 0;
+    chunk->active[s] = 1;
+    chunk->avn_issued[s].store(0, memory_order_relaxed);
+    fleet_write_end(i);
+
+    if (fresh) {
+        sim->fleet.size.store(i + 1, memory_order_release); // Publish the new slot
+    }
+    sim->fleet.admitted++;
+    log_flight(LOG_FLIGHT_ADDED, i, aircraft);
+    return i;
+}
+
+// Writer side: only the worker handling aircraft i's event may call these
+void fleet_write_begin(int i) {
+    atomic<unsigned>& seq = fleet_chunk(i)->seq[fleet_slot(i)];
+    seq.store(seq.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+void fleet_write_end(int i) {
+    atomic<unsigned>& seq = fleet_chunk(i)->seq[fleet_slot(i)];
+    seq.store(seq.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+// A phase's straight-line motion from its anchor point: position =
+// start + vel * dt. Shared with replay, which rebuilds it from the trace.
+struct PhaseMotion {
+    float start_x, start_y, start_alt;
+    float vel_x, vel_y, vel_alt;
+};
+
+PhaseMotion phase_motion(float airport_x, float airport_y, float bearing, FlightType direction,
+                         Phase phase, Phase next, int speed) {
+    PhaseMotion m;
+    float ux = cosf(bearing), uy = sinf(bearing);
+    float outward = (direction == ARRIVAL) ? -1.f : 1.f;
+    float km_per_s = speed / 3600.f;
+    m.start_x = airport_x + ux * PHASE_RADIUS_KM[phase];
+    m.start_y = airport_y + uy * PHASE_RADIUS_KM[phase];
+    m.start_alt = PHASE_ALTITUDE_M[phase];
+    m.vel_x = outward * ux * km_per_s;
+    m.vel_y = outward * uy * km_per_s;
+    m.vel_alt = (PHASE_ALTITUDE_M[next] - PHASE_ALTITUDE_M[phase]) / PHASE_DURATION_S;
+    return m;
+}
+
+// Seconds of motion at now_us. Movement stops after PHASE_DURATION_S, so a
+// flight held for a runway waits where it is.
+float motion_seconds(long long t0_us, long long now_us) {
+    long long elapsed = min(max(now_us - t0_us, 0LL), PHASE_DURATION_S * 1000000LL);
+    return elapsed / 1e6f;
+}
+
+// Writer side, inside fleet_write_begin/end: start a phase's motion
+void fleet_set_motion(int i, const Aircraft& aircraft, Phase phase, Phase next, int speed, long long now_us) {
+    FleetChunk* chunk = fleet_chunk(i);
+    int s = fleet_slot(i);
+    const Airport& airport = sim->airports[aircraft.airport];
+    PhaseMotion m = phase_motion(airport.x_km, airport.y_km, aircraft.bearing, aircraft.direction,
+                                 phase, next, speed);
+    chunk->start_x[s] = m.start_x;
+    chunk->start_y[s] = m.start_y;
+    chunk->start_alt[s] = m.start_alt;
+    chunk->vel_x[s] = m.vel_x;
+    chunk->vel_y[s] = m.vel_y;
+    chunk->vel_alt[s] = m.vel_alt;
+    chunk->motion_t0[s] = now_us;
+}
+
+// Position of slot s at now_us. Reads the raw arrays: callers either hold
+// the seqlock read loop or only need a candidate answer.
+void fleet_position(const FleetChunk* chunk, int s, long long now_us, float* x, float* y, float* alt) {
+    float dt = motion_seconds(chunk->motion_t0[s], now_us);
+    *x = chunk->start_x[s] + chunk->vel_x[s] * dt;
+    *y = chunk->start_y[s] + chunk->vel_y[s] * dt;
+    *alt = max(0.f, chunk->start_alt[s] + chunk->vel_alt[s] * dt);
+}
+
+// Reader side: lock-free consistent copy of aircraft i
+FlightView fleet_read(int i) {
+    FleetChunk* chunk = fleet_chunk(i);
+    int s = fleet_slot(i);
+    long long now = sim_now_us();
+    FlightView view;
+    unsigned before, after;
+    do {
+        before = chunk->seq[s].load(memory_order_acquire);
+        view.phase = (Phase)chunk->phase[s];
+        view.speed = chunk->speed[s];
+        fleet_position(chunk, s, now, &view.x, &view.y, &view.alt);
+        view.active = chunk->active[s];
+        atomic_thread_fence(memory_order_acquire);
+        after = chunk->seq[s].load(memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return view;
+}
+
+// ========================== TRACE RECORDER ==================================
+
+/*
+--record FILE writes every phase transition (with its speed sample), runway
+grant and release, AVN, and fleet admission and retirement to a compact
+binary trace. The records come from the event logger: the sink already
+drains every thread's ring and sorts the batch into global order, so the
+trace is written off the simulation threads and without a lock of its own.
+
+Layout: a header (magic, version, snapshot interval, the runway model),
+then records. Each record is a tag byte (a LogEventType), the time since
+the previous record as a zigzag varint, and varint fields; a flight number
+travels once, when the flight is admitted, and later records name the fleet
+slot. Every --trace-snapshot seconds a SNAPSHOT record carries the whole
+world at an absolute time, so a reader can start there instead of at the
+beginning. The file ends with an END record, the snapshot index and a
+fixed trailer; a trace cut short by a crash has no trailer and is indexed
+by scanning instead.
+*/
+
+void trace_put_varint(vector<unsigned char>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back((unsigned char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((unsigned char)v);
+}
+
+void trace_put_signed(vector<unsigned char>& out, long long v) {
+    trace_put_varint(out, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63)); // Zigzag
+}
+
+void trace_put_string(vector<unsigned char>& out, const char* s, size_t max_len) {
+    size_t n = strnlen(s, max_len);
+    trace_put_varint(out, n);
+    out.insert(out.end(), s, s + n);
+}
+
+void trace_put_float(vector<unsigned char>& out, float f) {
+    unsigned char bytes[sizeof(f)];
+    memcpy(bytes, &f, sizeof(f));
+    out.insert(out.end(), bytes, bytes + sizeof(f));
+}
+
+void trace_put_u64(vector<unsigned char>& out, uint64_t v) {
+    unsigned char bytes[sizeof(v)];
+    memcpy(bytes, &v, sizeof(v));
+    out.insert(out.end(), bytes, bytes + sizeof(v));
+}
+
+// Bounds-checked reader; ok turns false on the first short or bad field
+struct TraceCursor {
+    const unsigned char* p;
+    const unsigned char* end;
+    bool ok;
+};
+
+uint64_t trace_get_varint(TraceCursor& c) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (c.p >= c.end) {
+            c.ok = false;
+            return 0;
+        }
+        unsigned char b = *c.p++;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return v;
+        }
+    }
+    c.ok = false;
+    return 0;
+}
+
+long long trace_get_signed(TraceCursor& c) {
+    uint64_t v = trace_get_varint(c);
+    return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+void trace_get_string(TraceCursor& c, char* out, size_t size) {
+    uint64_t n = trace_get_varint(c);
+    if (!c.ok || n >= size || n > (uint64_t)(c.end - c.p)) {
+        c.ok = false;
+        out[0] = '\0';
+        return;
+    }
+    memcpy(out, c.p, n);
+    out[n] = '\0';
+    c.p += n;
+}
+
+void trace_get_bytes(TraceCursor& c, void* out, size_t n) {
+    if ((size_t)(c.end - c.p) < n) {
+        c.ok = false;
+        memset(out, 0, n);
+        return;
+    }
+    memcpy(out, c.p, n);
+    c.p += n;
+}
+
+// Phase that follows phase in the flight's sequence (the last one repeats)
+Phase next_phase(FlightType direction, Phase phase) {
+    const Phase* phases = (direction == ARRIVAL) ? ARRIVAL_PHASES : DEPARTURE_PHASES;
+    for (int i = 0; i + 1 < NUM_PHASES; ++i) {
+        if (phases[i] == phase) {
+            return phases[i + 1];
+        }
+    }
+    return phase;
+}
+
+// Event types the trace keeps
+bool trace_keeps(int type) {
+    return type == LOG_PHASE || type == LOG_RUNWAY_ASSIGNED || type == LOG_RUNWAY_RELEASED ||
+           type == LOG_AVN || type == LOG_FLIGHT_ADDED || type == LOG_FLIGHT_RETIRED;
+}
+
+// Applies one event record to w. The recorder and replay both go through
+// here, so a replayed world is exactly what was written.
+void trace_apply(TraceWorld& w, const LogEvent& ev) {
+    w.now_us = ev.sim_us;
+    bool slot_ok = ev.aircraft >= 0 && ev.aircraft < (int)w.flights.size();
+    bool runway_ok = ev.runway >= 0 && ev.runway < (int)w.runway_holder.size();
+    switch (ev.type) {
+    case LOG_FLIGHT_ADDED: {
+        if (ev.aircraft < 0) {
+            return;
+        }
+        if (ev.aircraft >= (int)w.flights.size()) {
+            w.flights.resize(ev.aircraft + 1, TraceFlight());
+        }
+        TraceFlight& f = w.flights[ev.aircraft];
+        memcpy(f.flight_number, ev.flight_number, sizeof(f.flight_number));
+        f.type = ev.aircraft_type;
+        f.direction = ev.direction;
+        f.airport = ev.airport;
+        f.phase = GATE;              // Parked at its airport, like fleet_add
+        f.speed = 0;
+        f.phase_t0 = -1;
+        f.active = 1;
+        f.avn_issued = 0;
+        w.admitted++;
+        w.active++;
+        break;
+    }
+    case LOG_PHASE:
+        if (slot_ok) {
+            w.flights[ev.aircraft].phase = ev.phase;
+            w.flights[ev.aircraft].speed = ev.speed;
+            w.flights[ev.aircraft].phase_t0 = ev.sim_us;
+        }
+        break;
+    case LOG_RUNWAY_ASSIGNED:
+        if (runway_ok) {
+            w.runway_holder[ev.runway] = ev.aircraft;
+        }
+        break;
+    case LOG_RUNWAY_RELEASED:
+        // A release logged after the next holder's grant must not clear it
+        if (runway_ok && (ev.aircraft < 0 || w.runway_holder[ev.runway] == ev.aircraft)) {
+            w.runway_holder[ev.runway] = -1;
+        }
+        break;
+    case LOG_AVN:
+        if (slot_ok) {
+            w.flights[ev.aircraft].avn_issued = 1;
+        }
+        w.avns++;
+        break;
+    case LOG_FLIGHT_RETIRED:
+        if (slot_ok && w.flights[ev.aircraft].active) {
+            w.flights[ev.aircraft].active = 0;
+            w.active--;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void trace_put_event(vector<unsigned char>& out, const LogEvent& ev, long long* last_us) {
+    out.push_back(ev.type);
+    trace_put_signed(out, ev.sim_us - *last_us);
+    *last_us = ev.sim_us;
+    switch (ev.type) {
+    case LOG_FLIGHT_ADDED:
+        trace_put_varint(out, ev.aircraft);
+        trace_put_string(out, ev.flight_number, sizeof(ev.flight_number) - 1);
+        out.push_back(ev.aircraft_type);
+        out.push_back(ev.direction);
+        trace_put_varint(out, ev.airport);
+        break;
+    case LOG_PHASE:
+        trace_put_varint(out, ev.aircraft);
+        out.push_back(ev.phase);
+        trace_put_signed(out, ev.speed);
+        break;
+    case LOG_RUNWAY_ASSIGNED:
+    case LOG_RUNWAY_RELEASED:
+        trace_put_varint(out, ev.aircraft + 1); // -1: released by someone outside the fleet
+        trace_put_varint(out, ev.runway);
+        break;
+    case LOG_AVN:
+        trace_put_varint(out, ev.aircraft);
+        trace_put_varint(out, ev.fine);
+        trace_put_string(out, ev.text, sizeof(ev.text) - 1);
+        break;
+    case LOG_FLIGHT_RETIRED:
+        trace_put_varint(out, ev.aircraft);
+        break;
+    }
+}
+
+// Reads the body of an event record whose tag and time are already known
+void trace_get_event(TraceCursor& c, int tag, long long sim_us, LogEvent* ev) {
+    *ev = LogEvent();
+    ev->type = tag;
+    ev->sim_us = sim_us;
+    ev->runway = -1;
+    switch (tag) {
+    case LOG_FLIGHT_ADDED:
+        ev->aircraft = (int)trace_get_varint(c);
+        trace_get_string(c, ev->flight_number, sizeof(ev->flight_number));
+        trace_get_bytes(c, &ev->aircraft_type, 1);
+        trace_get_bytes(c, &ev->direction, 1);
+        ev->airport = (int)trace_get_varint(c);
+        c.ok = c.ok && ev->aircraft_type <= EMERGENCY && ev->direction <= DEPARTURE;
+        break;
+    case LOG_PHASE:
+        ev->aircraft = (int)trace_get_varint(c);
+        trace_get_bytes(c, &ev->phase, 1);
+        ev->speed = (int)trace_get_signed(c);
+        c.ok = c.ok && ev->phase <= CRUISE;
+        break;
+    case LOG_RUNWAY_ASSIGNED:
+    case LOG_RUNWAY_RELEASED:
+        ev->aircraft = (int)trace_get_varint(c) - 1;
+        ev->runway = (int)trace_get_varint(c);
+        break;
+    case LOG_AVN:
+        ev->aircraft = (int)trace_get_varint(c);
+        ev->fine = (int)trace_get_varint(c);
+        trace_get_string(c, ev->text, sizeof(ev->text));
+        break;
+    case LOG_FLIGHT_RETIRED:
+        ev->aircraft = (int)trace_get_varint(c);
+        break;
+    default:
+        c.ok = false;
+        break;
+    }
+}
+
+// The whole world at at_us; the record's time is absolute, so a reader
+// can start decoding here
+void trace_put_snapshot(vector<unsigned char>& out, const TraceWorld& w, long long at_us) {
+    out.push_back(TRACE_SNAPSHOT);
+    trace_put_signed(out, at_us);
+    trace_put_varint(out, w.admitted);
+    trace_put_varint(out, w.avns);
+    trace_put_varint(out, w.active);
+    trace_put_varint(out, w.runway_holder.size());
+    for (size_t r = 0; r < w.runway_holder.size(); ++r) {
+        trace_put_varint(out, w.runway_holder[r] + 1);
+    }
+    trace_put_varint(out, w.flights.size());
+    for (size_t i = 0; i < w.flights.size(); ++i) {
+        const TraceFlight& f = w.flights[i];
+        bool parked = f.phase_t0 < 0;
+        trace_put_string(out, f.flight_number, sizeof(f.flight_number) - 1);
+        out.push_back(f.type);
+        out.push_back(f.direction);
+        out.push_back(f.phase);
+        out.push_back((unsigned char)(f.active | f.avn_issued << 1 | parked << 2));
+        trace_put_varint(out, f.airport);
+        trace_put_signed(out, f.speed);
+        if (!parked) {
+            trace_put_signed(out, at_us - f.phase_t0);
+        }
+    }
+}
+
+void trace_get_snapshot(TraceCursor& c, long long at_us, TraceWorld* w) {
+    w->now_us = at_us;
+    w->admitted = (long long)trace_get_varint(c);
+    w->avns = (long long)trace_get_varint(c);
+    w->active = (int)trace_get_varint(c);
+    uint64_t runways = trace_get_varint(c);
+    if (!c.ok || runways > (uint64_t)(c.end - c.p)) {
+        c.ok = false;
+        return;
+    }
+    w->runway_holder.resize(runways);
+    for (size_t r = 0; r < runways; ++r) {
+        w->runway_holder[r] = (int)trace_get_varint(c) - 1;
+    }
+    uint64_t flights = trace_get_varint(c);
+    if (!c.ok || flights > (uint64_t)(c.end - c.p)) { // Every flight takes bytes
+        c.ok = false;
+        return;
+    }
+    w->flights.resize(flights);
+    for (size_t i = 0; i < flights && c.ok; ++i) {
+        TraceFlight& f = w->flights[i];
+        unsigned char flags = 0;
+        trace_get_string(c, f.flight_number, sizeof(f.flight_number));
+        trace_get_bytes(c, &f.type, 1);
+        trace_get_bytes(c, &f.direction, 1);
+        trace_get_bytes(c, &f.phase, 1);
+        trace_get_bytes(c, &flags, 1);
+        f.active = flags & 1;
+        f.avn_issued = (flags >> 1) & 1;
+        f.airport = (int)trace_get_varint(c);
+        f.speed = (int)trace_get_signed(c);
+        f.phase_t0 = (flags & 4) ? -1 : at_us - trace_get_signed(c);
+        c.ok = c.ok && f.type <= EMERGENCY && f.direction <= DEPARTURE && f.phase <= CRUISE;
+    }
+}
+
+// Starts recording: writes the header and the snapshot at t = 0. Called
+// before the sink starts, so every event of the run is seen.
+bool trace_open(const char* path, long long snapshot_us) {
+    TraceRecorder& tr = sim->trace;
+    tr.file = fopen(path, "wb");
+    if (!tr.file) {
+        perror(path);
+        return false;
+    }
+    tr.snapshot_us = max(1000LL, snapshot_us);
+    tr.next_snapshot_us = tr.snapshot_us;
+    tr.last_us = 0;
+    tr.offset = 0;
+    tr.index.clear();
+    tr.world = TraceWorld();
+    tr.world.runway_holder.assign(sim->runways.size(), -1);
+
+    vector<unsigned char>& out = tr.buf;
+    out.clear();
+    out.insert(out.end(), TRACE_MAGIC, TRACE_MAGIC + sizeof(TRACE_MAGIC));
+    trace_put_varint(out, TRACE_VERSION);
+    trace_put_varint(out, tr.snapshot_us);
+    trace_put_varint(out, sim->airports.size());
+    for (size_t a = 0; a < sim->airports.size(); ++a) {
+        trace_put_string(out, sim->airports[a].code, sizeof(sim->airports[a].code) - 1);
+        trace_put_float(out, sim->airports[a].x_km);
+        trace_put_float(out, sim->airports[a].y_km);
+    }
+    trace_put_varint(out, sim->runways.size());
+    for (size_t r = 0; r < sim->runways.size(); ++r) {
+        trace_put_string(out, sim->runways[r].name, sizeof(sim->runways[r].name) - 1);
+        trace_put_varint(out, sim->runways[r].airport);
+    }
+    tr.index.push_back({0, out.size()});
+    trace_put_snapshot(out, tr.world, 0);
+    fwrite(out.data(), 1, out.size(), tr.file);
+    tr.offset = out.size();
+    sim->event_log.tracing = true;
+    return true;
+}
+
+// Sink side: appends one ordered batch, with a snapshot at each interval
+// boundary the batch crosses
+void trace_record_batch(const vector<LogEvent>& batch) {
+    TraceRecorder& tr = sim->trace;
+    tr.buf.clear();
+    for (size_t e = 0; e < batch.size(); ++e) {
+        const LogEvent& ev = batch[e];
+        if (!trace_keeps(ev.type)) {
+            continue;
+        }
+        if (ev.sim_us > tr.next_snapshot_us) {
+            // Latest boundary before this event; quiet stretches get one
+            long long at = tr.next_snapshot_us + (ev.sim_us - 1 - tr.next_snapshot_us) / tr.snapshot_us * tr.snapshot_us;
+            tr.index.push_back({at, tr.offset + tr.buf.size()});
+            trace_put_snapshot(tr.buf, tr.world, at);
+            tr.last_us = at;
+            tr.next_snapshot_us = at + tr.snapshot_us;
+        }
+        trace_put_event(tr.buf, ev, &tr.last_us);
+        trace_apply(tr.world, ev);
+    }
+    if (!tr.buf.empty()) {
+        fwrite(tr.buf.data(), 1, tr.buf.size(), tr.file);
+        tr.offset += tr.buf.size();
+    }
+}
+
+// After the sink has stopped: END, the snapshot index and the trailer
+void trace_close() {
+    TraceRecorder& tr = sim->trace;
+    if (!tr.file) {
+        return;
+    }
+    sim->event_log.tracing = false;
+    long long end_us = max(tr.world.now_us, sim_now_us());
+    vector<unsigned char>& out = tr.buf;
+    out.clear();
+    out.push_back(TRACE_END);
+    trace_put_signed(out, end_us - tr.last_us);
+    uint64_t index_offset = tr.offset + out.size();
+    trace_put_signed(out, end_us);
+    trace_put_varint(out, tr.index.size());
+    for (size_t k = 0; k < tr.index.size(); ++k) {
+        trace_put_signed(out, tr.index[k].sim_us);
+        trace_put_varint(out, tr.index[k].offset);
+    }
+    trace_put_u64(out, index_offset);
+    out.insert(out.end(), TRACE_END_MAGIC, TRACE_END_MAGIC + sizeof(TRACE_END_MAGIC));
+    fwrite(out.data(), 1, out.size(), tr.file);
+    if (fclose(tr.file) != 0) {
+        perror("trace");
+    }
+    tr.file = NULL;
+    tr.world = TraceWorld();
+    vector<TraceIndexEntry>().swap(tr.index);
+    vector<unsigned char>().swap(tr.buf);
+}
+
+// ========================== TICK ENGINE =====================================
+
+/*
+Whole-fleet passes (the radar sweep, snapshots) are ticks: the same small
+update applied to every aircraft. tick_parallel_for() splits [0, count)
+into TICK_GRAIN blocks and runs them on a work-stealing pool. Each worker
+starts with an even share of blocks in its own deque and takes from the
+front. A worker that runs dry steals half of the remaining blocks from
+the back of someone else's deque, so an uneven pass still finishes
+together.
+
+A deque is a packed (next, end) block range in one 64-bit atomic, so
+both ends are updated with a single CAS and there are no locks on the
+hot path. The calling thread works as worker 0. Passes write disjoint
+per-aircraft or per-block outputs, which keeps results identical for any
+worker count.
+
+There is no per-tick physics step to put on the pool. A position is
+analytic, start + velocity * dt from the motion set when the phase began
+(fleet_position), so it costs nothing until a pass reads it. The phase
+and speed draws happen once per flight per phase, in that flight's
+EV_PHASE_START on its airport's partition. Spreading them over the pool
+would reorder the per-flight random streams and cost a hand-off per
+event for a few nanoseconds of work. Work that grows with fleet size per
+tick is the radar scan and the separation pair search, and both run
+here.
+*/
+
+uint64_t tick_range(uint32_t next, uint32_t end) {
+    return ((uint64_t)next << 32) | end;
+}
+
+// Runs block b of the current pass
+void tick_run_block(int b) {
+    int begin = b * TICK_GRAIN;
+    sim->tick_pool.fn(begin, min(begin + TICK_GRAIN, sim->tick_pool.count));
+}
+
+// Worker w drains its own deque, then steals until every deque is empty
+void tick_work(int w) {
+    TickDeque& own = sim->tick_pool.deques[w];
+    for (;;) {
+        uint64_t r = own.range.load(memory_order_acquire);
+        uint32_t next = r >> 32, end = (uint32_t)r;
+        if (next < end) {
+            if (own.range.compare_exchange_weak(r, tick_range(next + 1, end), memory_order_acq_rel)) {
+                tick_run_block(next);
+            }
+            continue;
+        }
+
+        // Own deque empty: steal the back half of the first non-empty one
+        bool stole = false;
+        for (int k = 1; k < sim->tick_pool.workers && !stole; ++k) {
+            TickDeque& victim = sim->tick_pool.deques[(w + k) % sim->tick_pool.workers];
+            uint64_t v = victim.range.load(memory_order_acquire);
+            while ((uint32_t)(v >> 32) < (uint32_t)v) {
+                uint32_t vnext = v >> 32, vend = (uint32_t)v;
+                uint32_t take = (vend - vnext + 1) / 2;
+                if (victim.range.compare_exchange_weak(v, tick_range(vnext, vend - take), memory_order_acq_rel)) {
+                    // Only we refill our own deque, and only while it is empty
+                    own.range.store(tick_range(vend - take, vend), memory_order_release);
+                    sim->tick_pool.steals.fetch_add(1, memory_order_relaxed);
+                    stole = true;
+                    break;
+                }
+            }
+        }
+        if (!stole) {
+            return;
+        }
+    }
+}
+
+void* tick_helper(void* arg) {
+    int w = (int)(intptr_t)arg;
+    unsigned long long seen = 0;
+    pthread_mutex_lock(&sim->tick_pool.lock);
+    for (;;) {
+        while (!sim->tick_pool.stopping && sim->tick_pool.generation == seen) {
+            pthread_cond_wait(&sim->tick_pool.start, &sim->tick_pool.lock);
+        }
+        if (sim->tick_pool.stopping) {
+            break;
+        }
+        seen = sim->tick_pool.generation;
+        pthread_mutex_unlock(&sim->tick_pool.lock);
+
+        tick_work(w);
+
+        pthread_mutex_lock(&sim->tick_pool.lock);
+        if (--sim->tick_pool.busy_helpers == 0) {
+            pthread_cond_signal(&sim->tick_pool.done);
+        }
+    }
+    pthread_mutex_unlock(&sim->tick_pool.lock);
+    return nullptr;
+}
+
+// workers counts the calling thread; 1 means passes run inline
+void tick_pool_start(int workers) {
+    sim->tick_pool.workers = min(max(workers, 1), MAX_TICK_WORKERS);
+    sim->tick_pool.generation = 0;
+    sim->tick_pool.busy_helpers = 0;
+    sim->tick_pool.stopping = false;
+    sim->tick_pool.steals = 0;
+    pthread_mutex_init(&sim->tick_pool.lock, NULL);
+    pthread_cond_init(&sim->tick_pool.start, NULL);
+    pthread_cond_init(&sim->tick_pool.done, NULL);
+    for (int w = 1; w < sim->tick_pool.workers; ++w) {
+        sim_thread_create(&sim->tick_pool.threads[w], tick_helper, (void*)(intptr_t)w);
+    }
+}
+
+void tick_pool_stop() {
+    pthread_mutex_lock(&sim->tick_pool.lock);
+    sim->tick_pool.stopping = true;
+    pthread_cond_broadcast(&sim->tick_pool.start);
+    pthread_mutex_unlock(&sim->tick_pool.lock);
+    for (int w = 1; w < sim->tick_pool.workers; ++w) {
+        pthread_join(sim->tick_pool.threads[w], NULL);
+    }
+    sim->tick_pool.workers = 1;
+}
+
+// Runs fn over [0, count) in blocks; returns when every block is done
+void tick_parallel_for(int count, TickFn fn) {
+    int blocks = (count + TICK_GRAIN - 1) / TICK_GRAIN;
+    if (sim->tick_pool.workers <= 1 || blocks <= 1) {
+        for (int begin = 0; begin < count; begin += TICK_GRAIN) {
+            fn(begin, min(begin + TICK_GRAIN, count)); // Same blocks, inline
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&sim->tick_pass_lock);
+    sim->tick_pool.fn = fn;
+    sim->tick_pool.count = count;
+    for (int w = 0; w < sim->tick_pool.workers; ++w) {
+        uint32_t first = (uint32_t)((long long)blocks * w / sim->tick_pool.workers);
+        uint32_t last = (uint32_t)((long long)blocks * (w + 1) / sim->tick_pool.workers);
+        sim->tick_pool.deques[w].range.store(tick_range(first, last), memory_order_relaxed);
+    }
+
+    pthread_mutex_lock(&sim->tick_pool.lock);
+    sim->tick_pool.busy_helpers = sim->tick_pool.workers - 1;
+    sim->tick_pool.generation++;
+    pthread_cond_broadcast(&sim->tick_pool.start);
+    pthread_mutex_unlock(&sim->tick_pool.lock);
+
+    tick_work(0);
+
+    pthread_mutex_lock(&sim->tick_pool.lock);
+    while (sim->tick_pool.busy_helpers > 0) {
+        pthread_cond_wait(&sim->tick_pool.done, &sim->tick_pool.lock);
+    }
+    pthread_mutex_unlock(&sim->tick_pool.lock);
+    pthread_mutex_unlock(&sim->tick_pass_lock);
+}
+
+// ========================== SPEED CHECK KERNEL ==============================
+
+/*
+Speed-limit check. The ARRIVAL/DEPARTURE tables are
+packed into one table keyed by direction * 8 + phase, so a block of
+aircraft gathers its min/max limits without branching on direction.
+The AVX2 path checks 8 aircraft per step and the SSE4.1 path checks 4.
+A scalar loop handles the tail and any other CPU. Build with -march=native
+(or -mavx2) to get the vector paths. Bit i of the mask is set when aircraft
+i is active and its speed is outside the limits of its current phase.
+Live detection only checks flights whose speed changed (VIOLATION
+MONITOR) with speed_violates(); the batch kernel audits a whole fleet.
+*/
+
+const int LIMIT_KEYS = 16; // 2 directions x 8 phases
+int SPEED_LIMIT_MIN[LIMIT_KEYS];
+int SPEED_LIMIT_MAX[LIMIT_KEYS];
+
+#if defined(__AVX2__)
+const char* SPEED_KERNEL_ISA = "AVX2";
+#elif defined(__SSE4_1__)
+const char* SPEED_KERNEL_ISA = "SSE4.1";
+#else
+const char* SPEED_KERNEL_ISA = "scalar";
+#endif
+
+// Limits are per position in a direction's sequence (DEPARTURE taxi is
+// Phase 3 but row 1 of its table), so key them by the actual Phase here
+void build_speed_limit_table() {
+    for (int key = 0; key < LIMIT_KEYS; ++key) {
+        SPEED_LIMIT_MIN[key] = INT_MIN; // Phases a direction never enters
+        SPEED_LIMIT_MAX[key] = INT_MAX;
+    }
+    for (int k = 0; k < NUM_PHASES; ++k) {
+        SPEED_LIMIT_MIN[ARRIVAL * 8 + ARRIVAL_PHASES[k]] = ARRIVAL_SPEED_LIMITS[k][0];
+        SPEED_LIMIT_MAX[ARRIVAL * 8 + ARRIVAL_PHASES[k]] = ARRIVAL_SPEED_LIMITS[k][1];
+        SPEED_LIMIT_MIN[DEPARTURE * 8 + DEPARTURE_PHASES[k]] = DEPARTURE_SPEED_LIMITS[k][0];
+        SPEED_LIMIT_MAX[DEPARTURE * 8 + DEPARTURE_PHASES[k]] = DEPARTURE_SPEED_LIMITS[k][1];
+    }
+}
+
+// Shared by every instance; built once, whichever comes first
+pthread_once_t speed_limit_table_once = PTHREAD_ONCE_INIT;
+
+void init_speed_limit_table() {
+    pthread_once(&speed_limit_table_once, build_speed_limit_table);
+}
+
+inline bool speed_violates(int direction, int phase, int speed) {
+    int key = direction * 8 + phase;
+    return speed < SPEED_LIMIT_MIN[key] || speed > SPEED_LIMIT_MAX[key];
+}
+
+// Reference path; also finishes whatever the vector paths leave over
+void speed_violation_mask_scalar(const unsigned char* direction, const unsigned char* phase,
+                                 const int* speed, const unsigned char* active,
+                                 int begin, int end, uint64_t* mask) {
+    for (int i = begin; i < end; ++i) {
+        if (active[i] && speed_violates(direction[i], phase[i], speed[i])) {
+            mask[i >> 6] |= 1ULL << (i & 63);
+        }
+    }
+}
+
+#if defined(__AVX2__)
+// Returns how many aircraft it covered (a multiple of 8)
+int speed_violation_mask_avx2(const unsigned char* direction, const unsigned char* phase,
+                              const int* speed, const unsigned char* active,
+                              int count, uint64_t* mask) {
+    const __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i dir = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(direction + i)));
+        __m256i ph  = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(phase + i)));
+        __m256i act = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(active + i)));
+        __m256i key = _mm256_add_epi32(_mm256_slli_epi32(dir, 3), ph);
+        __m256i lo  = _mm256_i32gather_epi32(SPEED_LIMIT_MIN, key, 4);
+        __m256i hi  = _mm256_i32gather_epi32(SPEED_LIMIT_MAX, key, 4);
+        __m256i spd = _mm256_loadu_si256((const __m256i*)(speed + i));
+
+        __m256i bad = _mm256_or_si256(_mm256_cmpgt_epi32(lo, spd), _mm256_cmpgt_epi32(spd, hi));
+        bad = _mm256_andnot_si256(_mm256_cmpeq_epi32(act, zero), bad);
+        uint64_t bits = (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(bad));
+        mask[i >> 6] |= bits << (i & 63); // 8 | 64, so a block never straddles words
+    }
+    return i;
+}
+#elif defined(__SSE4_1__)
+// Returns how many aircraft it covered (a multiple of 4)
+int speed_violation_mask_sse41(const unsigned char* direction, const unsigned char* phase,
+                               const int* speed, const unsigned char* active,
+                               int count, uint64_t* mask) {
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int k0 = direction[i] * 8 + phase[i];
+        int k1 = direction[i + 1] * 8 + phase[i + 1];
+        int k2 = direction[i + 2] * 8 + phase[i + 2];
+        int k3 = direction[i + 3] * 8 + phase[i + 3];
+        __m128i lo = _mm_setr_epi32(SPEED_LIMIT_MIN[k0], SPEED_LIMIT_MIN[k1],
+                                    SPEED_LIMIT_MIN[k2], SPEED_LIMIT_MIN[k3]);
+        __m128i hi = _mm_setr_epi32(SPEED_LIMIT_MAX[k0], SPEED_LIMIT_MAX[k1],
+                                    SPEED_LIMIT_MAX[k2], SPEED_LIMIT_MAX[k3]);
+        int act4;
+        memcpy(&act4, active + i, 4);
+        __m128i act = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(act4));
+        __m128i spd = _mm_loadu_si128((const __m128i*)(speed + i));
+
+        __m128i bad = _mm_or_si128(_mm_cmpgt_epi32(lo, spd), _mm_cmpgt_epi32(spd, hi));
+        bad = _mm_andnot_si128(_mm_cmpeq_epi32(act, zero), bad);
+        uint64_t bits = (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(bad));
+        mask[i >> 6] |= bits << (i & 63);
+    }
+    return i;
+}
+#endif
+
+// Fills mask (caller zeroes it, (count + 63) / 64 words) for aircraft [0, count)
+void speed_violation_mask(const unsigned char* direction, const unsigned char* phase,
+                          const int* speed, const unsigned char* active,
+                          int count, uint64_t* mask) {
+    int done = 0;
+#if defined(__AVX2__)
+    done = speed_violation_mask_avx2(direction, phase, speed, active, count, mask);
+#elif defined(__SSE4_1__)
+    done = speed_violation_mask_sse41(direction, phase, speed, active, count, mask);
+#endif
+    speed_violation_mask_scalar(direction, phase, speed, active, done, count, mask);
+}
+
+// Micro-benchmark (--bench-radar N): scalar vs vector kernel on a
+// synthetic fleet of n aircraft, about half of them speeding
+int run_radar_benchmark(int n) {
+    init_speed_limit_table();
+    vector<unsigned char> direction(n), phase(n), active(n, 1);
+    vector<int> speed(n);
+    srand(42);
+    for (int i = 0; i < n; ++i) {
+        int k = rand() % NUM_PHASES;
+        direction[i] = rand() % 2;
+        phase[i] = direction[i] == ARRIVAL ? ARRIVAL_PHASES[k] : DEPARTURE_PHASES[k];
+        const int* limits = direction[i] == ARRIVAL ? ARRIVAL_SPEED_LIMITS[k] : DEPARTURE_SPEED_LIMITS[k];
+        speed[i] = limits[0] + rand() % (limits[1] - limits[0] + 40) - 10;
+    }
+
+    int words = (n + 63) / 64;
+    vector<uint64_t> scalar_mask(words), vector_mask(words);
+    int iterations = max(10, 200000000 / n);
+
+    timespec t0, t1, t2;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int it = 0; it < iterations; ++it) {
+        fill(scalar_mask.begin(), scalar_mask.end(), 0);
+        speed_violation_mask_scalar(direction.data(), phase.data(), speed.data(), active.data(),
+                                    0, n, scalar_mask.data());
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    for (int it = 0; it < iterations; ++it) {
+        fill(vector_mask.begin(), vector_mask.end(), 0);
+        speed_violation_mask(direction.data(), phase.data(), speed.data(), active.data(),
+                             n, vector_mask.data());
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+
+    double scalar_ns = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / iterations;
+    double vector_ns = ((t2.tv_sec - t1.tv_sec) * 1e9 + (t2.tv_nsec - t1.tv_nsec)) / iterations;
+    bool same = scalar_mask == vector_mask;
+
+    printf("[Radar Bench] %d aircraft, %d sweeps each\n", n, iterations);
+    printf("[Radar Bench] scalar : %10.1f us/sweep  %6.2f ns/aircraft\n", scalar_ns / 1e3, scalar_ns / n);
+    printf("[Radar Bench] %-7s: %10.1f us/sweep  %6.2f ns/aircraft  (%.2fx)\n", SPEED_KERNEL_ISA,
+           vector_ns / 1e3, vector_ns / n, scalar_ns / vector_ns);
+    printf("[Radar Bench] masks %s\n", same ? "match" : "DIFFER");
+    return same ? 0 : 1;
+}
+
+// ========================== SEPARATION GRID =================================
+
+/*
+Separation check for radar_monitor: any two airborne aircraft closer than
+MIN_SEPARATION_KM horizontally and MIN_VERTICAL_SEPARATION_M vertically
+have lost separation, and both are issued an AVN.
+
+Aircraft are kept in a spatial hash of cells one separation minimum wide,
+so a conflicting pair is always in the same or adjacent cells and each
+aircraft only compares against the 27 cells around it. The grid persists
+between sweeps. Each sweep only relinks the aircraft that changed cell,
+using intrusive doubly linked bucket lists, so an update is O(1) per
+aircraft and the whole check is near-linear instead of O(n^2).
+*/
+
+// Runway phases are sequenced by runway arbitration, not radar separation
+bool separation_phase(Phase phase) {
+    return phase == HOLDING || phase == APPROACH || phase == CLIMB || phase == CRUISE;
+}
+
+uint64_t grid_cell_key(long long cx, long long cy, long long cz) {
+    const long long bias = 1LL << 20; // 21 bits per axis, covers +/- 5000 km
+    return ((uint64_t)(cx + bias) & 0x1FFFFF) |
+           (((uint64_t)(cy + bias) & 0x1FFFFF) << 21) |
+           (((uint64_t)(cz + bias) & 0x1FFFFF) << 42);
+}
+
+uint32_t grid_bucket(const SeparationGrid* grid, uint64_t key) {
+    key *= 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(key >> 32) & (uint32_t)(grid->heads.size() - 1);
+}
+
+long long grid_axis(float value, float cell_size) {
+    return (long long)floorf(value / cell_size);
+}
+
+void grid_link(SeparationGrid* grid, int i) {
+    uint32_t b = grid_bucket(grid, grid->cell[i]);
+    grid->bucket[i] = b;
+    grid->prev[i] = -1;
+    grid->next[i] = grid->heads[b];
+    if (grid->heads[b] >= 0) {
+        grid->prev[grid->heads[b]] = i;
+    }
+    grid->heads[b] = i;
+}
+
+void grid_unlink(SeparationGrid* grid, int i) {
+    int b = grid->bucket[i];
+    if (grid->prev[i] >= 0) {
+        grid->next[grid->prev[i]] = grid->next[i];
+    } else {
+        grid->heads[b] = grid->next[i];
+    }
+    if (grid->next[i] >= 0) {
+        grid->prev[grid->next[i]] = grid->prev[i];
+    }
+    grid->bucket[i] = -1;
+}
+
+// Makes room for aircraft [0, count). Rehashes when the table gets crowded,
+// which only happens while the fleet is growing.
+void grid_reserve(SeparationGrid* grid, int count) {
+    if ((int)grid->bucket.size() < count) {
+        grid->next.resize(count, -1);
+        grid->prev.resize(count, -1);
+        grid->bucket.resize(count, -1);
+        grid->cell.resize(count, 0);
+        grid->x.resize(count, 0.f);
+        grid->y.resize(count, 0.f);
+        grid->alt.resize(count, 0.f);
+        grid->settled.resize(count, 0);
+    }
+    size_t wanted = 1024;
+    while (wanted < 2 * (size_t)count) {
+        wanted *= 2;
+    }
+    if (grid->heads.size() < wanted) {
+        grid->heads.assign(wanted, -1);
+        for (int i = 0; i < (int)grid->bucket.size(); ++i) {
+            if (grid->bucket[i] >= 0) {
+                grid_link(grid, i);
+            }
+        }
+    }
+}
+
+// Incremental update of one aircraft; absent ones (landed, parked,
+// finished) are dropped from the grid. Settled ones stay in it, so an
+// unfined aircraft still conflicts with them.
+void grid_update(SeparationGrid* grid, int i, bool present, float x, float y, float alt,
+                 bool settled = false) {
+    if (!present) {
+        if (grid->bucket[i] >= 0) {
+            grid_unlink(grid, i);
+        }
+        return;
+    }
+    grid->settled[i] = settled;
+    grid->x[i] = x;
+    grid->y[i] = y;
+    grid->alt[i] = alt;
+    uint64_t key = grid_cell_key(grid_axis(x, MIN_SEPARATION_KM), grid_axis(y, MIN_SEPARATION_KM),
+                                 grid_axis(alt, MIN_VERTICAL_SEPARATION_M));
+    if (grid->bucket[i] >= 0) {
+        if (grid->cell[i] == key) {
+            return; // Same cell: nothing to relink
+        }
+        grid_unlink(grid, i);
+        grid->moves++;
+    }
+    grid->cell[i] = key;
+    grid_link(grid, i);
+}
+
+bool separation_lost(float dx, float dy, float dalt) {
+    return dx * dx + dy * dy < MIN_SEPARATION_KM * MIN_SEPARATION_KM &&
+           fabsf(dalt) < MIN_VERTICAL_SEPARATION_M;
+}
+
+// Every pair (i < j) in the grid that has lost separation and holds at
+// least one unsettled aircraft, for aircraft i in [begin, end). Only
+// unsettled aircraft search: each looks at the 27 cells around it and
+// takes settled neighbours plus unsettled ones above its own index, so
+// every pair is reported once and a crowd that has all been fined costs
+// nothing. Bucket lists may hold other cells that hashed to the same
+// bucket; the cell check skips those. Read-only, so ranges can run in
+// parallel.
+void grid_find_pairs_range(const SeparationGrid* grid, int begin, int end,
+                           vector<pair<int, int>>& pairs) {
+    for (int i = begin; i < end; ++i) {
+        if (grid->bucket[i] < 0 || grid->settled[i]) {
+            continue;
+        }
+        long long cx = grid_axis(grid->x[i], MIN_SEPARATION_KM);
+        long long cy = grid_axis(grid->y[i], MIN_SEPARATION_KM);
+        long long cz = grid_axis(grid->alt[i], MIN_VERTICAL_SEPARATION_M);
+
+        for (int dx = -1; dx <= 1; ++dx) {
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dz = -1; dz <= 1; ++dz) {
+                    uint64_t key = grid_cell_key(cx + dx, cy + dy, cz + dz);
+                    for (int j = grid->heads[grid_bucket(grid, key)]; j >= 0; j = grid->next[j]) {
+                        if (grid->cell[j] != key || (j <= i && !grid->settled[j])) {
+                            continue;
+                        }
+                        if (separation_lost(grid->x[j] - grid->x[i], grid->y[j] - grid->y[i],
+                                            grid->alt[j] - grid->alt[i])) {
+                            pairs.push_back(make_pair(min(i, j), max(i, j)));
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void grid_find_pairs(const SeparationGrid* grid, vector<pair<int, int>>& pairs) {
+    pairs.clear();
+    grid_find_pairs_range(grid, 0, (int)grid->bucket.size(), pairs);
+}
+
+void separation_find_block(int begin, int end) {
+    vector<pair<int, int>>& pairs = sim->radar_block_pairs[begin / TICK_GRAIN];
+    pairs.clear();
+    grid_find_pairs_range(&sim->radar_grid, begin, end, pairs);
+}
+
+// Called from radar_monitor after the scan. Positions come from the raw
+// motion arrays, so the pairs are candidates; each is confirmed on
+// consistent copies. Aircraft already fined stay in the grid as settled
+// obstacles: a fresh aircraft closing on one is still caught, and
+// issue_avn ignores the side that was fined before. Relinking is serial
+// (the bucket lists are shared); the pair search is a parallel tick,
+// gathered back in index order.
+void separation_sweep() {
+    int count = fleet_size();
+    grid_reserve(&sim->radar_grid, count);
+    for (int i = 0; i < count; ++i) {
+        const FleetChunk* chunk = fleet_chunk(i);
+        bool settled = chunk->avn_issued[fleet_slot(i)].load(memory_order_relaxed);
+        grid_update(&sim->radar_grid, i, sim->radar_airborne[i], sim->radar_x[i], sim->radar_y[i],
+                    sim->radar_alt[i], settled);
+    }
+
+    int blocks = (count + TICK_GRAIN - 1) / TICK_GRAIN;
+    if ((int)sim->radar_block_pairs.size() < blocks) {
+        // A block keeps every pair it finds. The vectors start at one pair
+        // per aircraft and grow past that only in a pile-up; the capacity
+        // stays for later sweeps, so steady state doesn't allocate.
+        sim->radar_block_pairs.resize(blocks);
+        for (int b = 0; b < blocks; ++b) {
+            sim->radar_block_pairs[b].reserve(TICK_GRAIN);
+        }
+    }
+    tick_parallel_for(count, separation_find_block);
+    size_t found = 0;
+    for (int b = 0; b < blocks; ++b) {
+        found += sim->radar_block_pairs[b].size();
+    }
+    sim->radar_conflicts.clear();
+    sim->radar_conflicts.reserve(found);
+    for (int b = 0; b < blocks; ++b) {
+        sim->radar_conflicts.insert(sim->radar_conflicts.end(), sim->radar_block_pairs[b].begin(), sim->radar_block_pairs[b].end());
+    }
+    for (size_t p = 0; p < sim->radar_conflicts.size(); ++p) {
+        int a = sim->radar_conflicts[p].first, b = sim->radar_conflicts[p].second;
+        // Both may have been fined by an earlier pair of this same sweep
+        if (fleet_chunk(a)->avn_issued[fleet_slot(a)].load(memory_order_relaxed) &&
+            fleet_chunk(b)->avn_issued[fleet_slot(b)].load(memory_order_relaxed)) {
+            continue;
+        }
+        FlightView va = fleet_read(a), vb = fleet_read(b);
+        if (!va.active || !vb.active || !separation_phase(va.phase) || !separation_phase(vb.phase) ||
+            !separation_lost(vb.x - va.x, vb.y - va.y, vb.alt - va.alt)) {
+            continue;
+        }
+        sim->separation_losses++;
+        char reason[64];
+        float km = sqrtf((vb.x - va.x) * (vb.x - va.x) + (vb.y - va.y) * (vb.y - va.y));
+        float metres = fabsf(vb.alt - va.alt);
+        snprintf(reason, sizeof(reason), "Separation loss with %s (%.1f km, %.0f m)",
+                 fleet_aircraft(b).flight_number, km, metres);
+        issue_avn(a, va.phase, va.speed, reason);
+        snprintf(reason, sizeof(reason), "Separation loss with %s (%.1f km, %.0f m)",
+                 fleet_aircraft(a).flight_number, km, metres);
+        issue_avn(b, vb.phase, vb.speed, reason);
+    }
+}
+
+// --bench-separation N: grid vs all-pairs at 1k, 10k, ... up to N aircraft
+// at constant traffic density (one aircraft per 100 km^2, 0-12 km altitude)
+int run_separation_benchmark(int max_n) {
+    printf("[Separation Bench] %8s %10s %12s %12s %12s %8s\n",
+           "aircraft", "build ms", "update ms", "query ms", "pairs ms", "pairs");
+    srand(42);
+    bool ok = true;
+    for (int n = 1000; ; n = min(n * 10, max_n)) {
+        float side = sqrtf((float)n) * 10.f;
+        vector<float> x(n), y(n), alt(n), vx(n), vy(n);
+        for (int i = 0; i < n; ++i) {
+            x[i] = side * rand() / (float)RAND_MAX;
+            y[i] = side * rand() / (float)RAND_MAX;
+            alt[i] = 12000.f * rand() / (float)RAND_MAX;
+            float heading = 2.f * (float)M_PI * rand() / (float)RAND_MAX;
+            vx[i] = 0.25f * cosf(heading); // 900 km/h over a 1 s tick
+            vy[i] = 0.25f * sinf(heading);
+        }
+
+        SeparationGrid grid;
+        grid.moves = 0;
+        vector<pair<int, int>> pairs;
+        long long t0 = monotonic_ns();
+        grid_reserve(&grid, n);
+        for (int i = 0; i < n; ++i) {
+            grid_update(&grid, i, true, x[i], y[i], alt[i]);
+        }
+        long long t1 = monotonic_ns();
+
+        // Ten one-second ticks of straight-line motion
+        const int ticks = 10;
+        long long update_ns = 0, query_ns = 0;
+        for (int t = 0; t < ticks; ++t) {
+            for (int i = 0; i < n; ++i) {
+                x[i] += vx[i];
+                y[i] += vy[i];
+            }
+            long long a = monotonic_ns();
+            for (int i = 0; i < n; ++i) {
+                grid_update(&grid, i, true, x[i], y[i], alt[i]);
+            }
+            long long b = monotonic_ns();
+            grid_find_pairs(&grid, pairs);
+            long long c = monotonic_ns();
+            update_ns += b - a;
+            query_ns += c - b;
+        }
+
+        // All-pairs reference, skipped where it would take minutes
+        char brute[32] = "-";
+        if (n <= 20000) {
+            long long a = monotonic_ns();
+            size_t found = 0;
+            for (int i = 0; i < n; ++i) {
+                for (int j = i + 1; j < n; ++j) {
+                    found += separation_lost(x[j] - x[i], y[j] - y[i], alt[j] - alt[i]);
+                }
+            }
+            snprintf(brute, sizeof(brute), "%.2f", (monotonic_ns() - a) / 1e6);
+            if (found != pairs.size()) {
+                printf("[Separation Bench] %d aircraft: grid found %zu pairs, all-pairs %zu\n",
+                       n, pairs.size(), found);
+                ok = false;
+            }
+
+            // Every other aircraft settled: still obstacles for the rest,
+            // but two settled ones never pair
+            size_t mixed = 0;
+            for (int i = 0; i < n; ++i) {
+                for (int j = i + 1; j < n; ++j) {
+                    mixed += ((i & 1) == 0 || (j & 1) == 0) &&
+                             separation_lost(x[j] - x[i], y[j] - y[i], alt[j] - alt[i]);
+                }
+            }
+            vector<pair<int, int>> settled_pairs;
+            for (int i = 0; i < n; ++i) {
+                grid_update(&grid, i, true, x[i], y[i], alt[i], i & 1);
+            }
+            grid_find_pairs(&grid, settled_pairs);
+            if (mixed != settled_pairs.size()) {
+                printf("[Separation Bench] %d aircraft, half settled: grid found %zu pairs, all-pairs %zu\n",
+                       n, settled_pairs.size(), mixed);
+                ok = false;
+            }
+        }
+        printf("[Separation Bench] %8d %10.2f %12.3f %12.3f %12s %8zu\n", n, (t1 - t0) / 1e6,
+               update_ns / 1e6 / ticks, query_ns / 1e6 / ticks, brute, pairs.size());
+        if (n >= max_n) {
+            break;
+        }
+    }
+    printf("[Separation Bench] update/query are per tick; pairs ms is one all-pairs pass\n");
+    return ok ? 0 : 1;
+}
+
+// ========================== EVENT SCHEDULER =================================
+
+/*
+Flights no longer own a thread. Each phase transition is a timed event in a
+binary min-heap keyed on (due time, insertion order). A small fixed pool of
+worker threads sleeps until the earliest event is due, pops it and runs its
+handler. An aircraft only ever has one pending event, so memory per flight is
+constant and two workers never handle the same aircraft at once.
+In VIRTUAL clock mode there is no pool: scheduler_run_virtual() pops events
+in order on the calling thread and advances the clock to each one.
+
+There is one scheduler per airport partition. A flight's events go to its
+airport's queue and are run by that partition's workers, so airports never
+contend on a queue lock. Global events (radar, violation checks,
+snapshots, ingestion, the end timer) live on partition 0.
+*/
+
+enum EventType {
+    EV_PHASE_START,    // enter phases[phase_index]
+    EV_RUNWAY_REQUEST, // ask for a runway for LANDING/TAKEOFF
+    EV_RUNWAY_GRANTED, // a runway was handed over by release_runway()
+    EV_RUNWAY_GRANT_PASS, // hand free runways to this instant's requests (aircraft = a requester)
+    EV_PHASE_END,      // phase time elapsed: release runway, move on
+    EV_RADAR_SWEEP,    // periodic radar_monitor pass (aircraft = -1)
+    EV_VIOLATION_CHECK, // drain the speed dirty set (aircraft = -1)
+    EV_SNAPSHOT,       // publish a world snapshot for the renderer (aircraft = -1)
+    EV_INGEST,         // pull upcoming flights from the scenario (aircraft = -1)
+    EV_SIM_END         // simulation_timer expiry (aircraft = -1)
+};
+
+struct SimEvent {
+    long long time_us;       // Due time, microseconds since simulation start
+    unsigned long long seq;  // Insertion order, keeps equal-time events FIFO
+    int aircraft;            // Fleet index
+    EventType type;
+};
+
+// Heap comparator: the earliest (then oldest) event sits on top
+struct EventLater {
+    bool operator()(const SimEvent& a, const SimEvent& b) const {
+        if (a.time_us != b.time_us) return a.time_us > b.time_us;
+        return a.seq > b.seq;
+    }
+};
+
+struct Scheduler {
+    vector<SimEvent> heap;
+    unsigned long long next_seq;
+    bool stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;   // Signalled on new earliest event or stop
+};
+
+void scheduler_init(int partitions, int expected_events) {
+    sim->num_partitions = partitions;
+    sim->schedulers = new Scheduler[partitions];
+    for (int p = 0; p < partitions; ++p) {
+        Scheduler& scheduler = sim->schedulers[p];
+        scheduler.heap.reserve(expected_events);
+        scheduler.next_seq = 0;
+        scheduler.stopping = false;
+        pthread_mutex_init(&scheduler.lock, NULL);
+
+        // Deadlines are computed on the monotonic clock, so wait on it too
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&scheduler.wakeup, &attr);
+        pthread_condattr_destroy(&attr);
+    }
+}
+
+// Flights run on their airport's partition, global events on partition 0
+int event_partition(int aircraft) {
+    return aircraft >= 0 ? fleet_aircraft(aircraft).airport : 0;
+}
+
+void schedule_event(int aircraft, EventType type, long long delay_us) {
+    Scheduler& scheduler = sim->schedulers[event_partition(aircraft)];
+    SimEvent ev;
+    ev.time_us = sim_now_us() + delay_us;
+    ev.aircraft = aircraft;
+    ev.type = type;
+
+    pthread_mutex_lock(&scheduler.lock);
+    ev.seq = scheduler.next_seq++;
+    scheduler.heap.push_back(ev);
+    push_heap(scheduler.heap.begin(), scheduler.heap.end(), EventLater());
+    // Only a new earliest event changes how long the workers should sleep
+    if (scheduler.heap.front().seq == ev.seq) {
+        pthread_cond_signal(&scheduler.wakeup);
+    }
+    pthread_mutex_unlock(&scheduler.lock);
+}
+
+void scheduler_stop() {
+    for (int p = 0; p < sim->num_partitions; ++p) {
+        pthread_mutex_lock(&sim->schedulers[p].lock);
+        sim->schedulers[p].stopping = true;
+        pthread_cond_broadcast(&sim->schedulers[p].wakeup);
+        pthread_mutex_unlock(&sim->schedulers[p].lock);
+    }
+}
+
+void dispatch_event(const SimEvent& ev);
+
+// arg is the partition index this worker serves
+void* scheduler_worker(void* arg) {
+    Scheduler& scheduler = sim->schedulers[(intptr_t)arg];
+    pthread_mutex_lock(&scheduler.lock);
+    while (!scheduler.stopping) {
+        if (scheduler.heap.empty()) {
+            pthread_cond_wait(&scheduler.wakeup, &scheduler.lock);
+            continue;
+        }
+
+        long long due = scheduler.heap.front().time_us;
+        if (due > sim_now_us()) {
+            timespec deadline = sim_deadline(due);
+            pthread_cond_timedwait(&scheduler.wakeup, &scheduler.lock, &deadline);
+            continue;
+        }
+
+        pop_heap(scheduler.heap.begin(), scheduler.heap.end(), EventLater());
+        SimEvent ev = scheduler.heap.back();
+        scheduler.heap.pop_back();
+
+        // More work already due: hand it to another sleeping worker
+        if (!scheduler.heap.empty() && scheduler.heap.front().time_us <= sim_now_us()) {
+            pthread_cond_signal(&scheduler.wakeup);
+        }
+
+        pthread_mutex_unlock(&scheduler.lock);
+        dispatch_event(ev);
+        pthread_mutex_lock(&scheduler.lock);
+    }
+    pthread_mutex_unlock(&scheduler.lock);
+    return nullptr;
+}
+
+// VIRTUAL mode: run every event due by until_us in (time, partition, seq)
+// order on this thread, jumping the clock forward instead of waiting.
+// Returns true if events remain, with the clock parked at until_us.
+bool scheduler_run_virtual(long long until_us) {
+    for (;;) {
+        // Earliest head across partitions; single-threaded, so no locks
+        int best = -1;
+        for (int p = 0; p < sim->num_partitions; ++p) {
+            Scheduler& scheduler = sim->schedulers[p];
+            if (scheduler.stopping) {
+                return false;
+            }
+            if (!scheduler.heap.empty() &&
+                (best < 0 || scheduler.heap.front().time_us < sim->schedulers[best].heap.front().time_us)) {
+                best = p;
+            }
+        }
+        if (best < 0) {
+            return false;
+        }
+        Scheduler& scheduler = sim->schedulers[best];
+        if (scheduler.heap.front().time_us > until_us) {
+            sim->sim_clock.virtual_us.store(until_us, memory_order_relaxed);
+            return true;
+        }
+        pop_heap(scheduler.heap.begin(), scheduler.heap.end(), EventLater());
+        SimEvent ev = scheduler.heap.back();
+        scheduler.heap.pop_back();
+        sim->sim_clock.virtual_us.store(ev.time_us, memory_order_relaxed);
+        dispatch_event(ev);
+    }
+}
+
+// ========================== RUNWAY ARBITRATION ==============================
+
+/*
+[MODULE 2] Runway grant queue. Every request is parked in its airport's
+min-heap for its capability class, ordered by get_priority() and then by
+request order, so EMERGENCY traffic always goes first and equal
+priorities are FIFO. A request that finds a suitable runway free arms a
+grant pass for the airport, which runs once every other event due at
+that instant has: requests made at the same time are arbitrated by
+priority instead of by dispatch order. release_runway() arms the same
+pass when someone waiting can use the runway it frees. The pass
+schedules the EV_RUNWAY_GRANTED event of each flight it grants, so a
+runway is never idle past the instant while someone who can use it is
+waiting, and no worker ever blocks or polls. With --sequencing lookahead
+the RUNWAY SEQUENCER below picks the flight and the runway instead.
+*/
+
+struct RequestLater {
+    bool operator()(const RunwayRequest& a, const RunwayRequest& b) const {
+        if (a.priority != b.priority) return a.priority > b.priority;
+        return a.seq > b.seq;
+    }
+};
+
+bool parse_aircraft_type(const char* name, AircraftType* type) {
+    for (int t = 0; t < 3; ++t) {
+        if (strcasecmp(name, AIRCRAFT_TYPE_NAMES[t]) == 0) {
+            *type = (AircraftType)t;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parse_direction(const char* name, FlightType* direction) {
+    if (strcasecmp(name, "ARRIVAL") == 0) {
+        *direction = ARRIVAL;
+    } else if (strcasecmp(name, "DEPARTURE") == 0) {
+        *direction = DEPARTURE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+int add_airport(const char* code, float x_km, float y_km) {
+    Airport airport;
+    memset(airport.code, 0, sizeof(airport.code));
+    strncpy(airport.code, code, sizeof(airport.code) - 1);
+    airport.x_km = x_km;
+    airport.y_km = y_km;
+    airport.first_runway = (int)sim->runways.size();
+    airport.num_runways = 0;
+    airport.classes = 0;
+    memset(airport.free_by_class, 0, sizeof(airport.free_by_class));
+    airport.request_seq = 0;
+    airport.grant_pass_pending = false;
+    airport.wait_hist = NULL; // Allocated by airports_init
+    airport.emergency_wait_hist = NULL;
+    airport.holding_hist = NULL;
+    airport.sequencer = NULL;
+    sim->airports.push_back(airport);
+    return (int)sim->airports.size() - 1;
+}
+
+void add_runway(const char* name, unsigned char capabilities, long long occupancy_us) {
+    Airport& airport = sim->airports.back();
+    Runway runway;
+    memset(&runway, 0, sizeof(runway));
+    strncpy(runway.name, name, sizeof(runway.name) - 1);
+    runway.airport = (int)sim->airports.size() - 1;
+    runway.local_index = airport.num_runways++;
+    runway.capabilities = capabilities;
+    runway.occupancy_us = occupancy_us;
+    sim->runways.push_back(runway);
+
+    // Free at start: set its bit in every class it serves
+    airport.classes |= capabilities;
+    for (int c = 0; c < RUNWAY_CLASSES; ++c) {
+        if (capabilities & (1 << c)) {
+            airport.free_by_class[c] |= 1ULL << runway.local_index;
+        }
+    }
+}
+
+// The original layout: three runways taking everything for 3 s, unless
+// --runways / --occupancy (or a Monte Carlo sweep) say otherwise
+void default_airport_config(int runways = DEFAULT_RUNWAYS, long long occupancy_us = PHASE_DURATION_S * 1000000LL) {
+    add_airport("ATC", 0.f, 0.f);
+    runways = max(1, min(runways, MAX_AIRPORT_RUNWAYS));
+    for (int r = 0; r < runways; ++r) {
+        char name[16];
+        if (r < 26) {
+            snprintf(name, sizeof(name), "RWY-%c", 'A' + r);
+        } else {
+            snprintf(name, sizeof(name), "RWY-%d", r + 1);
+        }
+        add_runway(name, (1 << RUNWAY_CLASSES) - 1, occupancy_us);
+    }
+}
+
+// --airports FILE. Line format ('#' starts a comment):
+//   airport CODE [X_KM Y_KM]
+//   runway NAME arrival|departure|both all|TYPE[,TYPE...] OCCUPANCY_S
+// Runways belong to the airport line above them.
+bool load_airport_config(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+    char line[256];
+    int line_no = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_no++;
+        char* comment = strchr(line, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        char* save = NULL;
+        char* keyword = strtok_r(line, " \t\r\n", &save);
+        if (!keyword) {
+            continue;
+        }
+        if (strcmp(keyword, "airport") == 0) {
+            char* code = strtok_r(NULL, " \t\r\n", &save);
+            char* x = strtok_r(NULL, " \t\r\n", &save);
+            char* y = strtok_r(NULL, " \t\r\n", &save);
+            if (!code) {
+                fprintf(stderr, "%s:%d: airport needs a code\n", path, line_no);
+                ok = false;
+            } else {
+                add_airport(code, x ? atof(x) : 0.f, y ? atof(y) : 0.f);
+            }
+            continue;
+        }
+        if (strcmp(keyword, "runway") != 0) {
+            fprintf(stderr, "%s:%d: unknown keyword '%s'\n", path, line_no, keyword);
+            ok = false;
+            continue;
+        }
+
+        char* name = strtok_r(NULL, " \t\r\n", &save);
+        char* direction = strtok_r(NULL, " \t\r\n", &save);
+        char* types = strtok_r(NULL, " \t\r\n", &save);
+        char* occupancy = strtok_r(NULL, " \t\r\n", &save);
+        if (!name || !direction || !types || !occupancy) {
+            fprintf(stderr, "%s:%d: expected runway NAME DIRECTION TYPES OCCUPANCY_S\n", path, line_no);
+            ok = false;
+            continue;
+        }
+        if (sim->airports.empty()) {
+            fprintf(stderr, "%s:%d: runway before any airport\n", path, line_no);
+            ok = false;
+            continue;
+        }
+        if (sim->airports.back().num_runways >= MAX_AIRPORT_RUNWAYS) {
+            fprintf(stderr, "%s:%d: more than %d runways at %s\n", path, line_no,
+                    MAX_AIRPORT_RUNWAYS, sim->airports.back().code);
+            ok = false;
+            continue;
+        }
+
+        int directions = 0;
+        if (strcasecmp(direction, "arrival") == 0) {
+            directions = 1 << ARRIVAL;
+        } else if (strcasecmp(direction, "departure") == 0) {
+            directions = 1 << DEPARTURE;
+        } else if (strcasecmp(direction, "both") == 0) {
+            directions = (1 << ARRIVAL) | (1 << DEPARTURE);
+        } else {
+            fprintf(stderr, "%s:%d: direction must be arrival, departure or both\n", path, line_no);
+            ok = false;
+            continue;
+        }
+
+        int type_mask = 0;
+        if (strcasecmp(types, "all") == 0) {
+            type_mask = 7;
+        } else {
+            char* type_save = NULL;
+            for (char* t = strtok_r(types, ",", &type_save); t; t = strtok_r(NULL, ",", &type_save)) {
+                AircraftType type;
+                if (!parse_aircraft_type(t, &type)) {
+                    fprintf(stderr, "%s:%d: unknown aircraft type '%s'\n", path, line_no, t);
+                    ok = false;
+                    break;
+                }
+                type_mask |= 1 << type;
+            }
+            if (!ok) {
+                continue;
+            }
+        }
+
+        unsigned char capabilities = 0;
+        for (int d = ARRIVAL; d <= DEPARTURE; ++d) {
+            for (int t = COMMERCIAL; t <= EMERGENCY; ++t) {
+                if ((directions & (1 << d)) && (type_mask & (1 << t))) {
+                    capabilities |= 1 << runway_class((FlightType)d, (AircraftType)t);
+                }
+            }
+        }
+        char full_name[24];
+        snprintf(full_name, sizeof(full_name), "%s/%s", sim->airports.back().code, name);
+        add_runway(full_name, capabilities, (long long)(max(0.001, atof(occupancy)) * 1e6));
+    }
+    fclose(file);
+
+    for (size_t a = 0; ok && a < sim->airports.size(); ++a) {
+        if (sim->airports[a].num_runways == 0) {
+            fprintf(stderr, "%s: airport %s has no runways\n", path, sim->airports[a].code);
+            ok = false;
+        }
+    }
+    if (ok && sim->airports.empty()) {
+        fprintf(stderr, "%s: no airports defined\n", path);
+        ok = false;
+    }
+    return ok;
+}
+
+// RUNWAY SEQUENCER, below
+void sequencer_init(Airport& airport);
+RunwayDemand* sequencer_demand(Airport& airport, int aircraft, long long eta_us);
+int sequencer_next(Airport& airport, long long now, int* granted);
+
+// Locks are initialized once the vector has its final size
+void airports_init() {
+    for (size_t a = 0; a < sim->airports.size(); ++a) {
+        pthread_mutex_init(&sim->airports[a].lock, NULL);
+        sim->airports[a].wait_hist = new MetricSummary(); // Zeroed
+        sim->airports[a].emergency_wait_hist = new MetricSummary();
+        sim->airports[a].holding_hist = new MetricSummary();
+        for (int c = 0; c < RUNWAY_CLASSES; ++c) {
+            sim->airports[a].waiters[c].reserve(RUNWAY_QUEUE_RESERVE); // Grows only past a backlog this deep
+        }
+        if (sim->sequencing == SEQUENCING_LOOKAHEAD) {
+            sequencer_init(sim->airports[a]);
+        }
+    }
+}
+
+int airport_index(const char* code) {
+    for (size_t a = 0; a < sim->airports.size(); ++a) {
+        if (strcasecmp(sim->airports[a].code, code) == 0) {
+            return (int)a;
+        }
+    }
+    return -1;
+}
+
+// Airport for a new flight: the requested one if it can take the flight,
+// otherwise the next airport round-robin that can. -1 if none can.
+int assign_airport(int requested, FlightType direction, AircraftType type) {
+    int c = runway_class(direction, type);
+    if (requested >= 0 && requested < (int)sim->airports.size() && (sim->airports[requested].classes & (1 << c))) {
+        return requested;
+    }
+    for (size_t tries = 0; tries < sim->airports.size(); ++tries) {
+        int a = sim->next_airport;
+        sim->next_airport = (sim->next_airport + 1) % (int)sim->airports.size();
+        if (sim->airports[a].classes & (1 << c)) {
+            return a;
+        }
+    }
+    return -1;
+}
+
+// Give local runway r to aircraft for a request made at requested_us;
+// caller holds the airport lock. The runway leaves every class bitmap it
+// was in.
+void grant_runway_locked(Airport& airport, int r, int aircraft, long long requested_us, long long now) {
+    Runway& runway = sim->runways[airport.first_runway + r];
+    runway.in_use = true;
+    runway.granted_at_us = now;
+    runway.movements++;
+    for (int c = 0; c < RUNWAY_CLASSES; ++c) {
+        airport.free_by_class[c] &= ~(1ULL << r);
+    }
+    hist_add(airport.wait_hist, now - requested_us);
+    const Aircraft& a = fleet_aircraft(aircraft);
+    if (a.type == EMERGENCY) {
+        hist_add(airport.emergency_wait_hist, now - requested_us);
+    }
+    if (a.direction == ARRIVAL) {
+        hist_add(airport.holding_hist, now - requested_us);
+    }
+    metric_record(METRIC_RUNWAY_WAIT, now - requested_us);
+}
+
+// Local runway r is free again: back into every class bitmap it serves
+void free_runway_locked(Airport& airport, int r) {
+    Runway& runway = sim->runways[airport.first_runway + r];
+    runway.in_use = false;
+    for (int c = 0; c < RUNWAY_CLASSES; ++c) {
+        if (runway.capabilities & (1 << c)) {
+            airport.free_by_class[c] |= 1ULL << r;
+        }
+    }
+}
+
+// Hands free runways to the waiters in priority order, each the lowest
+// free runway of its class, until no waiting class has one free. Caller
+// holds the airport lock. Returns the number of flights in granted.
+int runway_grant_pass_locked(Airport& airport, long long now, int* granted) {
+    int n = 0;
+    for (;;) {
+        int best = -1;
+        for (int c = 0; c < RUNWAY_CLASSES; ++c) {
+            if (airport.free_by_class[c] && !airport.waiters[c].empty() &&
+                (best < 0 || RequestLater()(airport.waiters[best].front(), airport.waiters[c].front()))) {
+                best = c;
+            }
+        }
+        if (best < 0) {
+            return n;
+        }
+        int r = __builtin_ctzll(airport.free_by_class[best]);
+        vector<RunwayRequest>& queue = airport.waiters[best];
+        pop_heap(queue.begin(), queue.end(), RequestLater());
+        RunwayRequest req = queue.back();
+        queue.pop_back();
+        grant_runway_locked(airport, r, req.aircraft, req.requested_us, now);
+        fleet_aircraft(req.aircraft).runway = airport.first_runway + r;
+        granted[n++] = req.aircraft;
+    }
+}
+
+// True while the partition still has events due at or before time_us
+bool partition_due(int partition, long long time_us) {
+    Scheduler& scheduler = sim->schedulers[partition];
+    pthread_mutex_lock(&scheduler.lock);
+    bool due = !scheduler.heap.empty() && scheduler.heap.front().time_us <= time_us;
+    pthread_mutex_unlock(&scheduler.lock);
+    return due;
+}
+
+// EV_RUNWAY_GRANT_PASS. Goes to the back of the line while other events of
+// this instant are still due, since any of them may be a request too.
+void runway_grant_pass(const SimEvent& ev) {
+    if (partition_due(event_partition(ev.aircraft), ev.time_us)) {
+        schedule_event(ev.aircraft, EV_RUNWAY_GRANT_PASS, 0);
+        return;
+    }
+    Airport& airport = sim->airports[fleet_aircraft(ev.aircraft).airport];
+    int granted[MAX_AIRPORT_RUNWAYS];
+    long long locked_at = timed_lock(&airport.lock, METRIC_AIRPORT_LOCK_WAIT);
+    airport.grant_pass_pending = false;
+    int n = runway_grant_pass_locked(airport, sim_now_us(), granted);
+    timed_unlock(&airport.lock, METRIC_AIRPORT_LOCK_HOLD, locked_at);
+    for (int k = 0; k < n; ++k) {
+        schedule_event(granted[k], EV_RUNWAY_GRANTED, 0);
+    }
+}
+
+// [MODULE 2] Request a runway with priority-based access.
+// Never blocks and, at a greedy airport, never grants on the spot: the
+// flight is queued, and if a runway it can use is free a grant pass is
+// armed for the end of this instant. Either that pass or release_runway()
+// sends its EV_RUNWAY_GRANTED. A sequenced airport grants by its plan
+// instead, which may grant this flight right away (the return value) and
+// also hand free runways to other waiting flights.
+Runway* request_runway(int aircraft) {
+    Runway* granted = nullptr;
+    long long now = sim_now_us();
+    const Aircraft& flight = fleet_aircraft(aircraft);
+    Airport& airport = sim->airports[flight.airport];
+    int c = runway_class(flight.direction, flight.type);
+    int others[MAX_AIRPORT_RUNWAYS];
+    int num_others = 0;
+    bool arm_pass = false;
+
+    long long locked_at = timed_lock(&airport.lock, METRIC_AIRPORT_LOCK_WAIT);
+    uint64_t free_runways = airport.free_by_class[c];
+    if (airport.sequencer) {
+        sequencer_demand(airport, aircraft, now)->requested = true;
+        int n = sequencer_next(airport, now, others);
+        for (int k = 0; k < n; ++k) {
+            if (others[k] == aircraft) {
+                granted = &sim->runways[flight.runway];
+            } else {
+                others[num_others++] = others[k];
+            }
+        }
+    } else {
+        RunwayRequest req;
+        req.priority = get_priority(flight.type);
+        req.seq = airport.request_seq++;
+        req.aircraft = aircraft;
+        req.requested_us = now;
+        airport.waiters[c].push_back(req);
+        push_heap(airport.waiters[c].begin(), airport.waiters[c].end(), RequestLater());
+        if (free_runways && !airport.grant_pass_pending) {
+            airport.grant_pass_pending = true;
+            arm_pass = true;
+        }
+    }
+    timed_unlock(&airport.lock, METRIC_AIRPORT_LOCK_HOLD, locked_at);
+
+    if (arm_pass) {
+        schedule_event(aircraft, EV_RUNWAY_GRANT_PASS, 0);
+    }
+    for (int k = 0; k < num_others; ++k) {
+        schedule_event(others[k], EV_RUNWAY_GRANTED, 0);
+    }
+    return granted;
+}
+
+
+void release_runway(Runway* runway, int holder) {
+    Airport& airport = sim->airports[runway->airport];
+    int r = runway->local_index;
+    int next[MAX_AIRPORT_RUNWAYS];
+    int num_next = 0;
+    int pass_for = -1;
+    long long now = sim_now_us();
+
+    long long locked_at = timed_lock(&airport.lock, METRIC_AIRPORT_LOCK_WAIT);
+    runway->busy_us += now - runway->granted_at_us;
+    free_runway_locked(airport, r);
+    if (airport.sequencer) {
+        // Nobody queues there; the plan decides who goes next, on this
+        // runway or any other
+        num_next = sequencer_next(airport, now, next);
+    } else if (!airport.grant_pass_pending) {
+        // Someone waiting can use it: the grant pass at the end of this
+        // instant picks the highest-priority, longest-waiting flight,
+        // counting requests made at this same instant
+        for (int c = 0; c < RUNWAY_CLASSES; ++c) {
+            if ((runway->capabilities & (1 << c)) && !airport.waiters[c].empty()) {
+                pass_for = airport.waiters[c].front().aircraft;
+                airport.grant_pass_pending = true;
+                break;
+            }
+        }
+    }
+    timed_unlock(&airport.lock, METRIC_AIRPORT_LOCK_HOLD, locked_at);
+   
+    log_runway(LOG_RUNWAY_RELEASED, holder, "", airport.first_runway + r);
+    if (pass_for >= 0) {
+        schedule_event(pass_for, EV_RUNWAY_GRANT_PASS, 0);
+    }
+    for (int k = 0; k < num_next; ++k) {
+        schedule_event(next[k], EV_RUNWAY_GRANTED, 0);
+    }
+}
+
+// Runway utilization and grant latency over elapsed_us of simulated time
+void print_runway_report(long long elapsed_us) {
+    FILE* out = sim->console;
+    for (size_t a = 0; a < sim->airports.size(); ++a) {
+        Airport& airport = sim->airports[a];
+        pthread_mutex_lock(&airport.lock);
+        for (int r = 0; r < airport.num_runways; ++r) {
+            const Runway& runway = sim->runways[airport.first_runway + r];
+            long long busy = runway.busy_us;
+            if (runway.in_use) {
+                busy += elapsed_us - runway.granted_at_us; // Still occupied
+            }
+            fprintf(out, "[Runway Report] %s: %d movements, utilization %.1f%%\n",
+                   runway.name, runway.movements,
+                   elapsed_us > 0 ? 100.0 * busy / elapsed_us : 0.0);
+        }
+        size_t waiting = 0;
+        for (int c = 0; c < RUNWAY_CLASSES; ++c) {
+            waiting += airport.waiters[c].size();
+        }
+        for (size_t k = 0; airport.sequencer && k < airport.sequencer->plan.size(); ++k) {
+            waiting += airport.sequencer->plan[k].requested;
+        }
+        const MetricSummary& waits = *airport.wait_hist;
+        const MetricSummary& emergency = *airport.emergency_wait_hist;
+        // The single default airport keeps the original report line
+        string label = sim->airports.size() > 1 ? string(airport.code) + " " : string();
+        fprintf(out, "[Runway Report] %sGrant latency (s): p50 %.3f  p90 %.3f  p99 %.3f  max %.3f  (%zu grants, %zu still waiting)\n",
+               label.c_str(),
+               waits.total ? metric_quantile(waits, 0.50) / 1e6 : 0.0,
+               waits.total ? metric_quantile(waits, 0.90) / 1e6 : 0.0,
+               waits.total ? metric_quantile(waits, 0.99) / 1e6 : 0.0,
+               waits.max / 1e6,
+               (size_t)waits.total, waiting);
+        fprintf(out, "[Runway Report] %sEMERGENCY grant latency (s): p50 %.3f  p99 %.3f  max %.3f  (%zu grants)\n",
+               label.c_str(),
+               emergency.total ? metric_quantile(emergency, 0.50) / 1e6 : 0.0,
+               emergency.total ? metric_quantile(emergency, 0.99) / 1e6 : 0.0,
+               emergency.max / 1e6, (size_t)emergency.total);
+        pthread_mutex_unlock(&airport.lock);
+    }
+    if (sim->sequencing == SEQUENCING_LOOKAHEAD) {
+        MetricSummary* plans = new MetricSummary; // Too big for some stacks
+        metric_merge(METRIC_SEQUENCER_PLAN, plans);
+        fprintf(out, "[Runway Report] Look-ahead sequencing: %llu re-plans, p50 %.1f us  p99 %.1f us  max %.1f us\n",
+               (unsigned long long)plans->total, metric_quantile(*plans, 0.50) / 1e3,
+               metric_quantile(*plans, 0.99) / 1e3, plans->max / 1e3);
+        delete plans;
+        long long dropped = 0;
+        for (size_t a = 0; a < sim->airports.size(); ++a) {
+            pthread_mutex_lock(&sim->airports[a].lock);
+            dropped += sim->airports[a].sequencer->dropped;
+            pthread_mutex_unlock(&sim->airports[a].lock);
+        }
+        if (dropped) {
+            fprintf(out, "[Runway Report] Look-ahead horizon full (%d flights): %lld announcements dropped, planned once they asked\n",
+                   SEQUENCER_RESERVE, dropped);
+        }
+    }
+    fflush(out); // Don't let a later fork() duplicate buffered output
+}
+
+// ========================== RUNWAY SEQUENCER ================================
+
+/*
+--sequencing lookahead. Each airport keeps a rolling horizon of the
+landings and takeoffs it is about to serve: a flight joins when it enters
+HOLDING or GATE, with the time it will reach the runway (phases have a
+fixed length, so that time is known), and leaves when it is granted one.
+Every change re-plans the horizon under the airport lock:
+  - the plan is a sequence, and list scheduling turns it into slots: each
+    flight in turn takes the runway it can be off soonest, ties going to
+    the runway that serves the fewest classes so flexible ones stay free
+  - the cost is the summed delay, an emergency's delay counting
+    SEQUENCER_EMERGENCY_WEIGHT times
+  - the search starts from the cheaper of the previous plan and the
+    greedy queue's order (emergencies first, then by ETA), and adjacent
+    swaps only ever lower the cost, so a plan never costs more than
+    serving the same flights greedily would
+  - a flight joining costs a pass or two over at most SEQUENCER_WINDOW
+    leading entries
+Waiting flights are then granted in sequence order: their planned runway
+if their slot has started, otherwise the least flexible free runway they
+can use. A runway never idles while someone waits for it, with one
+exception: an EMERGENCY planned on it within SEQUENCER_HOLD_US keeps it
+if handing it out now would delay the emergency, weighted, by more than
+the waiting flight saves.
+*/
+
+const int SEQUENCER_WINDOW = 32;    // Leading plan entries the swap search reorders
+const int SEQUENCER_PASSES = 4;     // Swap passes per re-plan, at most
+const int SEQUENCER_EMERGENCY_WEIGHT = 4;      // An emergency's delay against anyone else's
+const long long SEQUENCER_HOLD_US = 500000;    // Longest a runway idles for a due emergency
+
+void sequencer_init(Airport& airport) {
+    airport.sequencer = new RunwaySequencer(); // Zeroed
+    RunwaySequencer& seq = *airport.sequencer;
+    seq.plan.reserve(SEQUENCER_RESERVE);
+    seq.kept.reserve(SEQUENCER_WINDOW);
+    for (int r = 0; r < airport.num_runways; ++r) {
+        unsigned char capabilities = sim->runways[airport.first_runway + r].capabilities;
+        for (int c = 0; c < RUNWAY_CLASSES; ++c) {
+            if (capabilities & (1 << c)) {
+                seq.serves[c] |= 1ULL << r;
+            }
+        }
+    }
+}
+
+// List-schedules the first count demands of the plan in its current
+// order, filling in their runways and start times. Returns the weighted
+// total delay.
+long long sequencer_schedule(Airport& airport, long long now, size_t count) {
+    RunwaySequencer& seq = *airport.sequencer;
+    for (int r = 0; r < airport.num_runways; ++r) {
+        const Runway& runway = sim->runways[airport.first_runway + r];
+        seq.free_at[r] = runway.in_use ? max(now, runway.granted_at_us + runway.occupancy_us) : now;
+    }
+    long long cost = 0;
+    for (size_t k = 0; k < count; ++k) {
+        RunwayDemand& d = seq.plan[k];
+        d.runway = -1;
+        long long best_end = LLONG_MAX;
+        int best_flex = 0;
+        for (uint64_t bits = seq.serves[d.runway_class]; bits; bits &= bits - 1) {
+            int r = __builtin_ctzll(bits);
+            const Runway& runway = sim->runways[airport.first_runway + r];
+            long long end = max(seq.free_at[r], d.eta_us) + runway.occupancy_us;
+            int flex = __builtin_popcount(runway.capabilities);
+            if (end < best_end || (end == best_end && flex < best_flex)) {
+                d.runway = r;
+                best_end = end;
+                best_flex = flex;
+            }
+        }
+        if (d.runway < 0) {
+            continue; // assign_airport() never sends one here
+        }
+        d.start_us = best_end - sim->runways[airport.first_runway + d.runway].occupancy_us;
+        seq.free_at[d.runway] = best_end;
+        cost += (d.start_us - d.eta_us) * (d.emergency ? SEQUENCER_EMERGENCY_WEIGHT : 1);
+    }
+    // Everyone behind waits, on average, for the runway time left to them
+    if (count < seq.plan.size() && airport.num_runways > 0) {
+        long long backlog = 0;
+        for (int r = 0; r < airport.num_runways; ++r) {
+            backlog += seq.free_at[r] - now;
+        }
+        cost += (long long)(seq.plan.size() - count) * backlog / airport.num_runways;
+    }
+    return cost;
+}
+
+// The order the greedy queue serves in: emergencies first, then by ETA
+bool sequencer_greedy_before(const RunwayDemand& a, const RunwayDemand& b) {
+    if (a.emergency != b.emergency) return a.emergency;
+    return a.eta_us < b.eta_us;
+}
+
+// Swap search over the leading window, which is all that is judged: the
+// flights behind it are planned in order after it
+void sequencer_replan(Airport& airport, long long now) {
+    long long t0 = monotonic_ns();
+    RunwaySequencer& seq = *airport.sequencer;
+    vector<RunwayDemand>& plan = seq.plan;
+    size_t window = min(plan.size(), (size_t)SEQUENCER_WINDOW);
+    long long best = sequencer_schedule(airport, now, window);
+
+    // Try the greedy order too and start from whichever is cheaper.
+    // Insertion sort: the window is short, mostly sorted, and this must
+    // not allocate.
+    seq.kept.assign(plan.begin(), plan.begin() + window);
+    for (size_t k = 1; k < window; ++k) {
+        for (size_t j = k; j > 0 && sequencer_greedy_before(plan[j], plan[j - 1]); --j) {
+            swap(plan[j], plan[j - 1]);
+        }
+    }
+    long long greedy = sequencer_schedule(airport, now, window);
+    if (greedy <= best) {
+        best = greedy;
+    } else {
+        copy(seq.kept.begin(), seq.kept.end(), plan.begin());
+    }
+
+    for (int pass = 0; pass < SEQUENCER_PASSES; ++pass) {
+        bool improved = false;
+        for (size_t k = 0; k + 1 < window; ++k) {
+            if (plan[k].runway_class == plan[k + 1].runway_class && plan[k].eta_us == plan[k + 1].eta_us) {
+                continue; // Interchangeable
+            }
+            swap(plan[k], plan[k + 1]);
+            long long cost = sequencer_schedule(airport, now, window);
+            if (cost < best) {
+                best = cost;
+                improved = true;
+            } else {
+                swap(plan[k], plan[k + 1]);
+            }
+        }
+        if (!improved) {
+            break;
+        }
+    }
+    sequencer_schedule(airport, now, plan.size());
+    metric_record(METRIC_SEQUENCER_PLAN, monotonic_ns() - t0);
+}
+
+// Index of the aircraft's entry in the horizon, -1 if it has none
+int sequencer_find(const RunwaySequencer& seq, int aircraft) {
+    for (size_t k = 0; k < seq.plan.size(); ++k) {
+        if (seq.plan[k].aircraft == aircraft) {
+            return (int)k;
+        }
+    }
+    return -1;
+}
+
+// The aircraft's entry in the horizon. A new one goes in ETA order, an
+// EMERGENCY ahead of all other traffic; eta_us moves an existing one only
+// in time, and the next re-plan moves it in the sequence.
+RunwayDemand* sequencer_demand(Airport& airport, int aircraft, long long eta_us) {
+    vector<RunwayDemand>& plan = airport.sequencer->plan;
+    int found = sequencer_find(*airport.sequencer, aircraft);
+    if (found >= 0) {
+        plan[found].eta_us = eta_us;
+        return &plan[found];
+    }
+    const Aircraft& flight = fleet_aircraft(aircraft);
+    RunwayDemand d;
+    d.aircraft = aircraft;
+    d.runway_class = (unsigned char)runway_class(flight.direction, flight.type);
+    d.emergency = flight.type == EMERGENCY;
+    d.requested = false;
+    d.eta_us = eta_us;
+    d.runway = -1;
+    d.start_us = eta_us;
+    size_t k = plan.size();
+    while (k > 0) {
+        const RunwayDemand& prev = plan[k - 1];
+        bool goes_first = d.emergency ? (!prev.emergency || prev.eta_us > eta_us)
+                                      : (!prev.emergency && prev.eta_us > eta_us);
+        if (!goes_first) {
+            break;
+        }
+        --k;
+    }
+    return &*plan.insert(plan.begin() + k, d);
+}
+
+// Re-plans, then grants runways to waiting flights in sequence order.
+// Caller holds the airport lock and sends the grants, which are left in
+// granted[] (at most one per runway); returns their count.
+int sequencer_next(Airport& airport, long long now, int* granted) {
+    sequencer_replan(airport, now);
+    vector<RunwayDemand>& plan = airport.sequencer->plan;
+
+    // Runways an EMERGENCY is due on within SEQUENCER_HOLD_US, and when
+    uint64_t held = 0;
+    long long held_for[MAX_AIRPORT_RUNWAYS];
+    for (size_t k = 0; k < plan.size(); ++k) {
+        const RunwayDemand& d = plan[k];
+        if (d.emergency && !d.requested && d.runway >= 0 && d.start_us - now <= SEQUENCER_HOLD_US &&
+            !(held & (1ULL << d.runway))) {
+            held |= 1ULL << d.runway;
+            held_for[d.runway] = d.start_us;
+        }
+    }
+
+    int n = 0;
+    for (size_t k = 0; k < plan.size(); ) {
+        const RunwayDemand& d = plan[k];
+        int r = -1;
+        if (d.requested) {
+            if (d.runway >= 0 && d.start_us <= now && !sim->runways[airport.first_runway + d.runway].in_use) {
+                r = d.runway; // Its slot
+            } else {
+                // The plan has it wait, but never while a runway it can use
+                // idles, unless taking it would delay a due emergency by
+                // more (weighted) than this flight saves
+                int best_flex = 0;
+                for (uint64_t bits = airport.free_by_class[d.runway_class]; bits; bits &= bits - 1) {
+                    int f = __builtin_ctzll(bits);
+                    const Runway& runway = sim->runways[airport.first_runway + f];
+                    if ((held & (1ULL << f)) &&
+                        (now + runway.occupancy_us - held_for[f]) * SEQUENCER_EMERGENCY_WEIGHT > d.start_us - now) {
+                        continue;
+                    }
+                    int flex = __builtin_popcount(runway.capabilities);
+                    if (r < 0 || flex < best_flex) {
+                        r = f;
+                        best_flex = flex;
+                    }
+                }
+            }
+        }
+        if (r >= 0) {
+            grant_runway_locked(airport, r, d.aircraft, d.eta_us, now);
+            fleet_aircraft(d.aircraft).runway = airport.first_runway + r;
+            granted[n++] = d.aircraft;
+            plan.erase(plan.begin() + k);
+        } else {
+            ++k;
+        }
+    }
+    return n;
+}
+
+// A flight still short of its runway phase will get there at eta_us.
+// A full horizon turns new flights away (counted in dropped); they are
+// planned once they ask for the runway.
+void sequencer_announce(int aircraft, long long eta_us) {
+    Airport& airport = sim->airports[fleet_aircraft(aircraft).airport];
+    RunwaySequencer& seq = *airport.sequencer;
+    int granted[MAX_AIRPORT_RUNWAYS];
+    int n = 0;
+    long long locked_at = timed_lock(&airport.lock, METRIC_AIRPORT_LOCK_WAIT);
+    if (seq.plan.size() < SEQUENCER_RESERVE || sequencer_find(seq, aircraft) >= 0) {
+        sequencer_demand(airport, aircraft, eta_us);
+        n = sequencer_next(airport, sim_now_us(), granted);
+    } else {
+        seq.dropped++;
+    }
+    timed_unlock(&airport.lock, METRIC_AIRPORT_LOCK_HOLD, locked_at);
+    for (int k = 0; k < n; ++k) {
+        schedule_event(granted[k], EV_RUNWAY_GRANTED, 0);
+    }
+}
+
+// ========================== SCENARIO SOURCES ================================
+
+/*
+Flights come from a ScenarioSource that hands them out one at a time in
+start-time order:
+  - BUILTIN   the original six flights, repeated with generated numbers
+              up to --flights, all starting at once
+  - CSV       --scenario file: flight,type,direction,start_seconds[,airport]
+  - BINARY    --scenario file starting with SCENARIO_MAGIC: 16-byte records
+  - GENERATOR --generate RATE: Poisson arrivals per aircraft type at RATE
+              flights/minute in total, split by --mix weights
+Nothing is loaded up front. A recurring EV_INGEST event adds the flights
+due within the next INGEST_HORIZON_US to the fleet and schedules their
+first phase, so a million-flight day only holds the flights near "now".
+*/
+
+uint64_t scenario_random(ScenarioSource* src) {
+    return splitmix64(&src->rng);
+}
+
+// Uniform in [0, 1)
+double scenario_uniform(ScenarioSource* src) {
+    return (scenario_random(src) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Exponential gap between Poisson arrivals at the given rate
+long long scenario_gap_us(ScenarioSource* src, double rate_per_us) {
+    return (long long)(-log(1.0 - scenario_uniform(src)) / rate_per_us) + 1;
+}
+
+void scenario_builtin(ScenarioSource* src, long long count) {
+    memset(src, 0, sizeof(*src));
+    src->kind = SCENARIO_BUILTIN;
+    src->limit = count;
+}
+
+// mix holds relative weights for COMMERCIAL, CARGO, EMERGENCY
+void scenario_generator(ScenarioSource* src, double flights_per_minute, const double mix[3],
+                        uint64_t seed, long long limit) {
+    memset(src, 0, sizeof(*src));
+    src->kind = SCENARIO_GENERATOR;
+    src->limit = limit;
+    src->rng = seed;
+    double total = mix[0] + mix[1] + mix[2];
+    for (int t = 0; t < 3; ++t) {
+        src->rate_per_us[t] = flights_per_minute * (mix[t] / total) / 60e6;
+        src->next_arrival_us[t] = src->rate_per_us[t] > 0 ? scenario_gap_us(src, src->rate_per_us[t]) : LLONG_MAX;
+    }
+}
+
+// Opens a CSV or binary scenario, telling them apart by the magic
+bool scenario_open(ScenarioSource* src, const char* path) {
+    memset(src, 0, sizeof(*src));
+    src->limit = -1;
+    src->file = fopen(path, "rb");
+    if (!src->file) {
+        perror(path);
+        return false;
+    }
+    char magic[sizeof(SCENARIO_MAGIC)];
+    bool read_magic = fread(magic, 1, sizeof(magic), src->file) == sizeof(magic);
+    if (read_magic && memcmp(magic, SCENARIO_MAGIC, sizeof(magic)) == 0) {
+        src->kind = SCENARIO_BINARY;
+        src->record_bytes = sizeof(ScenarioRecord);
+    } else if (read_magic && memcmp(magic, SCENARIO_MAGIC_V1, sizeof(magic)) == 0) {
+        src->kind = SCENARIO_BINARY;
+        src->record_bytes = SCENARIO_RECORD_V1_BYTES;
+    } else {
+        src->kind = SCENARIO_CSV;
+        rewind(src->file);
+    }
+    return true;
+}
+
+void scenario_close(ScenarioSource* src) {
+    if (src->file) {
+        fclose(src->file);
+        src->file = NULL;
+    }
+}
+
+// Next CSV flight; blank lines, '#' comments and a header line are skipped,
+// malformed lines are reported and skipped
+bool scenario_read_csv(ScenarioSource* src, ScenarioFlight* flight) {
+    char line[256];
+    while (fgets(line, sizeof(line), src->file)) {
+        src->line++;
+        char* save = NULL;
+        char* number = strtok_r(line, ", \t\r\n", &save);
+        if (!number || number[0] == '#') {
+            continue;
+        }
+        char* type = strtok_r(NULL, ", \t\r\n", &save);
+        char* direction = strtok_r(NULL, ", \t\r\n", &save);
+        char* start = strtok_r(NULL, ", \t\r\n", &save);
+        char* airport = strtok_r(NULL, ", \t\r\n", &save); // Optional
+        if (!type || !direction || !start ||
+            !parse_aircraft_type(type, &flight->type) || !parse_direction(direction, &flight->direction)) {
+            if (src->line > 1) {
+                fprintf(stderr, "scenario line %lld: expected flight,type,direction,start_s\n", src->line);
+            }
+            continue;
+        }
+        memset(flight->flight_number, 0, sizeof(flight->flight_number));
+        strncpy(flight->flight_number, number, sizeof(flight->flight_number) - 1);
+        flight->start_us = (long long)(atof(start) * 1e6);
+        flight->airport = airport ? airport_index(airport) : -1;
+        if (airport && flight->airport < 0) {
+            fprintf(stderr, "scenario line %lld: unknown airport %s, assigning one\n", src->line, airport);
+        }
+        return true;
+    }
+    return false;
+}
+
+bool scenario_read_binary(ScenarioSource* src, ScenarioFlight* flight) {
+    ScenarioRecord record;
+    record.airport = SCENARIO_ANY_AIRPORT;
+    if (fread(&record, src->record_bytes, 1, src->file) != 1) {
+        return false;
+    }
+    memcpy(flight->flight_number, record.flight_number, sizeof(flight->flight_number));
+    flight->flight_number[sizeof(flight->flight_number) - 1] = '\0';
+    flight->type = (AircraftType)min<int>(record.type, EMERGENCY);
+    flight->direction = record.direction ? DEPARTURE : ARRIVAL;
+    flight->start_us = record.start_ms * 1000LL;
+    flight->airport = record.airport == SCENARIO_ANY_AIRPORT ? -1 : record.airport;
+    return true;
+}
+
+bool scenario_read_generator(ScenarioSource* src, ScenarioFlight* flight) {
+    // Merge the three per-type Poisson streams by earliest arrival
+    static const char* airlines[3][2] = { {"PK", "ED"}, {"FX", "BD"}, {"AF", "AK"} };
+    int t = 0;
+    for (int k = 1; k < 3; ++k) {
+        if (src->next_arrival_us[k] < src->next_arrival_us[t]) {
+            t = k;
+        }
+    }
+    if (src->next_arrival_us[t] == LLONG_MAX) {
+        return false;
+    }
+    flight->type = (AircraftType)t;
+    flight->direction = (scenario_random(src) & 1) ? DEPARTURE : ARRIVAL;
+    flight->start_us = src->next_arrival_us[t];
+    flight->airport = -1; // Spread round-robin at ingestion
+    snprintf(flight->flight_number, sizeof(flight->flight_number), "%.2s%llu",
+             airlines[t][src->emitted & 1], (unsigned long long)src->emitted % 10000000);
+    src->next_arrival_us[t] += scenario_gap_us(src, src->rate_per_us[t]);
+    return true;
+}
+
+bool scenario_read_builtin(ScenarioSource* src, ScenarioFlight* flight) {
+    static const char* flight_ids[NUM_AIRCRAFTS] = { "PK303", "FX101", "ED220", "AF001", "BD321", "AK911" };
+    static const AircraftType types[NUM_AIRCRAFTS] = { COMMERCIAL, CARGO, COMMERCIAL, EMERGENCY, CARGO, EMERGENCY };
+    static const FlightType directions[NUM_AIRCRAFTS] = { ARRIVAL, ARRIVAL, DEPARTURE, DEPARTURE, ARRIVAL, DEPARTURE };
+
+    // Beyond the six named flights the same airlines, types and
+    // directions repeat with generated flight numbers
+    long long i = src->emitted;
+    int k = i % NUM_AIRCRAFTS;
+    if (i < NUM_AIRCRAFTS) {
+        snprintf(flight->flight_number, sizeof(flight->flight_number), "%s", flight_ids[k]);
+    } else {
+        snprintf(flight->flight_number, sizeof(flight->flight_number), "%.2s%llu", flight_ids[k], (unsigned long long)i % 10000000);
+    }
+    flight->type = types[k];
+    flight->direction = directions[k];
+    flight->start_us = 0;
+    flight->airport = -1;
+    return true;
+}
+
+// Next flight in start-time order, or false when the source is exhausted
+bool scenario_read(ScenarioSource* src, ScenarioFlight* flight) {
+    if (src->limit >= 0 && src->emitted >= src->limit) {
+        return false;
+    }
+    bool ok = false;
+    switch (src->kind) {
+    case SCENARIO_BUILTIN:   ok = scenario_read_builtin(src, flight); break;
+    case SCENARIO_CSV:       ok = scenario_read_csv(src, flight); break;
+    case SCENARIO_BINARY:    ok = scenario_read_binary(src, flight); break;
+    case SCENARIO_GENERATOR: ok = scenario_read_generator(src, flight); break;
+    }
+    if (!ok) {
+        return false;
+    }
+    if (flight->start_us < src->last_start_us) {
+        // Ingestion streams in order, so a late entry starts with its predecessor
+        if (!src->warned_order) {
+            fprintf(stderr, "scenario: %s is out of start-time order, starting it at %.3f s\n",
+                    flight->flight_number, src->last_start_us / 1e6);
+            src->warned_order = true;
+        }
+        flight->start_us = src->last_start_us;
+    }
+    src->last_start_us = flight->start_us;
+    src->emitted++;
+    return true;
+}
+
+// --write-scenario: drain any source into the compact binary format
+int scenario_write_binary(ScenarioSource* src, const char* path) {
+    FILE* out = fopen(path, "wb");
+    if (!out) {
+        perror(path);
+        return 1;
+    }
+    fwrite(SCENARIO_MAGIC, 1, sizeof(SCENARIO_MAGIC), out);
+    ScenarioFlight flight;
+    long long written = 0;
+    while (scenario_read(src, &flight)) {
+        if (src->kind == SCENARIO_GENERATOR && flight.start_us >= sim->sim_end_us) {
+            break; // An unbounded generator stops at the simulation end
+        }
+        ScenarioRecord record;
+        memcpy(record.flight_number, flight.flight_number, sizeof(record.flight_number));
+        record.type = flight.type;
+        record.direction = flight.direction;
+        record.start_ms = (uint32_t)(flight.start_us / 1000);
+        record.airport = flight.airport < 0 ? SCENARIO_ANY_AIRPORT : (unsigned char)flight.airport;
+        memset(record.reserved, 0, sizeof(record.reserved));
+        fwrite(&record, sizeof(record), 1, out);
+        written++;
+    }
+    fclose(out);
+    printf("[Scenario] wrote %lld flights to %s\n", written, path);
+    return 0;
+}
+
+// Runs as EV_INGEST (and once from atc_begin at t=0); only one is ever pending.
+// Adds every flight starting within the horizon and schedules its first
+// phase, then sleeps until the next flight comes within the horizon.
+void ingest_flights() {
+    long long now = sim_now_us();
+    while (sim->scenario.has_next && sim->simulation_running) {
+        const ScenarioFlight& flight = sim->scenario.next;
+        if (flight.start_us >= sim->sim_end_us) {
+            sim->scenario.has_next = false; // Would never get to fly
+            break;
+        }
+        if (flight.start_us > now + INGEST_HORIZON_US) {
+            break;
+        }
+        int airport = assign_airport(flight.airport, flight.direction, flight.type);
+        if (airport < 0) {
+            log_simple(LOG_WARN, LOG_FLIGHT_DROPPED, flight.flight_number);
+            sim->scenario.has_next = scenario_read(&sim->scenario, &sim->scenario.next);
+            continue;
+        }
+        int i = fleet_add(flight.flight_number, flight.type, flight.direction, airport);
+        if (i < 0) {
+            log_simple(LOG_WARN, LOG_FLEET_FULL, "");
+            sim->scenario.has_next = false;
+            break;
+        }
+        sim->active_flights++;
+        schedule_event(i, EV_PHASE_START, max(0LL, flight.start_us - now));
+        sim->scenario.has_next = scenario_read(&sim->scenario, &sim->scenario.next);
+    }
+
+    if (sim->scenario.has_next && sim->simulation_running) {
+        schedule_event(-1, EV_INGEST, max(0LL, sim->scenario.next.start_us - INGEST_HORIZON_US - now));
+    } else {
+        scenario_close(&sim->scenario);
+        sim->scenario_drained = true;
+    }
+}
+
+// ========================== WORLD SNAPSHOTS =================================
+
+/*
+The renderer never reads simulation state directly. A recurring EV_SNAPSHOT
+event copies the fleet (through the seqlocks) and runway flags into a
+WorldSnapshot. It publishes the copy through a lock-free triple buffer:
+the producer fills its back buffer and swaps it with the shared middle
+slot, and the renderer swaps the middle into its front buffer only when a
+fresh one is there. Neither side ever waits for the other, and the frame
+rate is independent of the simulation.
+*/
+
+void snapshots_init() {
+    sim->snapshots.back = 0;
+    sim->snapshots.middle = 1;
+    sim->snapshots.front = 2;
+}
+
+// Runs as EV_SNAPSHOT; only one is ever pending, so there is one producer
+void publish_snapshot() {
+    WorldSnapshot& snap = sim->snapshots.buffers[sim->snapshots.back];
+    snap.sim_time_us = sim_now_us();
+    int count = fleet_size();
+    snap.aircraft.resize(count);
+    for (int i = 0; i < count; ++i) {
+        FlightView view = fleet_read(i);
+        SnapshotAircraft& a = snap.aircraft[i];
+        a.phase = view.phase;
+        a.type = fleet_aircraft(i).type;
+        a.direction = fleet_aircraft(i).direction;
+        a.active = view.active;
+        a.x = view.x;
+        a.y = view.y;
+    }
+    snap.runway_in_use.resize(sim->runways.size());
+    for (size_t a = 0; a < sim->airports.size(); ++a) {
+        Airport& airport = sim->airports[a];
+        pthread_mutex_lock(&airport.lock);
+        for (int r = 0; r < airport.num_runways; ++r) {
+            snap.runway_in_use[airport.first_runway + r] = sim->runways[airport.first_runway + r].in_use;
+        }
+        pthread_mutex_unlock(&airport.lock);
+    }
+
+    int previous = sim->snapshots.middle.exchange(sim->snapshots.back | SNAPSHOT_FRESH, memory_order_acq_rel);
+    sim->snapshots.back = previous & ~SNAPSHOT_FRESH;
+
+    if (sim->simulation_running) {
+        schedule_event(-1, EV_SNAPSHOT, sim->snapshot_period_us);
+    }
+}
+
+// Renderer side: newest published snapshot (or the last one again)
+const WorldSnapshot& snapshot_latest() {
+    if (sim->snapshots.middle.load(memory_order_relaxed) & SNAPSHOT_FRESH) {
+        int previous = sim->snapshots.middle.exchange(sim->snapshots.front, memory_order_acq_rel);
+        sim->snapshots.front = previous & ~SNAPSHOT_FRESH;
+    }
+    return sim->snapshots.buffers[sim->snapshots.front];
+}
+
+// ========================== VIOLATION MONITOR ===============================
+
+/*
+Speed and phase only change when flight_simulation starts a phase, so the
+speed check runs on those changes instead of on the whole fleet. The
+writer marks the flight in a two-level dirty set (a bit per slot, a bit per
+chunk) once its new state is published, and the first mark since the last
+drain queues an EV_VIOLATION_CHECK at the current time. The check drains
+the set in index order, so AVNs come out the same for any worker count,
+and confirms each flight on a consistent copy. Its cost follows the number
+of changes, not the fleet size, and a violation is caught the moment it
+happens, even one corrected before the next radar sweep.
+*/
+
+// AVN reasons by Phase, spelled out once so a check never builds a string
+const char* const SPEED_VIOLATION_REASONS[] = {
+    "Speed violation in phase Holding", "Speed violation in phase Approach",
+    "Speed violation in phase Landing", "Speed violation in phase Taxi",
+    "Speed violation in phase Gate", "Speed violation in phase Takeoff",
+    "Speed violation in phase Climb", "Speed violation in phase Cruise"
+};
+
+// Adds aircraft i to the dirty set; after fleet_write_end
+void violation_mark_dirty(int i) {
+    int s = fleet_slot(i);
+    int c = i >> FLEET_CHUNK_BITS;
+    fleet_chunk(i)->speed_dirty[s >> 6].fetch_or(1ULL << (s & 63), memory_order_release);
+    sim->speed_dirty.chunks[c >> 6].fetch_or(1ULL << (c & 63), memory_order_release);
+}
+
+// Marks aircraft i and makes sure a check is queued
+void violation_mark(int i) {
+    violation_mark_dirty(i);
+    if (!sim->speed_dirty.check_pending.exchange(true, memory_order_acq_rel)) {
+        sim->speed_dirty.marked_ns.store(monotonic_ns(), memory_order_relaxed);
+        schedule_event(-1, EV_VIOLATION_CHECK, 0);
+    }
+}
+
+// Runs as EV_VIOLATION_CHECK. Marks made while it runs queue the next one.
+void violation_check() {
+    DirtySet& dirty = sim->speed_dirty;
+    long long marked = dirty.marked_ns.load(memory_order_relaxed);
+    bool queued = dirty.check_pending.exchange(false, memory_order_seq_cst);
+    long long checked = 0;
+    for (int w = 0; w < FLEET_MAX_CHUNKS / 64; ++w) {
+        if (!dirty.chunks[w].load(memory_order_relaxed)) {
+            continue;
+        }
+        for (uint64_t chunks = dirty.chunks[w].exchange(0, memory_order_acquire); chunks; chunks &= chunks - 1) {
+            int c = w * 64 + __builtin_ctzll(chunks);
+            FleetChunk* chunk = sim->fleet.chunks[c];
+            for (int k = 0; k < FLEET_CHUNK / 64; ++k) {
+                if (!chunk->speed_dirty[k].load(memory_order_relaxed)) {
+                    continue;
+                }
+                for (uint64_t bits = chunk->speed_dirty[k].exchange(0, memory_order_acquire); bits; bits &= bits - 1) {
+                    int s = k * 64 + __builtin_ctzll(bits);
+                    int i = (c << FLEET_CHUNK_BITS) + s;
+                    checked++;
+                    if (chunk->avn_issued[s].load(memory_order_relaxed)) {
+                        continue;
+                    }
+                    FlightView view = fleet_read(i); // Lock-free snapshot
+                    if (view.active && speed_violates(chunk->direction[s], view.phase, view.speed)) {
+                        issue_avn(i, view.phase, view.speed, SPEED_VIOLATION_REASONS[view.phase]);
+                    }
+                }
+            }
+        }
+    }
+    dirty.checks++;
+    dirty.checked += checked;
+    if (queued) {
+        metric_record(METRIC_VIOLATION_DETECT, monotonic_ns() - marked);
+    }
+}
+
+// ========================== THREAD FUNCTIONS ================================
+
+/*
+flight_simulation is the event handler for every aircraft. It walks the
+correct sequence of phases based on arrival or departure type, then simulates
+speed in each phase. Speeds are randomized within acceptable ranges,
+but may occasionally violate rules, allowing radar to trigger AVNs.
+*/
+
+void flight_simulation(const SimEvent& ev) {
+    Aircraft* aircraft = &fleet_aircraft(ev.aircraft);
+    FleetChunk* chunk = fleet_chunk(ev.aircraft);
+    int slot = fleet_slot(ev.aircraft);
+    const Phase* phases = (aircraft->direction == ARRIVAL) ? ARRIVAL_PHASES : DEPARTURE_PHASES;
+    int i = aircraft->phase_index;
+
+    if (!sim->simulation_running) {
+        return;
+    }
+
+    switch (ev.type) {
+    case EV_PHASE_START: {
+
+        // Calculate speed limits based on phase
+        int min_speed, max_speed;
+        if (aircraft->direction == ARRIVAL) {
+            min_speed = ARRIVAL_SPEED_LIMITS[i][0];
+            max_speed = ARRIVAL_SPEED_LIMITS[i][1];
+        } else {
+            min_speed = DEPARTURE_SPEED_LIMITS[i][0];
+            max_speed = DEPARTURE_SPEED_LIMITS[i][1];
+        }
+
+        // Randomized speed within phase range, adding some randomness
+        int speed = min_speed + (int)(splitmix64(&aircraft->rng) % (max_speed - min_speed + 20));
+
+        Phase next = phases[min(i + 1, NUM_PHASES - 1)];
+        fleet_write_begin(ev.aircraft);
+        chunk->phase[slot] = phases[i];
+        chunk->speed[slot] = speed;
+        fleet_set_motion(ev.aircraft, *aircraft, phases[i], next, speed, sim_now_us());
+        fleet_write_end(ev.aircraft);
+        violation_mark(ev.aircraft); // Checked as soon as the monitor runs
+
+        log_phase(ev.aircraft, *aircraft, phases[i], speed);
+
+        // A sequenced airport plans ahead for flights on their way to the runway
+        if (sim->airports[aircraft->airport].sequencer) {
+            Phase runway_phase = (aircraft->direction == ARRIVAL) ? LANDING : TAKEOFF;
+            for (int k = i + 1; k < NUM_PHASES; ++k) {
+                if (phases[k] == runway_phase) {
+                    sequencer_announce(ev.aircraft, sim_now_us() + (k - i) * PHASE_DURATION_S * 1000000LL);
+                }
+            }
+        }
+
+        // If phase needs runway, request runway
+        bool needs_runway = (aircraft->direction == ARRIVAL && phases[i] == LANDING) ||
+                            (aircraft->direction == DEPARTURE && phases[i] == TAKEOFF);
+
+        if (needs_runway) {
+            schedule_event(ev.aircraft, EV_RUNWAY_REQUEST, 0); // [MODULE 2]
+        } else {
+            schedule_event(ev.aircraft, EV_PHASE_END, PHASE_DURATION_S * 1000000LL); // Simulate phase time
+        }
+        break;
+    }
+
+    case EV_RUNWAY_REQUEST: {
+        Runway* assigned_runway = request_runway(ev.aircraft); // [MODULE 2]
+        if (!assigned_runway) {
+            break; // Queued; a grant pass or release_runway() sends EV_RUNWAY_GRANTED
+        }
+        aircraft->runway = assigned_runway - &sim->runways[0];
+    }
+    // fall through
+    case EV_RUNWAY_GRANTED:
+        log_runway(LOG_RUNWAY_ASSIGNED, ev.aircraft, aircraft->flight_number, aircraft->runway);
+        schedule_event(ev.aircraft, EV_PHASE_END, sim->runways[aircraft->runway].occupancy_us); // Simulate takeoff/landing
+        break;
+
+    case EV_RUNWAY_GRANT_PASS:
+        runway_grant_pass(ev);
+        break;
+
+    case EV_PHASE_END: {
+        if (aircraft->runway >= 0) {
+            release_runway(&sim->runways[aircraft->runway], ev.aircraft);
+            aircraft->runway = -1;
+        }
+
+        // Positions follow from the motion set at phase start; only the
+        // end of the last phase changes anything here
+        if (i + 1 >= NUM_PHASES) {
+            fleet_write_begin(ev.aircraft);
+            chunk->active[slot] = 0;
+            fleet_write_end(ev.aircraft);
+            fleet_retire(ev.aircraft);
+            sim->active_flights--;
+        }
+
+        if (i + 1 < NUM_PHASES) {
+            aircraft->phase_index = i + 1;
+            schedule_event(ev.aircraft, EV_PHASE_START, 0);
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+/*
+Radar sweep, run as a recurring EV_RADAR_SWEEP event every 0.5s of
+simulated time (--radar-hz). Positions change continuously, so it checks
+each aircraft for separation from the aircraft around it; speeds only
+change when a phase starts, and the violation monitor checks those as
+they happen. If aircraft are too close, it triggers an AVN. Aircrafts are
+only issued a violation once.
+*/
+
+// Scan scratch for count aircraft, rounded up to whole tick blocks so
+// every radar_scan_block runs the same number of iterations
+void radar_scratch_resize(int count) {
+    int padded = (count + TICK_GRAIN - 1) / TICK_GRAIN * TICK_GRAIN;
+    if ((int)sim->radar_airborne.size() < padded) {
+        sim->radar_airborne.resize(padded);
+        sim->radar_x.resize(padded);
+        sim->radar_y.resize(padded);
+        sim->radar_alt.resize(padded);
+    }
+}
+
+// One tick block of the scan: fleet_position() and separation_phase()
+// written out with no branches and a constant trip count over restrict
+// parameters (GCC ignores restrict on locals), which is what it needs at
+// -O2 to vectorize the loop
+void radar_scan_positions(long long now, const long long* __restrict t0,
+                          const float* __restrict sx, const float* __restrict sy, const float* __restrict sa,
+                          const float* __restrict vx, const float* __restrict vy, const float* __restrict va,
+                          const unsigned char* __restrict active, const unsigned char* __restrict phase,
+                          float* __restrict out_x, float* __restrict out_y, float* __restrict out_alt,
+                          unsigned char* __restrict airborne) {
+    const long long max_us = PHASE_DURATION_S * 1000000LL;
+    const unsigned sep_mask = (1u << HOLDING) | (1u << APPROACH) | (1u << CLIMB) | (1u << CRUISE);
+    for (int k = 0; k < TICK_GRAIN; ++k) {
+        long long elapsed = min(max(now - t0[k], 0LL), max_us);
+        float dt = elapsed / 1e6f;
+        float alt = max(0.f, sa[k] + va[k] * dt);
+        out_x[k] = sx[k] + vx[k] * dt;
+        out_y[k] = sy[k] + vy[k] * dt;
+        out_alt[k] = alt;
+        airborne[k] = (unsigned char)(alt > GROUND_ALTITUDE_M ? active[k] & (sep_mask >> phase[k]) : 0u);
+    }
+}
+
+// Parallel stage of the sweep: positions for the tick block at begin.
+// Blocks never straddle a chunk (TICK_GRAIN divides FLEET_CHUNK) and each
+// writes only its own scratch entries. The last block runs past the fleet
+// into zeroed chunk slots and padded scratch that nobody reads.
+void radar_scan_block(int begin, int) {
+    AtcState* state = sim; // thread_local: read once, not per aircraft
+    const FleetChunk* chunk = fleet_chunk(begin);
+    int s = fleet_slot(begin);
+    radar_scan_positions(state->radar_scan_now, chunk->motion_t0 + s,
+                         chunk->start_x + s, chunk->start_y + s, chunk->start_alt + s,
+                         chunk->vel_x + s, chunk->vel_y + s, chunk->vel_alt + s,
+                         chunk->active + s, chunk->phase + s,
+                         state->radar_x.data() + begin, state->radar_y.data() + begin,
+                         state->radar_alt.data() + begin, state->radar_airborne.data() + begin);
+}
+
+void radar_monitor() {
+    long long sweep_start = monotonic_ns();
+    int count = fleet_size();
+    sim->radar_scan_now = sim_now_us();
+    radar_scratch_resize(count);
+    tick_parallel_for(count, radar_scan_block);
+    long long scan_ns = monotonic_ns() - sweep_start;
+    separation_sweep();
+
+    long long sweep_ns = monotonic_ns() - sweep_start;
+    sim->radar_sweeps++;
+    sim->radar_scan_ns_total += scan_ns;
+    sim->radar_sweep_ns_total += sweep_ns;
+    sim->radar_sweep_ns_max = max(sim->radar_sweep_ns_max, sweep_ns);
+    metric_record(METRIC_RADAR_SWEEP, sweep_ns);
+
+    // Next sweep (0.5s by default); stop once every flight has finished
+    // and the scenario has nothing left to ingest
+    if (sim->active_flights > 0 || !sim->scenario_drained) {
+        schedule_event(-1, EV_RADAR_SWEEP, sim->radar_period_us);
+    }
+}
+
+// Adds n synthetic flights at airport 0, spread over every phase and
+// partway through it, about a tenth of them speeding. Needs the airports
+// and the fleet initialized; returns how many fit.
+int fleet_fill_synthetic(int n, uint64_t seed) {
+    uint64_t rng = seed;
+    for (int i = 0; i < n; ++i) {
+        char flight_number[10];
+        snprintf(flight_number, sizeof(flight_number), "BN%07d", i % 10000000);
+        FlightType direction = (FlightType)(splitmix64(&rng) % 2);
+        int k = splitmix64(&rng) % NUM_PHASES;
+        const Phase* phases = direction == ARRIVAL ? ARRIVAL_PHASES : DEPARTURE_PHASES;
+        const int* limits = direction == ARRIVAL ? ARRIVAL_SPEED_LIMITS[k] : DEPARTURE_SPEED_LIMITS[k];
+        int idx = fleet_add(flight_number, COMMERCIAL, direction, 0);
+        if (idx < 0) {
+            return i;
+        }
+        const Aircraft& aircraft = fleet_aircraft(idx);
+        FleetChunk* chunk = fleet_chunk(idx);
+        int s = fleet_slot(idx);
+        chunk->phase[s] = phases[k];
+        chunk->speed[s] = limits[0] + splitmix64(&rng) % (limits[1] - limits[0] + 20);
+        fleet_set_motion(idx, aircraft, phases[k], phases[min(k + 1, NUM_PHASES - 1)], chunk->speed[s],
+                         -(long long)(splitmix64(&rng) % (PHASE_DURATION_S * 1000000LL)));
+        violation_mark_dirty(idx); // No check queued; the caller runs violation_check()
+    }
+    return n;
+}
+
+// --bench-tick N: the radar scan over a synthetic fleet of n aircraft
+// with 1, 2, 4, ... tick workers up to the online CPU count. Rows up to 4
+// workers always run, so stealing and its overhead show up even on a
+// small machine; the ones past the CPU count are marked and say nothing
+// about scaling.
+int run_tick_benchmark(int n) {
+    init_speed_limit_table();
+    AtcState* state = atc_state_new(); // A private instance, never run
+    SimScope scope(state);
+    default_airport_config();
+    airports_init();
+    sim_clock_init(CLOCK_MODE_VIRTUAL, 1.0);
+    fleet_init();
+    n = fleet_fill_synthetic(n, 42);
+    radar_scratch_resize(n);
+
+    int cpus = max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    int sweeps = max(5, 50000000 / max(n, 1));
+    double base_ns = 0;
+    printf("[Tick Bench] %d aircraft, %d sweeps per row, %d CPUs\n", n, sweeps, cpus);
+    printf("[Tick Bench] %8s %14s %12s %9s %8s\n", "workers", "updates/s", "us/sweep", "speedup", "steals");
+    int max_workers = max(cpus, 4);
+    for (int workers = 1; ; workers = min(workers * 2, max_workers)) {
+        tick_pool_start(workers);
+        long long t0 = monotonic_ns();
+        for (int it = 0; it < sweeps; ++it) {
+            tick_parallel_for(n, radar_scan_block);
+        }
+        double sweep_ns = (monotonic_ns() - t0) / (double)sweeps;
+        long long steals = sim->tick_pool.steals.load();
+        tick_pool_stop();
+        if (workers == 1) {
+            base_ns = sweep_ns;
+        }
+        printf("[Tick Bench] %8d %14.0f %12.1f %8.2fx %8lld%s\n", workers, n / sweep_ns * 1e9,
+               sweep_ns / 1e3, base_ns / sweep_ns, steals, workers > cpus ? "  (oversubscribed)" : "");
+        if (workers >= max_workers) {
+            break;
+        }
+    }
+    atc_state_delete(state);
+    return 0;
+}
+
+// Controls simulation time: runs as the EV_SIM_END event, scheduled
+// --duration seconds (default 50) after the start
+
+void simulation_timer() {
+        log_simple(LOG_INFO, LOG_SIM_END, "");
+        sim->simulation_running = false; // Mark the simulation as finished
+        scheduler_stop();           // Wake idle workers so they can exit
+}
+
+void dispatch_event(const SimEvent& ev) {
+    switch (ev.type) {
+    case EV_RADAR_SWEEP: radar_monitor(); break;
+    case EV_VIOLATION_CHECK: violation_check(); break;
+    case EV_SNAPSHOT:    publish_snapshot(); break;
+    case EV_INGEST:      ingest_flights(); break;
+    case EV_SIM_END:     simulation_timer(); break;
+    default:             flight_simulation(ev); break;
+    }
+}
+// ========================== EMBEDDING API ===================================
+
+/*
+AtcSimulation wraps one AtcState. Every call makes its state current on the
+calling thread for the duration (SimScope), so the core underneath still
+reads as one simulation per process. The constructor only loads: threads,
+files and the clock start on the first step(), run() or start(), which
+keeps construction fork-safe for the portals.
+*/
+
+void atc_state_delete(AtcState* state) {
+    for (size_t a = 0; a < state->airports.size(); ++a) {
+        delete state->airports[a].wait_hist;
+        delete state->airports[a].emergency_wait_hist;
+        delete state->airports[a].holding_hist;
+        delete state->airports[a].sequencer;
+    }
+    for (int c = 0; c < FLEET_MAX_CHUNKS; ++c) {
+        fleet_chunk_free(state->fleet.chunks[c]);
+    }
+    delete[] state->schedulers;
+    for (MetricShard* shard = state->metric_shards.load(); shard; ) {
+        MetricShard* next = shard->next;
+        delete shard;
+        shard = next;
+    }
+    for (LogRing* ring = state->event_log.rings.load(); ring; ) {
+        LogRing* next = ring->next;
+        delete ring;
+        ring = next;
+    }
+    delete state;
+}
+
+AtcConfig::AtcConfig()
+    : clock_mode(CLOCK_MODE_REALTIME), time_scale(1.0), duration_s(DEFAULT_DURATION_S), seed(1),
+      workers(DEFAULT_WORKERS), tick_workers(min(8, max(1, (int)sysconf(_SC_NPROCESSORS_ONLN)))),
+      radar_hz(DEFAULT_RADAR_HZ), snapshot_hz(DEFAULT_SNAPSHOT_HZ),
+      airports_path(NULL), runways(DEFAULT_RUNWAYS), runway_occupancy_s(PHASE_DURATION_S),
+      sequencing(SEQUENCING_GREEDY), scenario_path(NULL), generate_rate(0), flights(-1),
+      log_level(LOG_DEBUG), console(stdout), metrics_interval_s(0),
+      avn_store_path(AVN_STORE_PATH), avn_log_path(AVN_LOG_PATH), avn_channel_name(AVN_CHANNEL_NAME),
+      trace_path(NULL), trace_snapshot_s(DEFAULT_TRACE_SNAPSHOT_S) {
+    mix[0] = 60;
+    mix[1] = 25;
+    mix[2] = 15;
+}
+
+AtcSimulation::AtcSimulation(const AtcConfig& config) {
+    init_speed_limit_table();
+    state = atc_state_new();
+    SimScope scope(state);
+
+    sim->sim_seed = config.seed;
+    sim->console = config.console ? config.console : stdout;
+    sim->radar_period_us = (long long)(1e6 / max(0.01, config.radar_hz));
+    sim->snapshot_period_us = config.snapshot_hz > 0 ? (long long)(1e6 / config.snapshot_hz) : 0;
+    sim->clock_mode = config.clock_mode;
+    sim->time_scale = max(0.001, config.time_scale);
+    sim->num_workers = max(1, config.workers);
+    sim->tick_workers = max(1, config.tick_workers);
+    sim->log_level = config.log_level;
+    sim->metrics_interval_s = config.metrics_interval_s;
+    sim->avn_store_path = config.avn_store_path ? config.avn_store_path : "";
+    sim->avn_log_path = config.avn_log_path ? config.avn_log_path : "";
+    sim->avn_channel_name = config.avn_channel_name ? config.avn_channel_name : "";
+    sim->trace_path = config.trace_path ? config.trace_path : "";
+    sim->trace_snapshot_us = (long long)(max(0.001, config.trace_snapshot_s) * 1e6);
+    sim->sequencing = config.sequencing;
+
+    // Runway model first: scenarios refer to airports by code
+    if (config.airports_path) {
+        if (!load_airport_config(config.airports_path)) {
+            return;
+        }
+    } else {
+        default_airport_config(config.runways, (long long)(max(0.001, config.runway_occupancy_s) * 1e6));
+    }
+    airports_init();
+
+    // Pick the flight source; the first flight is read ahead in begin(),
+    // so write_scenario() still sees all of it
+    sim->sim_end_us = config.duration_s * 1000000LL;
+    bool flights_given = config.flights >= 0;
+    if (config.scenario_path) {
+        if (!scenario_open(&sim->scenario, config.scenario_path)) {
+            return;
+        }
+        if (flights_given) {
+            sim->scenario.limit = config.flights;
+        }
+    } else if (config.generate_rate > 0) {
+        scenario_generator(&sim->scenario, config.generate_rate, config.mix, config.seed,
+                           flights_given ? config.flights : -1);
+    } else {
+        scenario_builtin(&sim->scenario, flights_given ? config.flights : NUM_AIRCRAFTS);
+    }
+
+    // Live AVN channel now, so portals can be forked before any thread exists
+    if (!sim->avn_channel_name.empty()) {
+        sim->avn_log.channel_ok = avn_channel_create(&sim->avn_log.channel, sim->avn_channel_name.c_str());
+    }
+    sim->loaded = true;
+}
+
+// Driver of a VIRTUAL run started with start()
+void* virtual_driver(void*) {
+    scheduler_run_virtual(LLONG_MAX);
+    return nullptr;
+}
+
+// Opens the sinks, starts the clock and queues the first events
+void atc_begin() {
+    sim->started = true;
+    avn_log_start(); // Clears previous run
+    if (!sim->trace_path.empty()) {
+        trace_open(sim->trace_path.c_str(), sim->trace_snapshot_us); // Before the sink sees an event
+    }
+    log_start(sim->log_level);
+    metrics_reporter_start(sim->metrics_interval_s);
+
+    // Flights are ingested lazily from the scenario as their start time
+    // approaches; radar and the end-of-simulation timer are events on the
+    // same queue
+    sim_clock_init(sim->clock_mode, sim->time_scale);
+    tick_pool_start(sim->tick_workers); // Fleet-wide passes (radar) fan out here
+    scheduler_init((int)sim->airports.size(), 1024);
+    fleet_init();
+    sim->scenario.has_next = scenario_read(&sim->scenario, &sim->scenario.next);
+    ingest_flights(); // Everything due at t=0 is in the fleet before radar
+    schedule_event(-1, EV_RADAR_SWEEP, 0);
+    schedule_event(-1, EV_SIM_END, sim->sim_end_us);
+    if (sim->snapshot_period_us > 0 && sim->clock_mode == CLOCK_MODE_REALTIME) {
+        // Only a renderer consumes snapshots; batch runs skip them
+        snapshots_init();
+        schedule_event(-1, EV_SNAPSHOT, 0);
+    }
+
+    if (sim->clock_mode == CLOCK_MODE_REALTIME) {
+        // Every airport partition needs at least one worker of its own;
+        // workers are dealt out to partitions round-robin
+        int workers = max(sim->num_workers, (int)sim->airports.size());
+        sim->worker_threads.resize(workers);
+        for (int w = 0; w < workers; ++w) {
+            sim_thread_create(&sim->worker_threads[w], scheduler_worker,
+                              (void*)(intptr_t)(w % sim->airports.size()));
+        }
+    }
+}
+
+// Joins the workers (they exit once EV_SIM_END has run) and closes the sinks
+void atc_finish() {
+    for (size_t w = 0; w < sim->worker_threads.size(); ++w) {
+        pthread_join(sim->worker_threads[w], NULL);
+    }
+    sim->worker_threads.clear();
+    tick_pool_stop();
+    metrics_reporter_stop();
+    log_stop(); // Every simulation line is out before the reports
+    trace_close();
+    sim->simulation_running = false;
+    avn_log_stop(); // Everything is on disk before a billing portal reads it
+    sim->finished = true;
+}
+
+AtcSimulation::~AtcSimulation() {
+    SimScope scope(state);
+    if (sim->started && !sim->finished) {
+        sim->simulation_running = false;
+        scheduler_stop();
+        atc_finish();
+    }
+    if (sim->avn_log.channel_ok) {
+        avn_channel_close(&sim->avn_log.channel); // Never started
+    }
+    scenario_close(&sim->scenario);
+    atc_state_delete(state);
+}
+
+bool AtcSimulation::ok() const {
+    return state->loaded;
+}
+
+bool AtcSimulation::step(long long until_us) {
+    SimScope scope(state);
+    if (!sim->loaded || sim->finished) {
+        return false;
+    }
+    if (sim->clock_mode == CLOCK_MODE_REALTIME) {
+        // The wall clock drives a REAL-TIME run; stepping just starts it
+        if (!sim->started) {
+            atc_begin();
+        }
+        return sim->simulation_running;
+    }
+    if (!sim->started) {
+        atc_begin();
+    }
+    if (scheduler_run_virtual(until_us)) {
+        return true;
+    }
+    atc_finish();
+    return false;
+}
+
+void AtcSimulation::run() {
+    if (state->clock_mode == CLOCK_MODE_VIRTUAL && !state->started) {
+        step(LLONG_MAX); // On this thread, no pool
+        return;
+    }
+    start();
+    wait();
+}
+
+void AtcSimulation::start() {
+    SimScope scope(state);
+    if (!sim->loaded || sim->started) {
+        return;
+    }
+    atc_begin();
+    if (sim->clock_mode == CLOCK_MODE_VIRTUAL) {
+        sim->worker_threads.resize(1);
+        sim_thread_create(&sim->worker_threads[0], virtual_driver, NULL);
+    }
+}
+
+void AtcSimulation::wait() {
+    SimScope scope(state);
+    if (sim->started && !sim->finished) {
+        atc_finish();
+    }
+}
+
+void AtcSimulation::stop() {
+    SimScope scope(state);
+    if (sim->started && !sim->finished) {
+        sim->simulation_running = false;
+        scheduler_stop();
+    }
+}
+
+bool AtcSimulation::running() const {
+    return state->started && !state->finished && state->simulation_running;
+}
+
+long long AtcSimulation::now_us() const {
+    SimScope scope(state);
+    return sim->started ? sim_now_us() : 0;
+}
+
+AtcStats AtcSimulation::stats() const {
+    SimScope scope(state);
+    AtcStats stats;
+    MetricSummary* avns = new MetricSummary;
+    metric_merge(METRIC_AVN_ISSUE, avns);
+    stats.sim_time_us = sim->started ? sim_now_us() : 0;
+    stats.flights_admitted = sim->fleet.admitted;
+    stats.active_flights = sim->active_flights;
+    stats.fleet_slots = fleet_size();
+    stats.avns_issued = (long long)avns->total;
+    stats.separation_losses = sim->separation_losses;
+    stats.radar_sweeps = sim->radar_sweeps;
+    stats.radar_sweep_mean_us = sim->radar_sweeps ? sim->radar_sweep_ns_total / 1e3 / sim->radar_sweeps : 0.0;
+    stats.radar_sweep_max_us = sim->radar_sweep_ns_max / 1e3;
+    stats.radar_scan_mean_us = sim->radar_sweeps ? sim->radar_scan_ns_total / 1e3 / sim->radar_sweeps : 0.0;
+    stats.grid_relinks = sim->radar_grid.moves;
+
+    // Grant latencies over every airport, each histogram read under its lock
+    MetricSummary* waits = avns; // Done with the AVN one
+    memset(waits, 0, sizeof(*waits));
+    uint64_t holds = 0, held_us = 0;
+    for (size_t a = 0; a < sim->airports.size(); ++a) {
+        Airport& airport = sim->airports[a];
+        if (!airport.wait_hist) {
+            continue; // The runway model never finished loading
+        }
+        pthread_mutex_lock(&airport.lock);
+        for (int b = 0; b < HIST_BUCKETS; ++b) {
+            waits->counts[b] += airport.wait_hist->counts[b];
+        }
+        waits->total += airport.wait_hist->total;
+        waits->sum += airport.wait_hist->sum;
+        waits->max = max(waits->max, airport.wait_hist->max);
+        holds += airport.holding_hist->total;
+        held_us += airport.holding_hist->sum;
+        pthread_mutex_unlock(&airport.lock);
+    }
+    stats.runway_grants = (long long)waits->total;
+    stats.runway_delay_mean_s = waits->total ? waits->sum / 1e6 / waits->total : 0.0;
+    stats.runway_delay_p99_s = waits->total ? metric_quantile(*waits, 0.99) / 1e6 : 0.0;
+    stats.holding_mean_s = holds ? held_us / 1e6 / holds : 0.0;
+    stats.running = running();
+    delete avns;
+    return stats;
+}
+
+bool AtcSimulation::flight(int index, AtcFlightInfo* info) const {
+    SimScope scope(state);
+    if (!sim->started || index < 0 || index >= fleet_size()) {
+        return false;
+    }
+    FlightView view = fleet_read(index);
+    const Aircraft& aircraft = fleet_aircraft(index);
+    memcpy(info->flight_number, aircraft.flight_number, sizeof(info->flight_number));
+    info->type = aircraft.type;
+    info->direction = aircraft.direction;
+    info->airport = aircraft.airport;
+    info->phase = view.phase;
+    info->speed = view.speed;
+    info->x = view.x;
+    info->y = view.y;
+    info->alt = view.alt;
+    info->active = view.active;
+    info->avn_issued = fleet_chunk(index)->avn_issued[fleet_slot(index)].load() != 0;
+    return true;
+}
+
+int AtcSimulation::find_flight(const char* flight_number) const {
+    SimScope scope(state);
+    if (!sim->started) {
+        return -1;
+    }
+    int count = fleet_size();
+    for (int i = 0; i < count; ++i) {
+        if (strncmp(fleet_aircraft(i).flight_number, flight_number, sizeof(Aircraft().flight_number)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int AtcSimulation::runway_count() const {
+    return (int)state->runways.size();
+}
+
+const char* AtcSimulation::runway_name(int runway) const {
+    return state->runways[runway].name;
+}
+
+const WorldSnapshot& AtcSimulation::latest_snapshot() {
+    SimScope scope(state);
+    return snapshot_latest();
+}
+
+void AtcSimulation::record_frame(long long frame_ns) {
+    SimScope scope(state);
+    metric_record(METRIC_FRAME, frame_ns);
+}
+
+void AtcSimulation::print_report() const {
+    SimScope scope(state);
+    print_runway_report(sim_now_us());
+    fprintf(sim->console, "[Radar Report] %lld sweeps over %lld flights (%d slots): mean %.1f us, max %.1f us\n",
+            sim->radar_sweeps, sim->fleet.admitted, fleet_size(),
+            sim->radar_sweeps ? sim->radar_sweep_ns_total / 1e3 / sim->radar_sweeps : 0.0,
+            sim->radar_sweep_ns_max / 1e3);
+    fprintf(sim->console, "[Radar Report] of which position scan mean %.1f us, separation check mean %.1f us\n",
+            sim->radar_sweeps ? sim->radar_scan_ns_total / 1e3 / sim->radar_sweeps : 0.0,
+            sim->radar_sweeps ? (sim->radar_sweep_ns_total - sim->radar_scan_ns_total) / 1e3 / sim->radar_sweeps : 0.0);
+    fprintf(sim->console, "[Radar Report] %lld separation losses, %lld grid relinks\n",
+            sim->separation_losses, sim->radar_grid.moves);
+    fprintf(sim->console, "[Radar Report] %lld speed changes checked in %lld event-driven passes\n",
+            sim->speed_dirty.checked.load(), sim->speed_dirty.checks.load());
+    fflush(sim->console);
+}
+
+bool AtcSimulation::write_metrics(const char* path) const {
+    SimScope scope(state);
+    return metrics_write_json(path);
+}
+
+int AtcSimulation::write_scenario(const char* path) {
+    SimScope scope(state);
+    return scenario_write_binary(&sim->scenario, path);
+}
+
+// ========================== REPLAY ==========================================
+
+/*
+AtcReplay maps a trace and keeps one TraceWorld positioned at some time.
+seek() backwards, or further forward than the next snapshot, restarts from
+the latest snapshot at or before the target (binary search over the
+index); a short step forward just keeps applying records from where the
+last seek stopped. Either way at most one snapshot interval of records is
+decoded, so an hour of traffic scrubs as fast as ten seconds of it.
+Positions are not in the trace: they follow from the phase, speed and
+phase start through the same phase_motion() the simulation uses.
+*/
+
+struct TraceReplay {
+    void* map;
+    size_t size;
+    const unsigned char* records;     // First record after the header
+    const unsigned char* records_end; // END record, or where a cut-short trace stops
+    vector<string> airport_codes;
+    vector<float> airport_x, airport_y;
+    vector<string> runway_names;
+    vector<TraceIndexEntry> index;
+    long long end_us;
+
+    TraceWorld world;
+    const unsigned char* pos;         // Next record to apply
+    long long last_us;                // Time base for pos's delta
+    long long at_us;                  // Time of the last seek
+    WorldSnapshot snap;
+};
+
+// Reads a record's tag and time; false at END or at the end of the data
+bool trace_get_head(TraceCursor& c, long long last_us, int* tag, long long* sim_us) {
+    if (c.p >= c.end) {
+        return false;
+    }
+    *tag = *c.p++;
+    long long t = trace_get_signed(c);
+    *sim_us = (*tag == TRACE_SNAPSHOT) ? t : last_us + t;
+    return c.ok && *tag != TRACE_END;
+}
+
+// Walks every record: the index of a trace without a trailer
+void trace_scan(TraceReplay* r) {
+    TraceCursor c = { r->records, r->records_end, true };
+    long long last_us = 0;
+    int tag;
+    long long sim_us;
+    const unsigned char* start = c.p;
+    TraceWorld scratch;
+    LogEvent ev;
+    while (trace_get_head(c, last_us, &tag, &sim_us)) {
+        if (tag == TRACE_SNAPSHOT) {
+            trace_get_snapshot(c, sim_us, &scratch);
+            if (c.ok) {
+                r->index.push_back({sim_us, (uint64_t)(start - (const unsigned char*)r->map)});
+            }
+        } else {
+            trace_get_event(c, tag, sim_us, &ev);
+        }
+        if (!c.ok) {
+            break; // Cut short mid-record
+        }
+        last_us = sim_us;
+        r->end_us = max(r->end_us, sim_us);
+        start = c.p;
+    }
+    r->records_end = start;
+}
+
+bool trace_replay_open(TraceReplay* r, const char* path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(TRACE_MAGIC)) {
+        close(fd);
+        return false;
+    }
+    r->size = st.st_size;
+    r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        return false;
+    }
+    const unsigned char* data = (const unsigned char*)r->map;
+    if (memcmp(data, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        return false;
+    }
+    TraceCursor c = { data + sizeof(TRACE_MAGIC), data + r->size, true };
+    if (trace_get_varint(c) != TRACE_VERSION) {
+        return false;
+    }
+    trace_get_varint(c); // Snapshot interval; the index says where they are
+    uint64_t airports = trace_get_varint(c);
+    for (uint64_t a = 0; a < airports && c.ok; ++a) {
+        char code[8];
+        float x, y;
+        trace_get_string(c, code, sizeof(code));
+        trace_get_bytes(c, &x, sizeof(x));
+        trace_get_bytes(c, &y, sizeof(y));
+        r->airport_codes.push_back(code);
+        r->airport_x.push_back(x);
+        r->airport_y.push_back(y);
+    }
+    uint64_t runways = trace_get_varint(c);
+    for (uint64_t k = 0; k < runways && c.ok; ++k) {
+        char name[24];
+        trace_get_string(c, name, sizeof(name));
+        trace_get_varint(c); // Airport
+        r->runway_names.push_back(name);
+    }
+    if (!c.ok) {
+        return false;
+    }
+    r->records = c.p;
+    r->records_end = data + r->size;
+    r->end_us = 0;
+
+    // Trailer: index offset and magic; without it, index by scanning
+    uint64_t index_offset = 0;
+    size_t trailer = sizeof(uint64_t) + sizeof(TRACE_END_MAGIC);
+    bool complete = r->size >= trailer &&
+                    memcmp(data + r->size - sizeof(TRACE_END_MAGIC), TRACE_END_MAGIC, sizeof(TRACE_END_MAGIC)) == 0;
+    if (complete) {
+        memcpy(&index_offset, data + r->size - trailer, sizeof(index_offset));
+        complete = index_offset >= (uint64_t)(r->records - data) && index_offset <= r->size - trailer;
+    }
+    if (complete) {
+        TraceCursor ix = { data + index_offset, data + r->size - trailer, true };
+        r->end_us = trace_get_signed(ix);
+        uint64_t count = trace_get_varint(ix);
+        for (uint64_t k = 0; k < count && ix.ok; ++k) {
+            TraceIndexEntry entry;
+            entry.sim_us = trace_get_signed(ix);
+            entry.offset = trace_get_varint(ix);
+            ix.ok = ix.ok && entry.offset < index_offset;
+            r->index.push_back(entry);
+        }
+        complete = ix.ok;
+    }
+    if (!complete) {
+        r->index.clear();
+        trace_scan(r);
+    }
+    if (r->index.empty()) {
+        return false;
+    }
+    r->at_us = -1; // Nothing applied yet
+    return true;
+}
+
+bool trace_index_less(long long t, const TraceIndexEntry& entry) {
+    return t < entry.sim_us;
+}
+
+void trace_replay_seek(TraceReplay* r, long long t_us) {
+    t_us = max(0LL, min(t_us, r->end_us));
+    const unsigned char* data = (const unsigned char*)r->map;
+    size_t k = upper_bound(r->index.begin(), r->index.end(), t_us, trace_index_less) - r->index.begin();
+    const TraceIndexEntry& base = r->index[k ? k - 1 : 0];
+
+    // Restart from the snapshot unless the world is already between it and t
+    if (r->at_us < 0 || r->at_us > t_us || r->at_us < base.sim_us) {
+        r->pos = data + base.offset;
+        r->last_us = 0;
+        r->world = TraceWorld();
+    }
+
+    TraceCursor c = { r->pos, r->records_end, true };
+    int tag;
+    long long sim_us;
+    LogEvent ev;
+    for (;;) {
+        TraceCursor head = c;
+        if (!trace_get_head(head, r->last_us, &tag, &sim_us) || sim_us > t_us) {
+            break;
+        }
+        if (tag == TRACE_SNAPSHOT) {
+            trace_get_snapshot(head, sim_us, &r->world);
+        } else {
+            trace_get_event(head, tag, sim_us, &ev);
+            if (head.ok) {
+                trace_apply(r->world, ev);
+            }
+        }
+        if (!head.ok) {
+            break;
+        }
+        c = head;
+        r->last_us = sim_us;
+    }
+    r->pos = c.p;
+    r->at_us = t_us;
+    r->world.now_us = t_us;
+}
+
+// Where flight f is at the replay's current time
+void trace_replay_position(const TraceReplay* r, const TraceFlight& f, float* x, float* y, float* alt) {
+    bool known = f.airport >= 0 && f.airport < (int)r->airport_x.size();
+    float ax = known ? r->airport_x[f.airport] : 0.f;
+    float ay = known ? r->airport_y[f.airport] : 0.f;
+    if (f.phase_t0 < 0) {
+        *x = ax;
+        *y = ay;
+        *alt = 0.f;
+        return;
+    }
+    PhaseMotion m = phase_motion(ax, ay, flight_bearing(f.flight_number), (FlightType)f.direction,
+                                 (Phase)f.phase, next_phase((FlightType)f.direction, (Phase)f.phase), f.speed);
+    float dt = motion_seconds(f.phase_t0, r->world.now_us);
+    *x = m.start_x + m.vel_x * dt;
+    *y = m.start_y + m.vel_y * dt;
+    *alt = max(0.f, m.start_alt + m.vel_alt * dt);
+}
+
+AtcReplay::AtcReplay() : state(new TraceReplay()) {
+}
+
+AtcReplay::~AtcReplay() {
+    if (state->map) {
+        munmap(state->map, state->size);
+    }
+    delete state;
+}
+
+bool AtcReplay::open(const char* path) {
+    if (state->map) {
+        munmap(state->map, state->size);
+    }
+    delete state;
+    state = new TraceReplay();
+    if (!trace_replay_open(state, path)) {
+        return false;
+    }
+    trace_replay_seek(state, 0);
+    return true;
+}
+
+long long AtcReplay::end_us() const {
+    return state->end_us;
+}
+
+long long AtcReplay::now_us() const {
+    return state->world.now_us;
+}
+
+void AtcReplay::seek(long long t_us) {
+    if (!state->index.empty()) {
+        trace_replay_seek(state, t_us);
+    }
+}
+
+AtcStats AtcReplay::stats() const {
+    AtcStats stats = AtcStats();
+    stats.sim_time_us = state->world.now_us;
+    stats.flights_admitted = state->world.admitted;
+    stats.active_flights = state->world.active;
+    stats.fleet_slots = (int)state->world.flights.size();
+    stats.avns_issued = state->world.avns;
+    return stats;
+}
+
+bool AtcReplay::flight(int index, AtcFlightInfo* info) const {
+    if (index < 0 || index >= (int)state->world.flights.size()) {
+        return false;
+    }
+    const TraceFlight& f = state->world.flights[index];
+    memcpy(info->flight_number, f.flight_number, sizeof(info->flight_number));
+    info->type = (AircraftType)f.type;
+    info->direction = (FlightType)f.direction;
+    info->airport = f.airport;
+    info->phase = (Phase)f.phase;
+    info->speed = f.speed;
+    trace_replay_position(state, f, &info->x, &info->y, &info->alt);
+    info->active = f.active;
+    info->avn_issued = f.avn_issued;
+    return true;
+}
+
+int AtcReplay::find_flight(const char* flight_number) const {
+    for (size_t i = 0; i < state->world.flights.size(); ++i) {
+        if (strncmp(state->world.flights[i].flight_number, flight_number, sizeof(TraceFlight().flight_number)) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+int AtcReplay::runway_count() const {
+    return (int)state->runway_names.size();
+}
+
+const char* AtcReplay::runway_name(int runway) const {
+    return state->runway_names[runway].c_str();
+}
+
+int AtcReplay::runway_holder(int runway) const {
+    return runway < (int)state->world.runway_holder.size() ? state->world.runway_holder[runway] : -1;
+}
+
+const WorldSnapshot& AtcReplay::snapshot() {
+    WorldSnapshot& snap = state->snap;
+    snap.sim_time_us = state->world.now_us;
+    snap.aircraft.resize(state->world.flights.size());
+    for (size_t i = 0; i < snap.aircraft.size(); ++i) {
+        const TraceFlight& f = state->world.flights[i];
+        SnapshotAircraft& a = snap.aircraft[i];
+        float alt;
+        a.phase = f.phase;
+        a.type = f.type;
+        a.direction = f.direction;
+        a.active = f.active;
+        trace_replay_position(state, f, &a.x, &a.y, &alt);
+    }
+    snap.runway_in_use.resize(state->runway_names.size());
+    for (size_t r = 0; r < snap.runway_in_use.size(); ++r) {
+        snap.runway_in_use[r] = runway_holder((int)r) >= 0;
+    }
+    return snap;
+}
+
+// ========================== MONTE CARLO =====================================
+
+/*
+Capacity planning (--monte-carlo RUNS): every combination of the swept
+runway counts, occupancy times and traffic mixes, RUNS seeded runs each.
+Jobs are (grid point, run) pairs handed out through one atomic counter to
+a pool of threads. A thread runs one whole simulation at a time on the
+virtual clock with every sink off, each one a private AtcSimulation, so
+the threads share nothing while a run is going. Run k of every point uses
+seed base + k, so the points are compared on the same traffic. A finished
+run is folded into its point under that point's lock: Welford's running
+mean and variance for a confidence interval, and a metrics histogram for
+percentiles. Memory stays fixed however many runs a sweep has. A point is
+reported as soon as its last run is in, so an overnight sweep writes its
+results as it goes.
+*/
+
+MonteCarloPlan::MonteCarloPlan() : runs(100), threads(0), report(NULL), csv_path(NULL) {}
+
+void mc_add(McStat* stat, double value, double scale) {
+    stat->n++;
+    double delta = value - stat->mean;
+    stat->mean += delta / stat->n;
+    stat->m2 += delta * (value - stat->mean);
+    hist_add(stat->hist, (uint64_t)llround(max(0.0, value) * scale));
+}
+
+// Half-width of the mean's 95% confidence interval (normal approximation)
+double mc_mean_ci(const McStat& stat) {
+    return stat.n > 1 ? 1.96 * sqrt(stat.m2 / (stat.n - 1) / stat.n) : 0.0;
+}
+
+double mc_quantile(const McStat& stat, double q, double scale) {
+    return stat.n ? metric_quantile(*stat.hist, min(1.0, max(0.0, q))) / scale : 0.0;
+}
+
+// Distribution-free 95% interval for quantile q: the runs ranked
+// n q -+ 1.96 sqrt(n q (1 - q))
+void mc_quantile_ci(const McStat& stat, double q, double scale, double* lo, double* hi) {
+    double half = 1.96 * sqrt(q * (1 - q) / max(1LL, stat.n));
+    *lo = mc_quantile(stat, q - half, scale);
+    *hi = mc_quantile(stat, q + half, scale);
+}
+
+void mc_report_point(McSweep* sweep, const McPoint& point) {
+    pthread_mutex_lock(&sweep->report_lock);
+    FILE* out = sweep->report;
+    fprintf(out, "[Monte Carlo] %d runways, %.2f s occupancy, mix %g/%g/%g: %lld runs\n", point.runways,
+            point.occupancy_s, point.mix[0], point.mix[1], point.mix[2], point.stats[0].n);
+    if (sweep->csv) {
+        fprintf(sweep->csv, "%d,%.3f,%g,%g,%g,%lld", point.runways, point.occupancy_s, point.mix[0],
+                point.mix[1], point.mix[2], point.stats[0].n);
+    }
+    for (int m = 0; m < MC_METRICS; ++m) {
+        const McStat& stat = point.stats[m];
+        double scale = MC_METRIC_SCALE[m], lo, hi;
+        mc_quantile_ci(stat, 0.99, scale, &lo, &hi);
+        fprintf(out, "[Monte Carlo]     %-18s mean %9.3f +- %-7.3f p50 %9.3f  p90 %9.3f  p99 %9.3f [%.3f, %.3f]  max %.3f\n",
+                MC_METRIC_NAMES[m], stat.mean, mc_mean_ci(stat), mc_quantile(stat, 0.50, scale),
+                mc_quantile(stat, 0.90, scale), mc_quantile(stat, 0.99, scale), lo, hi, stat.hist->max / scale);
+        if (sweep->csv) {
+            fprintf(sweep->csv, ",%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f", stat.mean, mc_mean_ci(stat),
+                    mc_quantile(stat, 0.50, scale), mc_quantile(stat, 0.90, scale), mc_quantile(stat, 0.99, scale),
+                    lo, hi, stat.hist->max / scale);
+        }
+    }
+    fflush(out);
+    if (sweep->csv) {
+        fprintf(sweep->csv, "\n");
+        fflush(sweep->csv);
+    }
+    pthread_mutex_unlock(&sweep->report_lock);
+}
+
+void* mc_worker(void* arg) {
+    McSweep* sweep = (McSweep*)arg;
+    long long jobs = (long long)sweep->points.size() * sweep->runs;
+    for (;;) {
+        long long job = sweep->next_job.fetch_add(1, memory_order_relaxed);
+        if (job >= jobs) {
+            break;
+        }
+        McPoint& point = sweep->points[job / sweep->runs];
+        AtcConfig config = sweep->base;
+        config.seed = sweep->base.seed + job % sweep->runs; // Same traffic at every point
+        config.runways = point.runways;
+        config.runway_occupancy_s = point.occupancy_s;
+        memcpy(config.mix, point.mix, sizeof(config.mix));
+
+        AtcStats stats;
+        bool ok;
+        {
+            AtcSimulation simulation(config);
+            ok = simulation.ok();
+            if (ok) {
+                simulation.run();
+                stats = simulation.stats();
+            }
+        }
+        pthread_mutex_lock(&point.lock);
+        if (ok) {
+            mc_add(&point.stats[MC_DELAY_MEAN], stats.runway_delay_mean_s, MC_METRIC_SCALE[MC_DELAY_MEAN]);
+            mc_add(&point.stats[MC_DELAY_P99], stats.runway_delay_p99_s, MC_METRIC_SCALE[MC_DELAY_P99]);
+            mc_add(&point.stats[MC_HOLDING_MEAN], stats.holding_mean_s, MC_METRIC_SCALE[MC_HOLDING_MEAN]);
+            mc_add(&point.stats[MC_AVNS], (double)stats.avns_issued, MC_METRIC_SCALE[MC_AVNS]);
+        } else {
+            sweep->failed.fetch_add(1, memory_order_relaxed);
+        }
+        bool complete = ++point.done == sweep->runs;
+        pthread_mutex_unlock(&point.lock);
+        if (complete && sweep->report) {
+            mc_report_point(sweep, point);
+        }
+    }
+    return nullptr;
+}
+
+// The grid, outermost axis first; an empty axis keeps the base value
+bool mc_sweep_init(McSweep* sweep, const AtcConfig& base, const MonteCarloPlan& plan) {
+    vector<int> runways = plan.runways;
+    vector<double> occupancy = plan.occupancy_s;
+    vector<double> mixes = plan.mixes;
+    if (runways.empty()) runways.push_back(base.runways);
+    if (occupancy.empty()) occupancy.push_back(base.runway_occupancy_s);
+    if (mixes.size() < 3) mixes.assign(base.mix, base.mix + 3);
+    if (base.airports_path && (!plan.runways.empty() || !plan.occupancy_s.empty())) {
+        return false; // Only the built-in airport's runways can be swept
+    }
+
+    // Headless and silent: virtual clock, no sinks, one thread per run
+    sweep->base = base;
+    AtcConfig& config = sweep->base;
+    config.clock_mode = CLOCK_MODE_VIRTUAL;
+    config.tick_workers = 1;
+    config.snapshot_hz = 0;
+    config.log_level = LOG_OFF;
+    config.metrics_interval_s = 0;
+    config.avn_store_path = NULL;
+    config.avn_log_path = NULL;
+    config.avn_channel_name = NULL;
+    config.trace_path = NULL;
+    if (!config.scenario_path && config.generate_rate <= 0) {
+        config.generate_rate = MC_DEFAULT_RATE;
+    }
+    sweep->quiet = fopen("/dev/null", "w");
+    config.console = sweep->quiet;
+
+    sweep->runs = max(1, plan.runs);
+    for (size_t r = 0; r < runways.size(); ++r) {
+        for (size_t o = 0; o < occupancy.size(); ++o) {
+            for (size_t x = 0; x + 3 <= mixes.size(); x += 3) {
+                McPoint point;
+                memset(&point, 0, sizeof(point));
+                point.runways = runways[r];
+                point.occupancy_s = occupancy[o];
+                memcpy(point.mix, &mixes[x], sizeof(point.mix));
+                sweep->points.push_back(point);
+            }
+        }
+    }
+    for (size_t p = 0; p < sweep->points.size(); ++p) {
+        pthread_mutex_init(&sweep->points[p].lock, NULL);
+        for (int m = 0; m < MC_METRICS; ++m) {
+            sweep->points[p].stats[m].hist = new MetricSummary(); // Zeroed
+        }
+    }
+    sweep->next_job = 0;
+    sweep->failed = 0;
+    sweep->report = plan.report;
+    sweep->csv = NULL;
+    pthread_mutex_init(&sweep->report_lock, NULL);
+    return true;
+}
+
+void mc_sweep_free(McSweep* sweep) {
+    for (size_t p = 0; p < sweep->points.size(); ++p) {
+        pthread_mutex_destroy(&sweep->points[p].lock);
+        for (int m = 0; m < MC_METRICS; ++m) {
+            delete sweep->points[p].stats[m].hist;
+        }
+    }
+    sweep->points.clear();
+    pthread_mutex_destroy(&sweep->report_lock);
+    if (sweep->quiet) {
+        fclose(sweep->quiet);
+    }
+}
+
+// All the jobs on `threads` threads; returns the wall-clock seconds
+double mc_sweep_run(McSweep* sweep, int threads) {
+    long long start = monotonic_ns();
+    vector<pthread_t> pool(max(1, threads));
+    for (size_t t = 0; t < pool.size(); ++t) {
+        pthread_create(&pool[t], NULL, mc_worker, sweep);
+    }
+    for (size_t t = 0; t < pool.size(); ++t) {
+        pthread_join(pool[t], NULL);
+    }
+    return (monotonic_ns() - start) / 1e9;
+}
+
+int run_monte_carlo(const AtcConfig& base, const MonteCarloPlan& plan) {
+    McSweep sweep;
+    if (!mc_sweep_init(&sweep, base, plan)) {
+        fprintf(stderr, "--sweep-runways and --sweep-occupancy apply to the built-in airport, not --airports\n");
+        return 1;
+    }
+    if (!sweep.report) {
+        sweep.report = stdout;
+    }
+    if (plan.csv_path) {
+        sweep.csv = fopen(plan.csv_path, "w");
+        if (!sweep.csv) {
+            perror(plan.csv_path);
+            mc_sweep_free(&sweep);
+            return 1;
+        }
+        fprintf(sweep.csv, "runways,occupancy_s,mix_commercial,mix_cargo,mix_emergency,runs");
+        for (int m = 0; m < MC_METRICS; ++m) {
+            const char* c = MC_METRIC_COLUMNS[m];
+            fprintf(sweep.csv, ",%s_mean,%s_ci95,%s_p50,%s_p90,%s_p99,%s_p99_lo,%s_p99_hi,%s_max", c, c, c, c, c, c,
+                    c, c);
+        }
+        fprintf(sweep.csv, "\n");
+    }
+
+    long long jobs = (long long)sweep.points.size() * sweep.runs;
+    int threads = plan.threads > 0 ? plan.threads : max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    threads = (int)min((long long)threads, jobs);
+    fprintf(sweep.report, "[Monte Carlo] %zu grid points x %d runs = %lld simulations of %d s at %g flights/min on %d thread%s\n",
+            sweep.points.size(), sweep.runs, jobs, sweep.base.duration_s, sweep.base.generate_rate, threads,
+            threads == 1 ? "" : "s");
+    fflush(sweep.report);
+    double seconds = mc_sweep_run(&sweep, threads);
+    long long failed = sweep.failed.load();
+    fprintf(sweep.report, "[Monte Carlo] %lld runs in %.2f s: %.1f runs/s, %lld failed\n", jobs, seconds,
+            jobs / seconds, failed);
+    if (sweep.csv) {
+        fclose(sweep.csv);
+        fprintf(sweep.report, "[Monte Carlo] Grid written to %s\n", plan.csv_path);
+    }
+    mc_sweep_free(&sweep);
+    return failed ? 1 : 0;
+}
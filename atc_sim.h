@@ -0,0 +1,320 @@
+/*
+AirControlX simulation core, embeddable API.
+
+An AtcSimulation owns one complete simulation: its fleet, airports and
+runways, clock, event queues, radar, and its sinks (console event log,
+AVN store, AVN text log, live portal channel, metrics). Nothing is shared
+between instances, so several can run side by side in one process, each
+on its own threads.
+
+Build the core with the program that embeds it, no SFML needed:
+    g++ -std=c++17 -O2 -march=native my_program.cpp atc_sim.cpp -lpthread -lrt
+
+    AtcConfig config;
+    config.clock_mode = CLOCK_MODE_VIRTUAL;
+    config.flights = 1000;
+    AtcSimulation sim(config);
+    while (sim.step(sim.now_us() + 1000000)) {
+        AtcStats stats = sim.stats(); // Once per simulated second
+    }
+*/
+
+#ifndef ATC_SIM_H
+#define ATC_SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// ========================== ENUMS AND CONSTANTS =============================
+
+// Defines all the flight phases, aircraft types, and direction types
+
+enum Phase { HOLDING, APPROACH, LANDING, TAXI, GATE, TAKEOFF, CLIMB, CRUISE };
+enum FlightType { ARRIVAL, DEPARTURE };
+enum AircraftType { COMMERCIAL, CARGO, EMERGENCY };
+
+// Names of phases used in console output
+const char* const PHASE_NAMES[] = {
+    "Holding", "Approach", "Landing", "Taxi", "Gate",
+    "Takeoff", "Climb", "Cruise"
+};
+// Names of aircraft types used in logs
+const char* const AIRCRAFT_TYPE_NAMES[] = { "COMMERCIAL", "CARGO", "EMERGENCY" };
+// Horizontal positions for each phase
+const float PHASE_X_POSITIONS[] = {
+    100.f, // HOLDING or GATE
+    200.f, // APPROACH or TAXI
+    300.f, // LANDING or TAKEOFF
+    400.f, // TAXI or CLIMB
+    500.f, // GATE or CRUISE
+};
+
+
+// Speed ranges per phase for ARRIVAL flights
+const int ARRIVAL_SPEED_LIMITS[][2] = {
+    {400, 600}, // Holding
+    {240, 290}, // Approach
+    {30, 240},  // Landing
+    {15, 30},   // Taxi
+    {0, 5}      // Gate
+};
+
+// Speed ranges per phase for DEPARTURE flights
+const int DEPARTURE_SPEED_LIMITS[][2] = {
+    {0, 5},     // Gate
+    {15, 30},   // Taxi
+    {0, 290},   // Takeoff
+    {250, 463}, // Climb
+    {800, 900}  // Cruise
+};
+
+const int NUM_AIRCRAFTS = 6; // Simulating 6 flights across airlines
+const int PHASE_DURATION_S = 3; // Time spent in each phase (and on the runway)
+const int DEFAULT_WORKERS = 4;  // Scheduler worker threads
+const int DEFAULT_DURATION_S = 50;      // Simulated time before the run ends
+const int DEFAULT_RADAR_HZ = 2;           // Radar sweeps per simulated second
+const int DEFAULT_RUNWAYS = 3;            // Runways of the built-in airport
+
+// Phase sequences walked by the flight_simulation event handler
+const Phase ARRIVAL_PHASES[] = { HOLDING, APPROACH, LANDING, TAXI, GATE };
+const Phase DEPARTURE_PHASES[] = { GATE, TAXI, TAKEOFF, CLIMB, CRUISE };
+const int NUM_PHASES = 5;
+
+// Where each phase starts, indexed by Phase: distance from the airport along
+// the flight's bearing and altitude. Aircraft fly straight from there at
+// their phase speed, climbing or descending toward the next phase's altitude.
+const float PHASE_RADIUS_KM[] = { 30.f, 15.f, 3.f, 0.5f, 0.f, 1.f, 4.f, 20.f };
+const float PHASE_ALTITUDE_M[] = { 3000.f, 1500.f, 150.f, 0.f, 0.f, 0.f, 1200.f, 9000.f };
+
+const int DEFAULT_FPS = 60;          // Visualizer frame cap (--fps, 0 = uncapped)
+const int DEFAULT_SNAPSHOT_HZ = 30; // World snapshots published per simulated second
+const int DEFAULT_TRACE_SNAPSHOT_S = 10; // Simulated seconds between trace snapshots
+
+// REAL-TIME follows the wall clock (what a window needs); VIRTUAL jumps
+// from event to event and is deterministic for a seed
+enum ClockMode { CLOCK_MODE_REALTIME, CLOCK_MODE_VIRTUAL };
+
+enum LogLevel { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_OFF };
+const char* const LOG_LEVEL_NAMES[] = { "debug", "info", "warn", "off" };
+
+// GREEDY queues every request by priority and hands out free runways at
+// the end of each instant; LOOKAHEAD plans the landings and takeoffs due
+// in the next few phases and grants runways by that plan. Its horizon
+// holds 256 flights per airport: past that, flights are planned only once
+// they ask, and the runway report counts them.
+enum SequencingPolicy { SEQUENCING_GREEDY, SEQUENCING_LOOKAHEAD };
+const char* const SEQUENCING_NAMES[] = { "greedy", "lookahead" };
+
+// ========================== CONFIGURATION ===================================
+
+// Everything an instance is built from. The defaults are the original
+// program: one airport, the six built-in flights, 50 s of real time.
+struct AtcConfig {
+    ClockMode clock_mode;
+    double time_scale;           // REAL-TIME: simulated seconds per wall-clock second
+    int duration_s;              // Simulated time before the run ends
+    uint64_t seed;               // Every random stream derives from it
+    int workers;                 // REAL-TIME scheduler workers, at least one per airport
+    int tick_workers;            // Threads for fleet-wide passes, the caller included
+    double radar_hz;             // Radar sweeps per simulated second
+    double snapshot_hz;          // World snapshots per simulated second, 0 = none
+
+    // Flight source: a scenario file, the Poisson generator, or the
+    // built-in flights scaled to `flights`
+    const char* airports_path;   // Runway model; NULL = one airport, `runways` runways
+    int runways;                 // Built-in airport: runways taking every flight
+    double runway_occupancy_s;   // Built-in airport: how long a movement holds one
+    SequencingPolicy sequencing; // Who gets a runway next
+    const char* scenario_path;   // CSV or binary scenario
+    double generate_rate;        // Generator flights per minute, 0 = off
+    double mix[3];               // Generator weights: COMMERCIAL, CARGO, EMERGENCY
+    long long flights;           // Built-in count, or a cap on the others; -1 = default
+
+    // Sinks. A NULL path turns that sink off.
+    LogLevel log_level;
+    FILE* console;               // Event log and reports
+    double metrics_interval_s;   // Periodic metrics dumps, 0 = on SIGUSR1 only
+    const char* avn_store_path;  // Binary AVN history for the billing portal
+    const char* avn_log_path;    // Text AVN log, rotated
+    const char* avn_channel_name; // POSIX shm name of the live portal feed
+    const char* trace_path;      // Binary trace for AtcReplay
+    double trace_snapshot_s;     // Simulated seconds between the trace's seek points
+
+    AtcConfig();
+};
+
+// ========================== QUERIES =========================================
+
+struct AtcStats {
+    long long sim_time_us;
+    long long flights_admitted;  // Ever added to the fleet
+    int active_flights;          // Not yet through their last phase
+    int fleet_slots;             // Valid indices for AtcSimulation::flight
+    long long avns_issued;
+    long long separation_losses;
+    long long radar_sweeps;
+    double radar_sweep_mean_us;
+    double radar_sweep_max_us;
+    double radar_scan_mean_us;   // Position scan part of a sweep, without the separation check
+    long long grid_relinks;
+    long long runway_grants;
+    double runway_delay_mean_s;  // Runway request to grant, every airport
+    double runway_delay_p99_s;
+    double holding_mean_s;       // The arrivals' part of it, spent holding to land
+    bool running;
+};
+
+// One aircraft as the radar sees it
+struct AtcFlightInfo {
+    char flight_number[10];
+    AircraftType type;
+    FlightType direction;
+    int airport;
+    Phase phase;
+    int speed;                   // km/h
+    float x, y;                  // km from the origin of the runway model
+    float alt;                   // metres
+    bool active;                 // False once the slot's flight has finished
+    bool avn_issued;
+};
+
+// What a renderer draws: one consistent copy of the world
+struct SnapshotAircraft {
+    unsigned char phase;     // Phase
+    unsigned char type;      // AircraftType
+    unsigned char direction; // FlightType
+    unsigned char active;
+    float x, y;
+};
+
+struct WorldSnapshot {
+    long long sim_time_us;
+    std::vector<unsigned char> runway_in_use; // Indexed like runways[]
+    std::vector<SnapshotAircraft> aircraft;
+};
+
+// ========================== SIMULATION ======================================
+
+struct AtcState;
+
+/*
+Lifecycle: construct (loads the runway model and opens the flight source
+and the portal channel; starts no threads, so the caller may still fork),
+then either step() a VIRTUAL run forward, or run() it to the end, or
+start() a REAL-TIME run and wait() for it. Sinks are flushed and closed
+when the run ends; reports and metrics can be read after that.
+*/
+class AtcSimulation {
+public:
+    explicit AtcSimulation(const AtcConfig& config);
+    ~AtcSimulation();
+
+    bool ok() const;                       // Runway model and flight source loaded
+
+    // VIRTUAL clock: runs every event due up to until_us on this thread.
+    // Returns false once the run has ended.
+    bool step(long long until_us);
+    void run();                            // To the end, on either clock
+    void start();                          // REAL-TIME: starts the workers, returns
+    void wait();                           // Until the run has ended and sinks are closed
+    void stop();                           // Ends the run early
+
+    // Callable from any thread while the run is going
+    bool running() const;
+    long long now_us() const;
+    AtcStats stats() const;
+    bool flight(int index, AtcFlightInfo* info) const;
+    int find_flight(const char* flight_number) const; // Slot index or -1
+    int runway_count() const;
+    const char* runway_name(int runway) const;
+    const WorldSnapshot& latest_snapshot(); // One renderer thread only
+    void record_frame(long long frame_ns);  // Renderer frame time, for metrics
+
+    // Reports, once the run has ended
+    void print_report() const;
+    bool write_metrics(const char* path) const;
+    int write_scenario(const char* path);   // Drains the flight source to a binary scenario
+
+private:
+    AtcState* state;
+    AtcSimulation(const AtcSimulation&);
+    AtcSimulation& operator=(const AtcSimulation&);
+};
+
+// ========================== REPLAY ==========================================
+
+struct TraceReplay;
+
+/*
+Reads a trace written with AtcConfig::trace_path and reconstructs the
+world at any simulated time: seek() jumps to the nearest snapshot at or
+before the target and applies the records after it, so scrubbing costs
+at most one snapshot interval of records wherever the target is. Queries
+answer for the time of the last seek(); the trace is mapped, not loaded.
+*/
+class AtcReplay {
+public:
+    AtcReplay();
+    ~AtcReplay();
+
+    bool open(const char* path);           // False if it is not a trace
+    long long end_us() const;              // Last recorded time
+    long long now_us() const;
+    void seek(long long t_us);
+
+    AtcStats stats() const;                // Fleet, AVN and time fields only
+    bool flight(int index, AtcFlightInfo* info) const;
+    int find_flight(const char* flight_number) const;
+    int runway_count() const;
+    const char* runway_name(int runway) const;
+    int runway_holder(int runway) const;   // Fleet index, -1 when free
+    const WorldSnapshot& snapshot();       // The world at now_us(), for a renderer
+
+private:
+    TraceReplay* state;
+    AtcReplay(const AtcReplay&);
+    AtcReplay& operator=(const AtcReplay&);
+};
+
+// ========================== CAPACITY PLANNING ===============================
+
+/*
+A Monte Carlo sweep: many seeded headless runs for every combination of
+runway count, runway occupancy time and traffic mix, spread over all
+cores. Each grid point's runway delay, holding time and AVN count are
+summarised across its runs as they finish (means with 95% confidence
+intervals, percentiles); no run is kept. Runways and occupancy describe
+the built-in airport, so they can't be swept with an airports file.
+*/
+struct MonteCarloPlan {
+    int runs;                      // Seeded runs per grid point
+    int threads;                   // Runs at once; 0 = one per online core
+    std::vector<int> runways;      // Grid axes; an empty one keeps the base config's value
+    std::vector<double> occupancy_s;
+    std::vector<double> mixes;     // COMMERCIAL,CARGO,EMERGENCY weight triples
+    FILE* report;                  // One block per finished point; NULL = stdout
+    const char* csv_path;          // One row per finished point; NULL = none
+    MonteCarloPlan();
+};
+
+int run_monte_carlo(const AtcConfig& base, const MonteCarloPlan& plan);
+
+// ========================== TOOLS ===========================================
+
+// Stand-alone entry points of the command-line front end
+long long monotonic_ns();
+void safe_print(const std::string& msg);
+int run_avn_query(const char* store_path, const char* key);
+int run_portal(const char* channel_name, const char* airline);
+int run_billing_summary(const char* store_path);
+int run_payment_gateway(const char* store_path);
+int run_payment_request(const char* avn_id, bool appeal);
+int run_payment_benchmark(int portals);
+int run_ipc_benchmark(long long n);
+int run_radar_benchmark(int n);
+int run_separation_benchmark(int max_n);
+int run_tick_benchmark(int n);
+
+#endif // ATC_SIM_H
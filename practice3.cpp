@@ -1,39 +1,36 @@
- /*
+/*
     🧚✈️ AIR TRAFFIC CONTROL SIMULATOR ✈️🧚
        BY EMAN IHSAN AND FATIMA TUZ ZAHRA
 
-
-
---------------------------------- MOD1 ----------------------------------
-Aircraft Movement & Speed Violation Monitoring
-- Each aircraft (thread) simulates a full journey: either ARRIVAL or DEPARTURE.
-- ARRIVAL aircraft pass through: HOLDING → APPROACH → LANDING → TAXI → GATE.
-- DEPARTURE aircraft pass through: GATE → TAXI → TAKEOFF → CLIMB → CRUISE.
-- Speed is randomized in each phase (smtimes outside limits).
-- A parallel radar monitor thread checks speed violations per aircraft per phase.
-- AVNS are once per aircraft for any speed issue.
-- Aircraft behavior is thread safe using per-aircraft mutex locks.
-
---------------------------------- MOD2 ----------------------------------
-Runway Synchronization & Priority-Based Access
-- Three runways (RWY-A, RWY-B, RWY-C) are shared resources protected by mutexes.
-- Only one aircraft may use a runway at a time; access is synchronized.
-- Emergency flights are given immediate access to runways( high priority using queue).
-- Commercial and Cargo aircraft retry access based on increasing wait times.
-- Aircraft requesting LANDING (ARRIVAL) or TAKEOFF (DEPARTURE) phases trigger runway requests.
-- Once granted access, aircraft occupy the runway for a fixed time 3s, then release it.
-- A global mutex (runway_queue_lock) ensures fair and race-free assignment decisions.
-extra stuff:
-- Multithreading: Each aircraft is a thread, simulating independent behavior.
-- Radar Monitor: A monitoring thread operates like an air traffic radar system.
-- Synchronization: Aircraft and runway threads require tight mutex coordination.
-- Prioritization: Real-world emergency protocols influence access logic.
-- Scalability: Design sets up for Module 3 (e.g., billing, GUI integration).
+Command-line front end for the simulation core in atc_sim.cpp: parses the
+flags into an AtcConfig, forks the airline portals, runs the simulation
+with or without the SFML window, then prints the reports and launches the
+billing portal, which settles the AVNs through the payment gateway
+(--gateway serves it stand-alone for --pay/--appeal). --instances N runs
+N independent simulations side by side in this one process instead, and
+--monte-carlo RUNS sweeps a grid of runway counts, occupancy times and
+traffic mixes (--sweep-runways, --sweep-occupancy, --sweep-mix) with RUNS
+seeded headless runs per point on every core, reporting delay, holding
+and AVN distributions. --sequencing lookahead grants runways by a plan of
+the next 256 landings and takeoffs per airport instead of by priority
+alone; flights past that horizon join the plan when they ask, and the
+runway report counts them. --record FILE saves the run as a trace, and
+--replay FILE reads one back: in the window with a scrub bar of keys, or
+headless as a report of the world at each --at time.
+
+Build:
+    g++ -std=c++17 -O2 -march=native practice3.cpp atc_sim.cpp -o atc -lsfml-graphics -lsfml-window -lsfml-system -lpthread -lrt
+Without SFML (server and batch runs):
+    g++ -std=c++17 -O2 -march=native -DATC_HEADLESS practice3.cpp atc_sim.cpp -o atc -lpthread -lrt
 ============================================================================
 */
 
+#include "atc_sim.h"
+// Build with -DATC_HEADLESS for server runs without SFML at all
+#ifndef ATC_HEADLESS
 #include <SFML/Graphics.hpp>
 #include <SFML/Window.hpp>
+#endif
 #include <chrono>
 #include <iomanip>
 #include <sstream>
@@ -41,435 +38,652 @@ extra stuff:
 #include <iostream>
 #include <pthread.h>
 #include <unistd.h>
+#include <sys/wait.h>
 #include <cstdlib>
 #include <ctime>
 #include <cstring>
-#include<cmath>
-using namespace std;
-#define FINE_COMMERCIAL 5000
-#define FINE_CARGO 3000
-#define FINE_EMERGENCY 1000
-
-// ========================== ENUMS AND CONSTANTS =============================
-
-// Defines all the flight phases, aircraft types, and direction types
-
-enum Phase { HOLDING, APPROACH, LANDING, TAXI, GATE, TAKEOFF, CLIMB, CRUISE };
-enum FlightType { ARRIVAL, DEPARTURE };
-enum AircraftType { COMMERCIAL, CARGO, EMERGENCY };
-bool runwaysInUse[3] = {false, false, false}; // RWY-A, RWY-B, RWY-C
-
-// Names of phases used in console output
-const char* PHASE_NAMES[] = {
-    "Holding", "Approach", "Landing", "Taxi", "Gate",
-    "Takeoff", "Climb", "Cruise"
-};
-// Horizontal positions for each phase
-const float PHASE_X_POSITIONS[] = {
-    100.f, // HOLDING or GATE
-    200.f, // APPROACH or TAXI
-    300.f, // LANDING or TAKEOFF
-    400.f, // TAXI or CLIMB
-    500.f, // GATE or CRUISE
-};
+#include <strings.h>
+#include <algorithm>
+#include <climits>
 
+using namespace std;
 
-// Speed ranges per phase for ARRIVAL flights
-const int ARRIVAL_SPEED_LIMITS[][2] = {
-    {400, 600}, // Holding
-    {240, 290}, // Approach
-    {30, 240},  // Landing
-    {15, 30},   // Taxi
-    {0, 5}      // Gate
-};
+const char* DEFAULT_ASSETS = "/mnt/c/Users/USR/Downloads"; // --assets DIR: sprites and font
 
-// Speed ranges per phase for DEPARTURE flights
-const int DEPARTURE_SPEED_LIMITS[][2] = {
-    {0, 5},     // Gate
-    {15, 30},   // Taxi
-    {0, 290},   // Takeoff
-    {250, 463}, // Climb
-    {800, 900}  // Cruise
+#ifndef ATC_HEADLESS
+// Sub-rectangle of the aircraft atlas, in texels
+struct AtlasRegion {
+    float left, top, width, height;
 };
 
-const int NUM_AIRCRAFTS = 6; // Simulating 6 flights across airlines
-
-sf::Texture commercialTexture;
-    sf::Texture cargoTexture;
-    sf::Texture emergencyTexture;
+sf::Texture aircraftAtlas;          // Commercial, cargo and emergency sprites side by side
+    AtlasRegion atlasRegions[3];    // Indexed by AircraftType
     sf::Texture runwayTexture;
+#endif
 
-// ========================== STRUCT DEFINITIONS ==============================
-
-// Aircraft holds flight metadata, current phase, speed, and AVN tracking
-struct Aircraft {
-    char flight_number[10];
-    FlightType direction;
-    AircraftType type;
-    Phase current_phase;
-    int speed;
-    bool is_active;
-    bool avn_issued;
-    pthread_mutex_t lock;
-     sf::Vector2f position;  // For rendering
-};
-// Runway structure will be useful in Module 2
-struct Runway {
-    const char* name;
-    pthread_mutex_t lock;
-};
+// ========================== VISUALIZER ======================================
+#ifndef ATC_HEADLESS
+/*
+Rendering is batched: every aircraft is one quad in a single sf::VertexArray
+textured from a packed atlas, so a frame costs one draw call for the fleet
+no matter how many aircraft there are. Phase boundaries and runways are
+static geometry built once; only the runway colours change between frames.
+*/
 
-// ========================== GLOBAL VARIABLES ================================
+const float AIRCRAFT_SCALE = 0.1f;       // Sprite size relative to its image
+const float PHASE_LINE_OFFSET = 100.f;   // Offset to move the lines to the right
+
+// Packs the three aircraft images into one texture, left to right.
+// A missing image gets a plain coloured square so the aircraft stays visible.
+void build_aircraft_atlas(const string& assets) {
+    const string paths[3] = {
+        assets + "/newairplane.png",
+        assets + "/newcargo.png",
+        assets + "/emergency.png"
+    };
+    const sf::Color placeholders[3] = {sf::Color::White, sf::Color(255, 200, 0), sf::Color::Red};
+
+    sf::Image images[3];
+    unsigned width = 0, height = 0;
+    for (int t = 0; t < 3; ++t) {
+        if (!images[t].loadFromFile(paths[t])) {
+            std::cout << "Failed to load " << AIRCRAFT_TYPE_NAMES[t] << " texture\n";
+            images[t].create(320, 320, placeholders[t]);
+        }
+        sf::Vector2u size = images[t].getSize();
+        atlasRegions[t].left = (float)width;
+        atlasRegions[t].top = 0.f;
+        atlasRegions[t].width = (float)size.x;
+        atlasRegions[t].height = (float)size.y;
+        width += size.x;
+        height = max(height, size.y);
+    }
 
-Aircraft aircrafts[NUM_AIRCRAFTS];
-Runway runways[3] = {
-    {"RWY-A", PTHREAD_MUTEX_INITIALIZER},
-    {"RWY-B", PTHREAD_MUTEX_INITIALIZER},
-    {"RWY-C", PTHREAD_MUTEX_INITIALIZER}
-};
-bool simulation_running = true;
-pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER; // Mutex for clean console output
-// ========================== GLOBAL VARIABLES ================================
-pthread_mutex_t runway_queue_lock = PTHREAD_MUTEX_INITIALIZER; // [MODULE 2]
-pthread_cond_t runway_available = PTHREAD_COND_INITIALIZER;    // [MODULE 2]
-
-// Priority values: lower means higher priority
-int get_priority(AircraftType type) {
-    int result;
-
-if (type == EMERGENCY) {
-    result = 0;
-} else if (type == COMMERCIAL) {
-    result = 1;
-} else if (type == CARGO) {
-    result = 2;
-} else {
-    result = 3;
+    sf::Image atlas;
+    atlas.create(width, height, sf::Color::Transparent);
+    for (int t = 0; t < 3; ++t) {
+        atlas.copy(images[t], (unsigned)atlasRegions[t].left, 0);
+    }
+    aircraftAtlas.loadFromImage(atlas);
 }
 
-return result;
+// Fills four vertices as an axis-aligned quad
+void set_quad(sf::Vertex* quad, float x, float y, float w, float h) {
+    quad[0].position = sf::Vector2f(x, y);
+    quad[1].position = sf::Vector2f(x + w, y);
+    quad[2].position = sf::Vector2f(x + w, y + h);
+    quad[3].position = sf::Vector2f(x, y + h);
+}
 
+void set_quad_texture(sf::Vertex* quad, float u, float v, float w, float h) {
+    quad[0].texCoords = sf::Vector2f(u, v);
+    quad[1].texCoords = sf::Vector2f(u + w, v);
+    quad[2].texCoords = sf::Vector2f(u + w, v + h);
+    quad[3].texCoords = sf::Vector2f(u, v + h);
 }
 
-// ========================== HELPER FUNCTIONS ================================
-#define RESET_COLOR "\033[0m"
-#define RED_COLOR "\033[31m"
-#define GREEN_COLOR "\033[32m"
-#define YELLOW_COLOR "\033[33m"
-#define BLUE_COLOR "\033[34m"
-#define MAGENTA_COLOR "\033[35m"
-#define CYAN_COLOR "\033[36m"
-#define WHITE_COLOR "\033[37m"
-//pthread_mutex_t print_lock = PTHREAD_MUTEX_INITIALIZER;
-void safe_print(const string& msg) {
-    pthread_mutex_lock(&print_lock);
-
-    // Match patterns to assign colors
-    if (msg.find("[Runway Assigned]") != string::npos) {
-        cout << BLUE_COLOR << msg << RESET_COLOR << endl << endl;
-    } else if (msg.find("[Runway Released]") != string::npos) {
-        cout << MAGENTA_COLOR << msg << RESET_COLOR << endl << endl;
-    } else if (msg.find("[AVN]") != string::npos) {
-        cout << RED_COLOR << msg << RESET_COLOR << endl << endl;
-    } else if (msg.find("[Flight ") != string::npos) {
-        cout << GREEN_COLOR << msg << RESET_COLOR << endl;
-    } else if (msg.find("Simulation Time Ended") != string::npos) {
-        cout << YELLOW_COLOR << msg << RESET_COLOR << endl << endl;
-    } else {
-        cout << WHITE_COLOR << msg << RESET_COLOR << endl;
+void set_quad_color(sf::Vertex* quad, sf::Color color) {
+    for (int k = 0; k < 4; ++k) {
+        quad[k].color = color;
     }
+}
 
-    pthread_mutex_unlock(&print_lock);
+// Phase boundaries never move: one vertex array built once
+void build_phase_boundaries(sf::VertexArray& lines) {
+    lines.setPrimitiveType(sf::Quads);
+    lines.resize(4 * NUM_PHASES);
+    for (int p = 0; p < NUM_PHASES; ++p) {
+        sf::Vertex* quad = &lines[4 * p];
+        set_quad(quad, PHASE_X_POSITIONS[p] + PHASE_LINE_OFFSET, 0.f, 2.f, 600.f); // tall vertical line
+        set_quad_color(quad, sf::Color(150, 150, 150)); // Light gray for the phase boundary
+    }
 }
 
-void issue_avn(Aircraft* aircraft, const char* reason) {
-    if (!aircraft->avn_issued) {
-        int fine = (aircraft->type == COMMERCIAL) ? FINE_COMMERCIAL :
-                   (aircraft->type == CARGO) ? FINE_CARGO : FINE_EMERGENCY;
-
-        string log = "[AVN] Violation by Flight " + string(aircraft->flight_number) +
-                     " - " + reason + " - Fine: $" + to_string(fine);
-        safe_print(log);
-
-        // Log to file
-        FILE* f = fopen("avn_log.txt", "a");
-        if (f) {
-        time_t current_time = time(0);
-            char* dt = ctime(&current_time);
-            dt[strlen(dt) - 1] = '\0';  // Remove newline from ctime output
-cout<<RED_COLOR;
-            fprintf(f, "%s - %s - %s - Fine: $%d\n",
-                    aircraft->flight_number,
-                    (aircraft->type == COMMERCIAL ? "COMMERCIAL" :
-                     aircraft->type == CARGO ? "CARGO" : "EMERGENCY"),
-                    reason, fine);
-            fclose(f);
-        }
+// Runways stacked between y=150 and y=450 (100 px apart for the default
+// three); geometry is fixed, colour is not
+void build_runways(sf::VertexArray& quads, int count) {
+    sf::Vector2u size = runwayTexture.getSize();
+    float spacing = count > 1 ? min(100.f, 300.f / (count - 1)) : 0.f;
+    float height = count > 1 ? min(20.f, spacing * 0.8f) : 20.f;
+    quads.setPrimitiveType(sf::Quads);
+    quads.resize(4 * count);
+    for (int i = 0; i < count; ++i) {
+        sf::Vertex* quad = &quads[4 * i];
+        set_quad(quad, 100.f, 150.f + i * spacing, 800.f, height);
+        set_quad_texture(quad, 0.f, 0.f, (float)size.x, (float)size.y);
+    }
+}
 
-        aircraft->avn_issued = true;
+// Red while occupied, green while available
+void update_runways(sf::VertexArray& quads, const WorldSnapshot& snap) {
+    for (size_t i = 0; i < snap.runway_in_use.size() && 4 * i < quads.getVertexCount(); ++i) {
+        set_quad_color(&quads[4 * i], snap.runway_in_use[i] ? sf::Color::Red : sf::Color::Green);
     }
 }
 
-// [MODULE 2] Request a runway with priority-based access
-Runway* request_runway(const char* flight_number, AircraftType type) {
-    int my_priority = get_priority(type);
-
-    while (simulation_running) {
-        pthread_mutex_lock(&runway_queue_lock);
-        for (int i = 0; i < 3; ++i) {
-            if (!runwaysInUse[i] && pthread_mutex_trylock(&runways[i].lock) == 0) {
-                runwaysInUse[i] = true;
-                safe_print("[Runway Assigned] " + string(flight_number) + " is using " + runways[i].name);
-                pthread_mutex_unlock(&runway_queue_lock);
-                return &runways[i];
+// Rewrites the fleet's quads in place; the array only reallocates when
+// the fleet grows
+void update_aircraft(sf::VertexArray& quads, const WorldSnapshot& snap) {
+    size_t count = snap.aircraft.size();
+    if (quads.getVertexCount() != 4 * count) {
+        quads.resize(4 * count);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const SnapshotAircraft& aircraft = snap.aircraft[i];
+        sf::Vertex* quad = &quads[4 * i];
+
+        // Dynamic position based on aircraft phase
+        int index = 0;
+        if (aircraft.direction == ARRIVAL) {
+            // ARRIVAL phases: HOLDING(0) to GATE(4)
+            if (aircraft.phase <= GATE) {
+                index = static_cast<int>(aircraft.phase);
+            }
+        } else {
+            // DEPARTURE phases: GATE(4) to CRUISE(8)
+            if (aircraft.phase >= GATE && aircraft.phase <= CRUISE) {
+                index = static_cast<int>(aircraft.phase) - GATE;
             }
         }
+        float y_position = 100.f + 50.f * aircraft.type;  // Vertical placement by aircraft type
 
-        // If no runway is free, emergency flights wait less
-        int wait_time;
-
-if (my_priority == 0) {
-    wait_time = 1;
-} else {
-    wait_time = 2 + my_priority;
-}
-
-        pthread_mutex_unlock(&runway_queue_lock);
-        sleep(wait_time); // Simulate retry delay based on priority
+        const AtlasRegion& region = atlasRegions[aircraft.type];
+        set_quad(quad, PHASE_X_POSITIONS[index], y_position,
+                 region.width * AIRCRAFT_SCALE, region.height * AIRCRAFT_SCALE);
+        set_quad_texture(quad, region.left, region.top, region.width, region.height);
+        set_quad_color(quad, sf::Color::White);
     }
-    return nullptr;
 }
 
 
-void release_runway(Runway* runway) {
-    runwaysInUse[runway - &runways[0]] = false; // Free up the runway
-    pthread_mutex_unlock(&runway->lock); // Unlock the runway
-   
-    safe_print("[Runway Released] Runway " + string(runway->name) + " is now available.");
+// Font, sprites and runway texture; the clock text goes top-left
+void load_visual_assets(sf::Font& font, sf::Text& clockText, const string& assets) {
+clockText.setFont(font);
+clockText.setCharacterSize(20);
+clockText.setFillColor(sf::Color::White);
+clockText.setPosition(10, 10);  // top-left corner
+if (!font.loadFromFile(assets + "/arial/ARIAL.TTF")) {
+    std::cout << "Failed to load font\n";
 }
 
+build_aircraft_atlas(assets);
 
+if (!runwayTexture.loadFromFile(assets + "/runway.png")) {
+    std::cout << "Failed to load runway texture\n";
+}
+}
 
-// ========================== THREAD FUNCTIONS ================================
+// SFML window loop; returns once the user closes the window.
+// fps caps the frame rate (0 = uncapped) so rendering doesn't burn a core.
+void run_visualizer(AtcSimulation& simulation, int fps, const string& assets) {
+sf::Font font;
+sf::Text clockText;
+load_visual_assets(font, clockText, assets);
 
-/*
-Each aircraft thread runs this function. It assigns the correct
-sequence of phases based on arrival or departure type, then simulates
-speed in each phase. Speeds are randomized within acceptable ranges,
-but may occasionally violate rules, allowing radar to trigger AVNs.
-*/
+    sf::VertexArray phaseLines, runwayQuads, aircraftQuads(sf::Quads);
+    build_phase_boundaries(phaseLines);
+    build_runways(runwayQuads, simulation.runway_count());
 
+    sf::RenderWindow window(sf::VideoMode(1000, 600), "Air Traffic Control - Visualizer");
+    window.setFramerateLimit(fps);
 
-// Helper function to request a runway
+    long long last_frame = monotonic_ns();
+    while (window.isOpen()) {
+        sf::Event event;
+        while (window.pollEvent(event)) {
+            if (event.type == sf::Event::Closed)
+                window.close();
+        }
 
+        // Everything drawn this frame comes from one consistent snapshot
+        const WorldSnapshot& snap = simulation.latest_snapshot();
 
-void* flight_simulation(void* arg) {
-    Aircraft* aircraft = (Aircraft*)arg;
-    Phase phases[5];
-    int num_phases = 0;
+        update_runways(runwayQuads, snap);
+        update_aircraft(aircraftQuads, snap);
 
-    if (aircraft->direction == ARRIVAL) {
-        Phase temp[] = { HOLDING, APPROACH, LANDING, TAXI, GATE };
-        memcpy(phases, temp, sizeof(temp));
-        num_phases = 5;
-    } else {
-        Phase temp[] = { GATE, TAXI, TAKEOFF, CLIMB, CRUISE };
-        memcpy(phases, temp, sizeof(temp));
-        num_phases = 5;
-    }
+        // Three draw calls regardless of fleet size
+        window.clear(sf::Color::Black);
+        window.draw(phaseLines); // before drawing aircraft
+        window.draw(runwayQuads, sf::RenderStates(&runwayTexture));
+        window.draw(aircraftQuads, sf::RenderStates(&aircraftAtlas));
 
-    for (int i = 0; i < num_phases && simulation_running; ++i) {
-        pthread_mutex_lock(&aircraft->lock);
-        aircraft->current_phase = phases[i];
 
-        // Calculate speed limits based on phase
-        int min_speed, max_speed;
-        if (aircraft->direction == ARRIVAL) {
-            min_speed = ARRIVAL_SPEED_LIMITS[i][0];
-            max_speed = ARRIVAL_SPEED_LIMITS[i][1];
-        } else {
-            min_speed = DEPARTURE_SPEED_LIMITS[i][0];
-            max_speed = DEPARTURE_SPEED_LIMITS[i][1];
-        }
+        // Get current system time
+        auto now = std::chrono::system_clock::now();
+        std::time_t time_now = std::chrono::system_clock::to_time_t(now);
 
-        // Randomized speed within phase range, adding some randomness
-        aircraft->speed = min_speed + rand() % (max_speed - min_speed + 20);
+        std::stringstream ss;
+        ss << std::put_time(std::localtime(&time_now), "%H:%M:%S");
 
-        safe_print("[Flight " + string(aircraft->flight_number) + "] [" +
-                   (aircraft->direction == ARRIVAL ? "ARRIVAL" : "DEPARTURE") +
-                   "] Phase: " + PHASE_NAMES[phases[i]] + ", Speed: " +
-                   to_string(aircraft->speed) + " km/h");
-        pthread_mutex_unlock(&aircraft->lock);
+        // Set it to the text object
+        clockText.setString("Time: " + ss.str());
 
-        // If phase needs runway, request runway
-        bool needs_runway = (aircraft->direction == ARRIVAL && phases[i] == LANDING) ||
-                            (aircraft->direction == DEPARTURE && phases[i] == TAKEOFF);
+        // Draw the clock
+        window.draw(clockText);
 
-              if (needs_runway) {
-            Runway* assigned_runway = request_runway(aircraft->flight_number, aircraft->type); // [MODULE 2]
-            if (assigned_runway) {
-                sleep(3); // Simulate takeoff/landing
-                release_runway(assigned_runway);
-            }
-        } else {
-            sleep(3); // Simulate phase time
-        }
-// Update position
-        pthread_mutex_lock(&aircraft->lock);
-        aircraft->position.x += 20;  // Move forward per phase (example logic)
-        pthread_mutex_unlock(&aircraft->lock);
+        window.display();
+        long long frame_end = monotonic_ns();
+        simulation.record_frame(frame_end - last_frame);
+        last_frame = frame_end;
     }
-
-    pthread_mutex_lock(&aircraft->lock);
-    aircraft->is_active = false;
-    pthread_mutex_unlock(&aircraft->lock);
-    return nullptr;
 }
 
-/*
-Radar thread constantly checks each aircraft for speed compliance.
-If a violation is detected (too slow or too fast), it triggers an
-AVN. Aircrafts are only issued a violation once.
-*/
+// Same drawing over a recorded trace. Plays at normal speed from start_us;
+// Space pauses, Left/Right step 10 s, Up/Down 60 s, Home/End jump to the
+// ends. Every jump is one seek(), so scrubbing is instant anywhere.
+void run_replay_visualizer(AtcReplay& replay, long long start_us, int fps, const string& assets) {
+    sf::Font font;
+    sf::Text clockText;
+    load_visual_assets(font, clockText, assets);
 
-void* radar_monitor(void* arg) {
-    while (simulation_running) {
-        for (int i = 0; i < NUM_AIRCRAFTS; ++i) {
-            pthread_mutex_lock(&aircrafts[i].lock);
-            if (!aircrafts[i].avn_issued && aircrafts[i].is_active) {
-                Phase phase = aircrafts[i].current_phase;
-                int speed = aircrafts[i].speed;
-                int min_speed, max_speed;
-
-                if (aircrafts[i].direction == ARRIVAL) {
-                    min_speed = ARRIVAL_SPEED_LIMITS[phase][0];
-                    max_speed = ARRIVAL_SPEED_LIMITS[phase][1];
-                } else {
-                    min_speed = DEPARTURE_SPEED_LIMITS[phase][0];
-                    max_speed = DEPARTURE_SPEED_LIMITS[phase][1];
-                }
+    sf::VertexArray phaseLines, runwayQuads, aircraftQuads(sf::Quads);
+    build_phase_boundaries(phaseLines);
+    build_runways(runwayQuads, replay.runway_count());
+
+    sf::RenderWindow window(sf::VideoMode(1000, 600), "Air Traffic Control - Replay");
+    window.setFramerateLimit(fps);
 
-                if (speed < min_speed || speed > max_speed) {
-                    issue_avn(&aircrafts[i], ("Speed violation in phase " + string(PHASE_NAMES[phase])).c_str());
+    long long t = start_us;
+    bool paused = false;
+    long long last_frame = monotonic_ns();
+    while (window.isOpen()) {
+        sf::Event event;
+        while (window.pollEvent(event)) {
+            if (event.type == sf::Event::Closed) {
+                window.close();
+            } else if (event.type == sf::Event::KeyPressed) {
+                switch (event.key.code) {
+                case sf::Keyboard::Space: paused = !paused; break;
+                case sf::Keyboard::Left:  t -= 10000000LL; break;
+                case sf::Keyboard::Right: t += 10000000LL; break;
+                case sf::Keyboard::Down:  t -= 60000000LL; break;
+                case sf::Keyboard::Up:    t += 60000000LL; break;
+                case sf::Keyboard::Home:  t = 0; break;
+                case sf::Keyboard::End:   t = replay.end_us(); break;
+                default: break;
                 }
             }
-            pthread_mutex_unlock(&aircrafts[i].lock);
         }
-        usleep(500000); // 0.5s delay before next check
+        long long frame_start = monotonic_ns();
+        if (!paused) {
+            t += (frame_start - last_frame) / 1000;
+        }
+        last_frame = frame_start;
+        t = max(0LL, min(t, replay.end_us()));
+        replay.seek(t);
+
+        const WorldSnapshot& snap = replay.snapshot();
+        update_runways(runwayQuads, snap);
+        update_aircraft(aircraftQuads, snap);
+
+        window.clear(sf::Color::Black);
+        window.draw(phaseLines);
+        window.draw(runwayQuads, sf::RenderStates(&runwayTexture));
+        window.draw(aircraftQuads, sf::RenderStates(&aircraftAtlas));
+
+        char clock[64];
+        snprintf(clock, sizeof(clock), "Replay: %.1f / %.1f s%s", t / 1e6, replay.end_us() / 1e6,
+                 paused ? " (paused)" : "");
+        clockText.setString(clock);
+        window.draw(clockText);
+        window.display();
     }
-    return nullptr;
 }
+#endif // ATC_HEADLESS
 
-// Controls simulation time (default 5 minutes)
-// Controls simulation time and handles restart scenarios
+// ========================== REPLAY REPORT ===================================
 
-void* simulation_timer(void* arg) {
-    int duration = 300; // Default 5 minutes
-    while (simulation_running) {
-        sleep(50); // Timer for 5 minutes
-        safe_print("\nSimulation Time Ended.");
-        simulation_running = false; // Mark the simulation as finished
+// Headless --replay: the world at each --at time (the end if none given)
+int run_replay_report(AtcReplay& replay, const vector<double>& at_s) {
+    vector<long long> times;
+    for (size_t k = 0; k < at_s.size(); ++k) {
+        times.push_back((long long)(at_s[k] * 1e6));
     }
-    return nullptr;
-}
-void drawPhaseBoundaries(sf::RenderWindow& window) {
-    const float PHASE_LINE_OFFSET = 100.f;  // Offset to move the lines to the right
-    for (float x : PHASE_X_POSITIONS) {
-        sf::RectangleShape line(sf::Vector2f(2.f, 600.f)); // tall vertical line
-        line.setPosition(x + PHASE_LINE_OFFSET, 0.f);  // Apply the offset to the x position
-        line.setFillColor(sf::Color(150, 150, 150)); // Light gray for the phase boundary
-        window.draw(line);
+    if (times.empty()) {
+        times.push_back(replay.end_us());
+    }
+    printf("[Replay] Trace covers %.3f s, %d runways\n", replay.end_us() / 1e6, replay.runway_count());
+    for (size_t k = 0; k < times.size(); ++k) {
+        long long t0 = monotonic_ns();
+        replay.seek(times[k]);
+        long long seek_ns = monotonic_ns() - t0;
+        AtcStats s = replay.stats();
+        printf("[Replay] t=%.3f s: %lld flights admitted, %d active, %lld AVNs (seek %.1f us)\n",
+               s.sim_time_us / 1e6, s.flights_admitted, s.active_flights, s.avns_issued, seek_ns / 1e3);
+        int busy = 0;
+        for (int r = 0; r < replay.runway_count(); ++r) {
+            int holder = replay.runway_holder(r);
+            AtcFlightInfo info;
+            if (holder >= 0 && replay.flight(holder, &info)) {
+                printf("    %s: %s (%s, %s)\n", replay.runway_name(r), info.flight_number,
+                       AIRCRAFT_TYPE_NAMES[info.type], PHASE_NAMES[info.phase]);
+                busy++;
+            }
+        }
+        printf("    %d of %d runways in use\n", busy, replay.runway_count());
     }
+    return 0;
 }
 
+// ========================== PARALLEL INSTANCES ==============================
 
-// Render aircraft according to the flight phase
-void render_aircraft(sf::RenderWindow& window, const Aircraft& aircraft, sf::Texture &texture) {
-    sf::Sprite sprite;
-    sprite.setTexture(texture);
-    sprite.setScale(0.1f, 0.1f);  // Adjust size
- // Draw dotted lines between each phase location
-    
+/*
+--instances N: N independent simulations in one process, one thread each,
+seeded seed, seed+1, ... Nothing is shared between them, so each keeps its
+own event log (events.K.txt), AVN files and metrics, and there is no
+portal channel. Useful for parameter sweeps and for checking that
+instances really are independent: instance 0 matches a single run.
+*/
 
-    // Dynamic position based on aircraft phase
-    float y_position = 100.f + 50.f * aircraft.type;  // Vertical placement by aircraft type
-int index = 0;
+struct InstanceJob {
+    AtcConfig config;
+    int index;
+    const char* metrics_path;
+    AtcStats stats;
+    bool ok;
+};
 
-if (aircraft.direction == ARRIVAL) {
-    // ARRIVAL phases: HOLDING(0) to GATE(4)
-    if (aircraft.current_phase <= GATE) {
-        index = static_cast<int>(aircraft.current_phase);
+void* run_instance(void* arg) {
+    InstanceJob* job = (InstanceJob*)arg;
+    char store[64], log[64], events[64], metrics[PATH_MAX];
+    snprintf(store, sizeof(store), "avn_records.%d.bin", job->index);
+    snprintf(log, sizeof(log), "avn_log.%d.txt", job->index);
+    snprintf(events, sizeof(events), "events.%d.txt", job->index);
+    snprintf(metrics, sizeof(metrics), "%s.%d", job->metrics_path, job->index);
+    job->config.avn_store_path = store;
+    job->config.avn_log_path = log;
+    job->config.avn_channel_name = NULL;
+    job->config.console = fopen(events, "w");
+    if (!job->config.console) {
+        perror(events);
+        job->ok = false;
+        return nullptr;
     }
-} else {
-    // DEPARTURE phases: GATE(4) to CRUISE(8)
-    if (aircraft.current_phase >= GATE && aircraft.current_phase <= CRUISE) {
-        index = static_cast<int>(aircraft.current_phase) - GATE;
+
+    AtcSimulation simulation(job->config);
+    job->ok = simulation.ok();
+    if (job->ok) {
+        simulation.run();
+        simulation.print_report();
+        simulation.write_metrics(metrics);
+        job->stats = simulation.stats();
     }
+    fclose(job->config.console);
+    return nullptr;
 }
 
-sprite.setPosition(PHASE_X_POSITIONS[index], y_position);
-
-     
-   
-    window.draw(sprite);  // Draw the aircraft sprite
+int run_instances(const AtcConfig& config, int count, const char* metrics_path) {
+    vector<InstanceJob> jobs(count);
+    vector<pthread_t> threads(count);
+    long long t0 = monotonic_ns();
+    for (int k = 0; k < count; ++k) {
+        jobs[k].config = config;
+        jobs[k].config.seed = config.seed + k;
+        jobs[k].index = k;
+        jobs[k].metrics_path = metrics_path;
+        jobs[k].ok = false;
+        pthread_create(&threads[k], NULL, run_instance, &jobs[k]);
+    }
+    int failed = 0;
+    for (int k = 0; k < count; ++k) {
+        pthread_join(threads[k], NULL);
+        if (!jobs[k].ok) {
+            printf("[Instance %d] failed to load\n", k);
+            failed++;
+            continue;
+        }
+        const AtcStats& s = jobs[k].stats;
+        printf("[Instance %d] seed %llu: %lld flights, %lld AVNs, %lld separation losses, %lld radar sweeps (mean %.1f us)\n",
+               k, (unsigned long long)jobs[k].config.seed, s.flights_admitted, s.avns_issued,
+               s.separation_losses, s.radar_sweeps, s.radar_sweep_mean_us);
+    }
+    printf("[Instances] %d simulations in %.2f s wall clock\n", count, (monotonic_ns() - t0) / 1e9);
+    return failed ? 1 : 0;
 }
 
-// Render runways with visual representation of status
-void render_runways(sf::RenderWindow& window) {
-    // Render three runways at different Y positions or across the screen
-    for (int i = 0; i < 3; ++i) {
-        sf::RectangleShape runway(sf::Vector2f(800.f, 20.f)); // Adjust size accordingly
-        runway.setTexture(&runwayTexture);
-        
-        // Set runway color to indicate if it's occupied
-        if (runwaysInUse[i]) {
-            runway.setFillColor(sf::Color::Red); // Occupied runway
-        } else {
-            runway.setFillColor(sf::Color::Green); // Available runway
+// Comma- (or slash-) separated numbers for the --sweep-* flags
+bool parse_numbers(const char* text, vector<double>* out) {
+    out->clear();
+    const char* p = text;
+    for (;;) {
+        char* end;
+        double v = strtod(p, &end);
+        if (end == p) {
+            return false;
         }
-
-        runway.setPosition(100.f, 150.f + (i * 100)); // Adjust Y position for each runway
-        window.draw(runway);
+        out->push_back(v);
+        if (*end == '\0') {
+            return true;
+        }
+        if (*end != ',' && *end != '/') {
+            return false;
+        }
+        p = end + 1;
     }
 }
 
-
 // ========================== MAIN FUNCTION ===================================
-int main() {
- 
-sf::Font font;
+int main(int argc, char* argv[]) {
+    AtcConfig config;
+    bool seeded = false;
+    const char* metrics_path = "atc_metrics.json"; // --metrics-file PATH
+    vector<const char*> portal_airlines; // --portal XX (or ALL), repeatable
+    int fps = DEFAULT_FPS;
+    const char* scenario_out = NULL;     // --write-scenario FILE
+    const char* assets = DEFAULT_ASSETS; // --assets DIR
+    int instances = 0;                   // --instances N (0: one ordinary run)
+    const char* replay_path = NULL;      // --replay FILE
+    vector<double> replay_at;            // --at SECONDS, repeatable
+    MonteCarloPlan plan;                 // --sweep-* axes and --mc-* options
+    int monte_carlo_runs = 0;            // --monte-carlo RUNS (0: no sweep)
+#ifdef ATC_HEADLESS
+    bool headless = true;
+#else
+    bool headless = false;
+#endif
+
+    // --flights N scales the built-in scenario (or caps the generator),
+    // --workers N sizes the pool, --virtual runs as fast as possible
+    // (batch mode, no window)
+    for (int a = 1; a < argc; ++a) {
+        bool has_value = a + 1 < argc;
+        if (strcmp(argv[a], "--flights") == 0 && has_value) {
+            config.flights = max(1LL, atoll(argv[++a]));
+        } else if (strcmp(argv[a], "--airports") == 0 && has_value) {
+            config.airports_path = argv[++a];
+        } else if (strcmp(argv[a], "--runways") == 0 && has_value) {
+            config.runways = max(1, min(atoi(argv[++a]), 64));
+        } else if (strcmp(argv[a], "--occupancy") == 0 && has_value) {
+            config.runway_occupancy_s = max(0.001, atof(argv[++a]));
+        } else if (strcmp(argv[a], "--monte-carlo") == 0 && has_value) {
+            monte_carlo_runs = max(1, atoi(argv[++a]));
+        } else if (strcmp(argv[a], "--mc-threads") == 0 && has_value) {
+            plan.threads = max(1, atoi(argv[++a]));
+        } else if (strcmp(argv[a], "--mc-csv") == 0 && has_value) {
+            plan.csv_path = argv[++a];
+        } else if (strcmp(argv[a], "--sweep-runways") == 0 && has_value) {
+            vector<double> values;
+            if (!parse_numbers(argv[++a], &values)) {
+                fprintf(stderr, "--sweep-runways expects a list of runway counts, e.g. 2,3,4\n");
+                return 1;
+            }
+            for (size_t v = 0; v < values.size(); ++v) {
+                plan.runways.push_back(max(1, min((int)values[v], 64)));
+            }
+        } else if (strcmp(argv[a], "--sweep-occupancy") == 0 && has_value) {
+            if (!parse_numbers(argv[++a], &plan.occupancy_s)) {
+                fprintf(stderr, "--sweep-occupancy expects a list of seconds, e.g. 2.5,3,4\n");
+                return 1;
+            }
+            for (size_t v = 0; v < plan.occupancy_s.size(); ++v) {
+                plan.occupancy_s[v] = max(0.001, plan.occupancy_s[v]);
+            }
+        } else if (strcmp(argv[a], "--sweep-mix") == 0 && has_value) {
+            bool ok = parse_numbers(argv[++a], &plan.mixes) && !plan.mixes.empty() && plan.mixes.size() % 3 == 0;
+            for (size_t m = 0; ok && m < plan.mixes.size(); m += 3) {
+                const double* w = &plan.mixes[m];
+                ok = w[0] >= 0 && w[1] >= 0 && w[2] >= 0 && w[0] + w[1] + w[2] > 0;
+            }
+            if (!ok) {
+                fprintf(stderr, "--sweep-mix expects COMMERCIAL,CARGO,EMERGENCY weight triples separated by /\n");
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--sequencing") == 0 && has_value) {
+            const char* name = argv[++a];
+            if (strcasecmp(name, SEQUENCING_NAMES[SEQUENCING_GREEDY]) == 0) {
+                config.sequencing = SEQUENCING_GREEDY;
+            } else if (strcasecmp(name, SEQUENCING_NAMES[SEQUENCING_LOOKAHEAD]) == 0) {
+                config.sequencing = SEQUENCING_LOOKAHEAD;
+            } else {
+                fprintf(stderr, "--sequencing expects greedy or lookahead (plans up to 256 flights per airport)\n");
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--scenario") == 0 && has_value) {
+            config.scenario_path = argv[++a];
+        } else if (strcmp(argv[a], "--write-scenario") == 0 && has_value) {
+            scenario_out = argv[++a];
+        } else if (strcmp(argv[a], "--generate") == 0 && has_value) {
+            config.generate_rate = max(0.0, atof(argv[++a]));
+        } else if (strcmp(argv[a], "--mix") == 0 && has_value) {
+            double* mix = config.mix;
+            if (sscanf(argv[++a], "%lf,%lf,%lf", &mix[0], &mix[1], &mix[2]) != 3 ||
+                mix[0] < 0 || mix[1] < 0 || mix[2] < 0 || mix[0] + mix[1] + mix[2] <= 0) {
+                fprintf(stderr, "--mix expects three non-negative weights: COMMERCIAL,CARGO,EMERGENCY\n");
+                return 1;
+            }
+        } else if (strcmp(argv[a], "--workers") == 0 && has_value) {
+            config.workers = max(1, atoi(argv[++a]));
+        } else if (strcmp(argv[a], "--tick-workers") == 0 && has_value) {
+            config.tick_workers = max(1, atoi(argv[++a]));
+        } else if (strcmp(argv[a], "--metrics-interval") == 0 && has_value) {
+            config.metrics_interval_s = max(0.0, atof(argv[++a]));
+        } else if (strcmp(argv[a], "--metrics-file") == 0 && has_value) {
+            metrics_path = argv[++a];
+        } else if (strcmp(argv[a], "--log-level") == 0 && has_value) {
+            const char* name = argv[++a];
+            int l = 0;
+            while (l <= LOG_OFF && strcasecmp(name, LOG_LEVEL_NAMES[l]) != 0) {
+                ++l;
+            }
+            if (l > LOG_OFF) {
+                fprintf(stderr, "--log-level expects debug, info, warn or off\n");
+                return 1;
+            }
+            config.log_level = (LogLevel)l;
+        } else if (strcmp(argv[a], "--duration") == 0 && has_value) {
+            config.duration_s = max(1, atoi(argv[++a]));
+        } else if (strcmp(argv[a], "--time-scale") == 0 && has_value) {
+            config.time_scale = max(0.001, atof(argv[++a]));
+        } else if (strcmp(argv[a], "--seed") == 0 && has_value) {
+            config.seed = (unsigned int)strtoul(argv[++a], NULL, 10);
+            seeded = true;
+        } else if (strcmp(argv[a], "--radar-hz") == 0 && has_value) {
+            config.radar_hz = max(0.01, atof(argv[++a]));
+        } else if (strcmp(argv[a], "--virtual") == 0) {
+            config.clock_mode = CLOCK_MODE_VIRTUAL;
+        } else if (strcmp(argv[a], "--headless") == 0) {
+            headless = true;
+        } else if (strcmp(argv[a], "--fps") == 0 && has_value) {
+            fps = max(0, atoi(argv[++a]));
+        } else if (strcmp(argv[a], "--snapshot-hz") == 0 && has_value) {
+            config.snapshot_hz = max(0.01, atof(argv[++a]));
+        } else if (strcmp(argv[a], "--assets") == 0 && has_value) {
+            assets = argv[++a];
+        } else if (strcmp(argv[a], "--record") == 0 && has_value) {
+            config.trace_path = argv[++a];
+        } else if (strcmp(argv[a], "--trace-snapshot") == 0 && has_value) {
+            config.trace_snapshot_s = max(0.001, atof(argv[++a]));
+        } else if (strcmp(argv[a], "--replay") == 0 && has_value) {
+            replay_path = argv[++a];
+        } else if (strcmp(argv[a], "--at") == 0 && has_value) {
+            replay_at.push_back(max(0.0, atof(argv[++a])));
+        } else if (strcmp(argv[a], "--instances") == 0 && has_value) {
+            instances = max(1, atoi(argv[++a]));
+        } else if (strcmp(argv[a], "--avn-query") == 0 && has_value) {
+            return run_avn_query(config.avn_store_path, argv[++a]);
+        } else if (strcmp(argv[a], "--portal") == 0 && has_value) {
+            portal_airlines.push_back(argv[++a]);
+        } else if (strcmp(argv[a], "--portal-attach") == 0 && has_value) {
+            return run_portal(config.avn_channel_name, argv[++a]);
+        } else if (strcmp(argv[a], "--gateway") == 0) {
+            return run_payment_gateway(config.avn_store_path);
+        } else if (strcmp(argv[a], "--pay") == 0 && has_value) {
+            return run_payment_request(argv[++a], false);
+        } else if (strcmp(argv[a], "--appeal") == 0 && has_value) {
+            return run_payment_request(argv[++a], true);
+        } else if (strcmp(argv[a], "--bench-payments") == 0 && has_value) {
+            return run_payment_benchmark(max(1, atoi(argv[++a])));
+        } else if (strcmp(argv[a], "--bench-ipc") == 0 && has_value) {
+            return run_ipc_benchmark(max(1LL, atoll(argv[++a])));
+        } else if (strcmp(argv[a], "--bench-separation") == 0 && has_value) {
+            return run_separation_benchmark(max(1000, atoi(argv[++a])));
+        } else if (strcmp(argv[a], "--bench-radar") == 0 && has_value) {
+            return run_radar_benchmark(max(1, atoi(argv[++a])));
+        } else if (strcmp(argv[a], "--bench-tick") == 0 && has_value) {
+            return run_tick_benchmark(max(1, atoi(argv[++a])));
+        }
+    }
 
+    if (replay_path) {
+        AtcReplay replay;
+        if (!replay.open(replay_path)) {
+            fprintf(stderr, "%s: not a readable trace\n", replay_path);
+            return 1;
+        }
+#ifndef ATC_HEADLESS
+        if (!headless) {
+            run_replay_visualizer(replay, replay_at.empty() ? 0 : (long long)(replay_at[0] * 1e6), fps, assets);
+            return 0;
+        }
+#endif
+        return run_replay_report(replay, replay_at);
+    }
 
-sf::Text clockText;
-clockText.setFont(font);
-clockText.setCharacterSize(20);
-clockText.setFillColor(sf::Color::White);
-clockText.setPosition(10, 10);  // top-left corner
-if (!font.loadFromFile("/mnt/c/Users/USR/Downloads/arial/ARIAL.TTF")) {
-    std::cout << "Failed to load font\n";
-}
+    // Capacity planning: a whole grid of seeded runs, no window, no portals
+    if (monte_carlo_runs > 0) {
+        plan.runs = monte_carlo_runs;
+        if (!seeded) {
+            config.seed = 1;
+        }
+        return run_monte_carlo(config, plan);
+    }
 
-if (!commercialTexture.loadFromFile("/mnt/c/Users/USR/Downloads/newairplane.png")) {
-    std::cout << "Failed to load commercial texture\n";
-}
+    // Virtual runs are meant to be reproducible, so they never seed from time
+    if (!seeded) {
+        config.seed = (config.clock_mode == CLOCK_MODE_VIRTUAL) ? 1 : (unsigned int)time(NULL);
+    }
+    // Only the window consumes snapshots; headless and batch runs skip them
+    bool visual = config.clock_mode == CLOCK_MODE_REALTIME && !headless && instances == 0;
+    if (!visual) {
+        config.snapshot_hz = 0;
+    }
 
-if (!cargoTexture.loadFromFile("/mnt/c/Users/USR/Downloads/newcargo.png")) {
-    std::cout << "Failed to load cargo texture\n";
-}
+    if (instances > 0) {
+        config.trace_path = NULL; // One trace per run; instances would share the file
+        return run_instances(config, instances, metrics_path);
+    }
 
-if (!emergencyTexture.loadFromFile("/mnt/c/Users/USR/Downloads/emergency.png")) {
-    std::cout << "Failed to load emergency texture\n";
-}
+    // Loads the runway model and flight source and creates the portal
+    // channel; no threads yet, so the portals can still be forked
+    AtcSimulation simulation(config);
+    if (!simulation.ok()) {
+        return 1;
+    }
+    if (scenario_out) {
+        return simulation.write_scenario(scenario_out);
+    }
 
-if (!runwayTexture.loadFromFile("/mnt/c/Users/USR/Downloads/runway.png")) {
-    std::cout << "Failed to load runway texture\n";
-}
 std::ofstream clearLog("avnlog.txt", std::ofstream::out | std::ofstream::trunc);
     clearLog.close();
-FILE* clear_log = fopen("/mnt/c/Users/USR/Downloads/avn_log.txt", "w");
-if (clear_log) fclose(clear_log); // Clears previous run
-
-srand(time(NULL));
+vector<pid_t> portal_pids;
+fflush(stdout);
+for (size_t p = 0; p < portal_airlines.size(); ++p) {
+    pid_t portal = fork();
+    if (portal == 0) {
+        _exit(run_portal(config.avn_channel_name, portal_airlines[p])); // CHILD PROCESS: Airline Portal
+    }
+    portal_pids.push_back(portal);
+}
 
 
     printf("🧚✈️ AIR TRAFFIC CONTROL SIMULATOR ✈️🧚\n   BY EMAN IHSAN AND FATIMA TUZ ZAHRA\n\n");
@@ -483,125 +697,44 @@ std::cout << "Phase 5 (500): Gate or Cruise - The aircraft is either at the gate
 std::cout << "--------------------------------------------" << std::endl;
 std::cout << "These phases represent key stages of an aircraft's journey, with overlapping roles for each phase." << std::endl;
 
-    const char* flight_ids[NUM_AIRCRAFTS] = { "PK303", "FX101", "ED220", "AF001", "BD321", "AK911" };
-    AircraftType types[NUM_AIRCRAFTS] = { COMMERCIAL, CARGO, COMMERCIAL, EMERGENCY, CARGO, EMERGENCY };
-    FlightType directions[NUM_AIRCRAFTS] = { ARRIVAL, ARRIVAL, DEPARTURE, DEPARTURE, ARRIVAL, DEPARTURE };
-
-    pthread_t flight_threads[NUM_AIRCRAFTS];
-    pthread_t radar_thread, timer_thread;
-
-    // Initialize aircrafts
-    for (int i = 0; i < NUM_AIRCRAFTS; ++i) {
-        strncpy(aircrafts[i].flight_number, flight_ids[i], 10);
-        aircrafts[i].type = types[i];
-        aircrafts[i].direction = directions[i];
-        aircrafts[i].current_phase = GATE;
-        aircrafts[i].speed = 0;
-        aircrafts[i].is_active = true;
-        aircrafts[i].avn_issued = false;
-        aircrafts[i].position = sf::Vector2f(50.f, 100.f + 70.f * i);  // Initial Y offset
-        pthread_mutex_init(&aircrafts[i].lock, NULL);
+    if (config.clock_mode == CLOCK_MODE_VIRTUAL) {
+        // Batch run: no window, no worker pool, deterministic for a seed
+        simulation.run();
+    } else {
+        simulation.start();
     }
-//pthread_t radar_thread;
-pthread_create(&radar_thread, NULL, radar_monitor, NULL);
 
-    // Create aircraft threads
-    for (int i = 0; i < NUM_AIRCRAFTS; ++i) {
-        pthread_create(&flight_threads[i], NULL, flight_simulation, (void*)&aircrafts[i]);
+    // === SFML VISUALIZATION LOOP === (real-time runs with a window only)
+#ifndef ATC_HEADLESS
+    if (visual) {
+        run_visualizer(simulation, fps, assets);
     }
-
-    pthread_create(&radar_thread, NULL, radar_monitor, NULL);
-    pthread_create(&timer_thread, NULL, simulation_timer, NULL);
-
-    // === SFML VISUALIZATION LOOP ===
-    sf::RenderWindow window(sf::VideoMode(1000, 600), "Air Traffic Control - Visualizer");
-
-    while (window.isOpen()) {
-        sf::Event event;
-        while (window.pollEvent(event)) {
-            if (event.type == sf::Event::Closed)
-                window.close();
-        }
-
-        window.clear(sf::Color::Black);
-drawPhaseBoundaries(window); // before drawing aircraft
-        // Draw all three runways
-    render_runways(window);
-
-        for (int i = 0; i < NUM_AIRCRAFTS; ++i) {
-    pthread_mutex_lock(&aircrafts[i].lock);
-    sf::Texture* texture = nullptr;
-    switch (aircrafts[i].type) {
-        case COMMERCIAL: texture = &commercialTexture; break;
-        case CARGO:      texture = &cargoTexture; break;
-        case EMERGENCY:  texture = &emergencyTexture; break;
-    }
-    render_aircraft(window, aircrafts[i], *texture);
-    pthread_mutex_unlock(&aircrafts[i].lock);
-}
-
-
-        // Get current system time
-        auto now = std::chrono::system_clock::now();
-        std::time_t time_now = std::chrono::system_clock::to_time_t(now);
-
-        std::stringstream ss;
-        ss << std::put_time(std::localtime(&time_now), "%H:%M:%S");
-
-        // Set it to the text object
-        clockText.setString("Time: " + ss.str());
-
-        // Draw the clock
-        window.draw(clockText);
-
-        window.display();
+#else
+    (void)visual;
+    (void)fps;
+    (void)assets;
+#endif
+
+    // Wait for the run after SFML window is closed; the workers exit once
+    // the EV_SIM_END event has run, and the sinks are closed after them
+    simulation.wait();
+    for (size_t p = 0; p < portal_pids.size(); ++p) {
+        waitpid(portal_pids[p], NULL, 0); // Live portals exit once the channel closes
     }
-
-    // Wait for threads after SFML window is closed
-    for (int i = 0; i < NUM_AIRCRAFTS; ++i) {
-        pthread_join(flight_threads[i], NULL);
+    simulation.print_report();
+    if (simulation.write_metrics(metrics_path)) {
+        printf("[Metrics] Latency histograms written to %s\n", metrics_path);
     }
-    pthread_join(radar_thread, NULL);
-    pthread_join(timer_thread, NULL);
-
-// Stop radar monitor
-    simulation_running = false;
-    pthread_join(radar_thread, NULL);
+    if (config.trace_path) {
+        printf("[Trace] Run recorded to %s (--replay to play it back)\n", config.trace_path);
+    }
+    fflush(stdout);
     pid_t pid = fork();
     if (pid == 0) {
         // CHILD PROCESS: Airline Billing Portal
-        safe_print("\n🧾 Launching Airline Billing Portal...\n");
-
-        FILE* f = fopen("avn_log.txt", "r");
-        if (!f) {
-            safe_print("No AVNs to process. All aircrafts compliant.");
-            exit(0);
-        }
-
-        char line[256];
-        int total_fine = 0;
-        safe_print("📋 AVN Fine Summary:");
-
-        while (fgets(line, sizeof(line), f)) {
-            printf("%s", line);
-
-            // Extract fine amount from end of line
-            char* dollar = strrchr(line, '$');
-            if (dollar) {
-                total_fine += atoi(dollar + 1);
-            }
-        }
-        fclose(f);
-
-        printf("\n💰 Total Fine Amount Due: $%d\n", total_fine);
-        printf("✅ Processing payment... Payment successful.\n");
-        exit(0);
-    }
-
-    // Destroy all aircraft locks
-    for (int i = 0; i < NUM_AIRCRAFTS; ++i) {
-        pthread_mutex_destroy(&aircrafts[i].lock);
+        exit(run_billing_summary(config.avn_store_path));
     }
+    waitpid(pid, NULL, 0); // Keep the portal's report ahead of the final line
 
     safe_print("\nSimulation complete. All aircraft have completed their operations.");
     return 0;